@@ -0,0 +1,42 @@
+#include "BusAirtime.h"
+
+BusAirtime::BusAirtime() { m_lastRefill = std::chrono::steady_clock::now(); }
+
+void BusAirtime::SetPollShare(uint8_t pollShare) {
+  m_pollShare = pollShare > BUS_AIRTIME_MAX_POLL_SHARE
+                    ? BUS_AIRTIME_MAX_POLL_SHARE
+                    : pollShare;
+}
+
+void BusAirtime::Refill() {
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  int64_t elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+                        now - m_lastRefill)
+                        .count();
+  m_lastRefill = now;
+
+  int64_t share = 100;
+  if (m_pollAirtime == 0 || m_pollShare == 0) {
+    m_outbound += elapsed;
+  } else {
+    share = 100 - m_pollShare;
+    m_outbound += m_pollAirtime * share / m_pollShare;
+  }
+  m_pollAirtime = 0;
+
+  if (m_outbound > BUS_AIRTIME_CYCLE * share / 100) {
+    m_outbound = BUS_AIRTIME_CYCLE * share / 100;
+  }
+}
+
+size_t BusAirtime::GetOutboundFrames(uint32_t frameAirtime) {
+  if (m_outbound <= 0 || frameAirtime == 0) {
+    return 0;
+  }
+
+  return (size_t)((m_outbound + frameAirtime - 1) / frameAirtime);
+}
+
+void BusAirtime::ChargeOutbound(uint32_t airtime) { m_outbound -= airtime; }
+
+void BusAirtime::ChargePoll(uint32_t airtime) { m_pollAirtime += airtime; }
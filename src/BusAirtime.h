@@ -0,0 +1,44 @@
+#pragma once
+
+#include <inttypes.h>
+
+#include <chrono>
+#include <cstddef>
+
+// Percentage of the bus airtime reserved for switch polling if not configured.
+#define BUS_AIRTIME_DEFAULT_POLL_SHARE 50
+// Polling never gets more than this, so outbound events always get through.
+#define BUS_AIRTIME_MAX_POLL_SHARE 90
+// Length of a budget cycle in microseconds. Unused outbound airtime is saved
+// for at most one cycle.
+#define BUS_AIRTIME_CYCLE 10000
+
+// Splits the airtime of a bus between outbound events and switch polling.
+// Polls are charged with the time they really took, including turnarounds,
+// responses and timeouts. Outbound events earn their budget in proportion to
+// that, so a flood of events delays the events instead of the switch
+// polling, however long a poll takes. It belongs to the serial thread.
+class BusAirtime {
+ public:
+  BusAirtime();
+
+  void SetPollShare(uint8_t pollShare);
+  uint8_t GetPollShare() { return m_pollShare; }
+
+  // Refills the outbound budget for the polls charged since the last call.
+  // If nothing got polled, outbound events get the whole time passed.
+  void Refill();
+  // Returns how many frames of the given airtime in microseconds fit into the
+  // outbound budget.
+  size_t GetOutboundFrames(uint32_t frameAirtime);
+  void ChargeOutbound(uint32_t airtime);
+  void ChargePoll(uint32_t airtime);
+
+ private:
+  uint8_t m_pollShare = BUS_AIRTIME_DEFAULT_POLL_SHARE;
+  // Outbound budget in microseconds.
+  int64_t m_outbound = 0;
+  // Airtime of the polls since the last refill in microseconds.
+  int64_t m_pollAirtime = 0;
+  std::chrono::steady_clock::time_point m_lastRefill;
+};
@@ -0,0 +1,117 @@
+#include "IntensityFilter.h"
+
+#include <stdlib.h>
+
+void IntensityFilter::Configure(uint8_t sourceId, uint16_t number,
+                                uint16_t levels, uint8_t hysteresis,
+                                uint16_t maxRate) {
+  if (levels < 2) {
+    levels = 2;
+  } else if (levels > 256) {
+    levels = 256;
+  }
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  Output& output = GetOutput(sourceId, number);
+  output.levels = levels;
+  output.hysteresis = hysteresis;
+  output.interval = maxRate > 0 ? 1000 / maxRate : 0;
+}
+
+// Has to be called with the mutex locked.
+IntensityFilter::Output& IntensityFilter::GetOutput(uint8_t sourceId,
+                                                    uint16_t number) {
+  uint32_t key = ((uint32_t)sourceId << 16) | number;
+  auto it = m_outputs.find(key);
+  if (it != m_outputs.end()) {
+    return it->second;
+  }
+
+  Output& output = m_outputs[key];
+  output.sourceId = sourceId;
+  output.number = number;
+  return output;
+}
+
+void IntensityFilter::Set(uint8_t sourceId, uint16_t number,
+                          uint8_t intensity) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  Output& output = GetOutput(sourceId, number);
+  output.intensity = intensity;
+  if (output.pending) {
+    // Replaces an intensity that didn't make it to the bus.
+    m_suppressedUpdates++;
+    return;
+  }
+
+  output.pending = true;
+  m_pending.push_back(&output);
+  m_pendingCount++;
+}
+
+int16_t IntensityFilter::Quantize(const Output& output) {
+  int32_t steps = output.levels - 1;
+  int16_t level = (int16_t)((output.intensity * steps + 127) / 255);
+  if (level == output.sentLevel) {
+    return -1;
+  }
+
+  // Fully off and fully on always get through, the hysteresis must not keep
+  // an output glowing.
+  if (output.sentLevel < 0 || output.intensity == 0 ||
+      output.intensity == 255) {
+    return level;
+  }
+
+  // The intensity has to leave the band of the sent level by more than the
+  // hysteresis. Everything is scaled by steps to stay in integers, so half a
+  // step is 255 / 2.
+  int32_t distance = abs(output.intensity * steps - output.sentLevel * 255);
+  if (distance * 2 < 255 + 2 * output.hysteresis * steps) {
+    return -1;
+  }
+
+  return level;
+}
+
+size_t IntensityFilter::Poll(uint64_t now, Event** events, size_t max) {
+  if (m_pendingCount == 0) {
+    return 0;
+  }
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  size_t count = 0;
+  size_t kept = 0;
+  for (Output* output : m_pending) {
+    if (count >= max) {
+      m_pending[kept++] = output;
+      continue;
+    }
+
+    int16_t level = Quantize(*output);
+    if (level < 0) {
+      output->pending = false;
+      m_suppressedUpdates++;
+      continue;
+    }
+
+    if (output->sentLevel >= 0 && now - output->lastSent < output->interval) {
+      // Sent with the latest intensity once the interval passed.
+      m_pending[kept++] = output;
+      continue;
+    }
+
+    // The board gets the level scaled back to 0..255, so 0 stays off and the
+    // highest level is full brightness.
+    int32_t steps = output->levels - 1;
+    events[count++] = new Event(output->sourceId, output->number,
+                                (uint8_t)((level * 255 + steps / 2) / steps));
+    output->sentLevel = level;
+    output->lastSent = now;
+    output->pending = false;
+  }
+  m_pending.resize(kept);
+  m_pendingCount = kept;
+
+  return count;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <inttypes.h>
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include "io-boards/Event.h"
+
+// Defaults for outputs without an intensity configuration. The hysteresis is
+// given in steps of the 0..255 intensity range, the rate in updates per
+// second.
+#define INTENSITY_FILTER_DEFAULT_LEVELS 16
+#define INTENSITY_FILTER_DEFAULT_HYSTERESIS 4
+#define INTENSITY_FILTER_DEFAULT_MAX_RATE 50
+
+// Turns the intensities of lamps and flashers into output events of a bus.
+// Intensities are quantized to the brightness levels of the output and only
+// sent when the level changes by more than the hysteresis, at most maxRate
+// times per second. The host sets intensities from any thread, the serial
+// thread collects the resulting events.
+class IntensityFilter {
+ public:
+  IntensityFilter() {}
+
+  // levels is the number of brightness levels of the output, 2 to 256. A
+  // maxRate of 0 disables the rate limit.
+  void Configure(uint8_t sourceId, uint16_t number, uint16_t levels,
+                 uint8_t hysteresis, uint16_t maxRate);
+
+  void Set(uint8_t sourceId, uint16_t number, uint8_t intensity);
+  // Appends up to max events for outputs that changed their level and are
+  // due. Outputs that are rate limited stay pending. now is a tick in ms.
+  size_t Poll(uint64_t now, Event** events, size_t max);
+
+  uint32_t GetSuppressedUpdates() { return m_suppressedUpdates; }
+
+ private:
+  struct Output {
+    uint8_t sourceId = 0;
+    uint16_t number = 0;
+    uint16_t levels = INTENSITY_FILTER_DEFAULT_LEVELS;
+    uint8_t hysteresis = INTENSITY_FILTER_DEFAULT_HYSTERESIS;
+    // Minimum time in ms between two updates.
+    uint16_t interval = 1000 / INTENSITY_FILTER_DEFAULT_MAX_RATE;
+
+    uint8_t intensity = 0;
+    // Level sent last, -1 if none got sent yet.
+    int16_t sentLevel = -1;
+    uint64_t lastSent = 0;
+    bool pending = false;
+  };
+
+  Output& GetOutput(uint8_t sourceId, uint16_t number);
+  // Returns the level to send or -1 if the change is suppressed.
+  int16_t Quantize(const Output& output);
+
+  std::mutex m_mutex;
+  std::map<uint32_t, Output> m_outputs;
+  // Outputs with an intensity that hasn't been processed yet, in the order
+  // they were set.
+  std::vector<Output*> m_pending;
+  std::atomic<size_t> m_pendingCount = 0;
+
+  std::atomic<uint32_t> m_suppressedUpdates = 0;
+};
@@ -0,0 +1,67 @@
+#include "LatencyHistogram.h"
+
+#include <bit>
+
+void LatencyHistogram::Record(uint32_t latency) {
+  m_buckets[GetBucket(latency)].fetch_add(1, std::memory_order_relaxed);
+  m_count.fetch_add(1, std::memory_order_relaxed);
+  if (latency > m_max) {
+    m_max = latency;
+  }
+}
+
+void LatencyHistogram::Reset() {
+  for (auto& bucket : m_buckets) {
+    bucket = 0;
+  }
+  m_count = 0;
+  m_max = 0;
+}
+
+uint32_t LatencyHistogram::GetPercentile(double percentile) {
+  uint32_t count = m_count;
+  if (count == 0) {
+    return 0;
+  }
+
+  uint64_t rank = (uint64_t)(count * percentile / 100.0 + 0.5);
+  if (rank < 1) {
+    rank = 1;
+  }
+
+  uint64_t seen = 0;
+  for (uint32_t i = 0; i < LATENCY_HISTOGRAM_BUCKETS; i++) {
+    seen += m_buckets[i];
+    if (seen >= rank) {
+      uint32_t upperBound = GetUpperBound(i);
+      return upperBound < m_max ? upperBound : (uint32_t)m_max;
+    }
+  }
+
+  return m_max;
+}
+
+uint32_t LatencyHistogram::GetBucket(uint32_t latency) {
+  if (latency < (1 << LATENCY_HISTOGRAM_SUB_BITS)) {
+    return latency;
+  }
+
+  uint32_t msb = std::bit_width(latency) - 1;
+  uint32_t shift = msb - LATENCY_HISTOGRAM_SUB_BITS;
+  uint32_t sub = (latency >> shift) & ((1 << LATENCY_HISTOGRAM_SUB_BITS) - 1);
+
+  return ((shift + 1) << LATENCY_HISTOGRAM_SUB_BITS) + sub;
+}
+
+uint32_t LatencyHistogram::GetUpperBound(uint32_t bucket) {
+  if (bucket < (1 << LATENCY_HISTOGRAM_SUB_BITS)) {
+    return bucket;
+  }
+
+  uint32_t shift = (bucket >> LATENCY_HISTOGRAM_SUB_BITS) - 1;
+  uint64_t sub = bucket & ((1 << LATENCY_HISTOGRAM_SUB_BITS) - 1);
+  uint64_t upperBound =
+      (((1 << LATENCY_HISTOGRAM_SUB_BITS) + sub + 1) << shift) - 1;
+
+  return upperBound > 0xffffffff ? 0xffffffff : (uint32_t)upperBound;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <inttypes.h>
+
+#include <atomic>
+
+// Values up to 2^LATENCY_HISTOGRAM_SUB_BITS are exact, larger ones fall into
+// one of 2^LATENCY_HISTOGRAM_SUB_BITS buckets per power of two, which keeps
+// the error below 12.5%.
+#define LATENCY_HISTOGRAM_SUB_BITS 3
+#define LATENCY_HISTOGRAM_BUCKETS \
+  ((32 - LATENCY_HISTOGRAM_SUB_BITS + 1) << LATENCY_HISTOGRAM_SUB_BITS)
+
+// Log-linear histogram of latencies in microseconds. Recording is lock free,
+// so one thread can record while another one reads the percentiles.
+class LatencyHistogram {
+ public:
+  void Record(uint32_t latency);
+  void Reset();
+
+  uint32_t GetCount() { return m_count; }
+  uint32_t GetMax() { return m_max; }
+  // Returns the upper bound of the bucket containing the given percentile,
+  // 0 if nothing got recorded.
+  uint32_t GetPercentile(double percentile);
+
+ private:
+  static uint32_t GetBucket(uint32_t latency);
+  static uint32_t GetUpperBound(uint32_t bucket);
+
+  std::atomic<uint32_t> m_buckets[LATENCY_HISTOGRAM_BUCKETS] = {};
+  std::atomic<uint32_t> m_count = 0;
+  std::atomic<uint32_t> m_max = 0;
+};
@@ -0,0 +1,111 @@
+#include "LedStripe.h"
+
+// Maximum airtime in microseconds a stripe can save up while idle.
+#define LED_STRIPE_MAX_AIRTIME_BUDGET 20000
+
+LedStripe::LedStripe(uint8_t board, uint8_t port, uint16_t amount, bool white,
+                     uint8_t airtimeShare)
+    : m_board(board),
+      m_port(port),
+      m_white(white),
+      m_airtimeShare(airtimeShare > 100 ? 100 : airtimeShare),
+      m_pending(amount, 0),
+      m_transmitted(amount, 0) {
+  m_lastRefill = std::chrono::steady_clock::now();
+}
+
+bool LedStripe::SetFrame(const uint32_t* colors, uint16_t count,
+                         uint16_t first) {
+  if ((size_t)first + count > m_pending.size()) {
+    return false;
+  }
+
+  m_mutex.lock();
+  for (uint16_t i = 0; i < count; i++) {
+    m_pending[first + i] = colors[i];
+  }
+  m_dirty = true;
+  m_mutex.unlock();
+
+  return true;
+}
+
+bool LedStripe::IsReady() {
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  int64_t elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+                        now - m_lastRefill)
+                        .count();
+  m_lastRefill = now;
+  m_airtime += elapsed * m_airtimeShare / 100;
+  if (m_airtime > LED_STRIPE_MAX_AIRTIME_BUDGET) {
+    m_airtime = LED_STRIPE_MAX_AIRTIME_BUDGET;
+  }
+
+  return (m_dirty || m_encodePosition > 0) && m_airtime >= 0;
+}
+
+size_t LedStripe::EncodeRuns(uint8_t* payload, size_t size) {
+  size_t runSize = LED_STRIPE_RUN_HEADER_SIZE + (m_white ? 4 : 3);
+  size_t position = 0;
+
+  m_mutex.lock();
+  if (m_encodePosition == 0) {
+    // Changes made from now on are part of the next pass.
+    m_dirty = false;
+  }
+
+  uint16_t i = m_encodePosition;
+  while (i < m_pending.size() && position + runSize <= size) {
+    uint32_t color = m_pending[i];
+    if (m_transmittedValid && color == m_transmitted[i]) {
+      i++;
+      continue;
+    }
+
+    // Extend the run over all following LEDs of the same color, no matter if
+    // they changed or not.
+    uint16_t count = 1;
+    while (i + count < m_pending.size() && count < LED_STRIPE_MAX_RUN_LENGTH &&
+           m_pending[i + count] == color) {
+      count++;
+    }
+
+    payload[position++] = i >> 8;
+    payload[position++] = i & 0xff;
+    payload[position++] = (uint8_t)count;
+    payload[position++] = (color >> 16) & 0xff;
+    payload[position++] = (color >> 8) & 0xff;
+    payload[position++] = color & 0xff;
+    if (m_white) {
+      payload[position++] = color >> 24;
+    }
+
+    for (uint16_t j = 0; j < count; j++) {
+      m_transmitted[i + j] = color;
+    }
+    i += count;
+  }
+
+  if (i >= m_pending.size()) {
+    m_encodePosition = 0;
+    m_transmittedValid = true;
+  } else {
+    m_encodePosition = i;
+  }
+  m_mutex.unlock();
+
+  return position;
+}
+
+void LedStripe::Transmitted(size_t bytes, int baudRate) {
+  // Every byte takes 10 bits on the wire using 8N1.
+  m_airtime -= (int64_t)bytes * 10 * 1000000 / baudRate;
+}
+
+void LedStripe::Invalidate() {
+  m_mutex.lock();
+  m_transmittedValid = false;
+  m_encodePosition = 0;
+  m_dirty = true;
+  m_mutex.unlock();
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <inttypes.h>
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+// Bytes of a run in a LED frame without the color: first LED and count.
+#define LED_STRIPE_RUN_HEADER_SIZE 3
+// A run covers up to 255 LEDs of the same color.
+#define LED_STRIPE_MAX_RUN_LENGTH 255
+// Percentage of the bus airtime a stripe may use if not configured.
+#define LED_STRIPE_DEFAULT_AIRTIME_SHARE 25
+
+// Host side framebuffer of a LED stripe. The host renders into the pending
+// frame at any rate, the serial thread transmits the differences to the last
+// transmitted frame as long as the stripe's share of the bus airtime allows.
+class LedStripe {
+ public:
+  LedStripe(uint8_t board, uint8_t port, uint16_t amount, bool white,
+            uint8_t airtimeShare);
+
+  uint8_t GetBoard() { return m_board; }
+  uint8_t GetPort() { return m_port; }
+
+  // Copies colors in 0xWWRRGGBB format into the pending frame, starting at
+  // LED first.
+  bool SetFrame(const uint32_t* colors, uint16_t count, uint16_t first);
+
+  // Returns true if the pending frame differs from the transmitted one and
+  // the airtime budget allows to send it now.
+  bool IsReady();
+  // Encodes changed runs as payload of a single LED frame. Returns the payload
+  // size, 0 if all changes are encoded.
+  size_t EncodeRuns(uint8_t* payload, size_t size);
+  // Charges the airtime of a transmitted frame.
+  void Transmitted(size_t bytes, int baudRate);
+  // Forces a transmission of the full frame, for example if the board
+  // rebooted.
+  void Invalidate();
+
+ private:
+  uint8_t m_board;
+  uint8_t m_port;
+  bool m_white;
+  // Percentage of the bus airtime this stripe is allowed to use.
+  uint8_t m_airtimeShare;
+
+  std::mutex m_mutex;
+  std::vector<uint32_t> m_pending;
+  std::vector<uint32_t> m_transmitted;
+  // Set by the host, read by the serial thread without the lock.
+  std::atomic<bool> m_dirty = false;
+  bool m_transmittedValid = false;
+  // Position of the next run to encode.
+  uint16_t m_encodePosition = 0;
+
+  // Airtime budget in microseconds, might be negative after a large frame.
+  int64_t m_airtime = 0;
+  std::chrono::steady_clock::time_point m_lastRefill;
+};
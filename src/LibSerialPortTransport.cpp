@@ -0,0 +1,150 @@
+#include "LibSerialPortTransport.h"
+
+#include <cstring>
+
+LibSerialPortTransport::LibSerialPortTransport() {
+  m_pSerialPort = NULL;
+  m_pSerialPortConfig = NULL;
+}
+
+LibSerialPortTransport::~LibSerialPortTransport() { Close(); }
+
+bool LibSerialPortTransport::Open(const char* device, int baudRate) {
+  enum sp_return result = sp_get_port_by_name(device, &m_pSerialPort);
+  if (result != SP_OK) {
+    m_pSerialPort = NULL;
+    return false;
+  }
+
+  result = sp_open(m_pSerialPort, SP_MODE_READ_WRITE);
+  if (result != SP_OK) {
+    sp_free_port(m_pSerialPort);
+    m_pSerialPort = NULL;
+    return false;
+  }
+
+  // Keep the original configuration to restore it when closing the port.
+  sp_new_config(&m_pSerialPortConfig);
+  sp_get_config(m_pSerialPort, m_pSerialPortConfig);
+  sp_set_baudrate(m_pSerialPort, baudRate);
+  sp_set_bits(m_pSerialPort, 8);
+  sp_set_parity(m_pSerialPort, SP_PARITY_NONE);
+  sp_set_stopbits(m_pSerialPort, 1);
+  sp_set_xon_xoff(m_pSerialPort, SP_XONXOFF_DISABLED);
+
+  return true;
+}
+
+void LibSerialPortTransport::Close() {
+  if (m_pSerialPort == NULL) {
+    return;
+  }
+
+  sp_set_config(m_pSerialPort, m_pSerialPortConfig);
+  sp_free_config(m_pSerialPortConfig);
+  m_pSerialPortConfig = NULL;
+
+  sp_close(m_pSerialPort);
+  sp_free_port(m_pSerialPort);
+  m_pSerialPort = NULL;
+}
+
+bool LibSerialPortTransport::IsOpen() { return m_pSerialPort != NULL; }
+
+bool LibSerialPortTransport::SetBaudRate(int baudRate) {
+  return m_pSerialPort != NULL &&
+         sp_set_baudrate(m_pSerialPort, baudRate) == SP_OK;
+}
+
+int LibSerialPortTransport::InputWaiting() {
+  if (m_pSerialPort == NULL) {
+    return -1;
+  }
+
+  return (int)sp_input_waiting(m_pSerialPort);
+}
+
+bool LibSerialPortTransport::WaitForInput(
+    size_t bytes, std::chrono::steady_clock::time_point deadline) {
+  // libserialport can't wait for a number of bytes, so we have to poll.
+  do {
+    int waiting = InputWaiting();
+    if (waiting < 0) {
+      return false;
+    }
+    if ((size_t)waiting >= bytes) {
+      return true;
+    }
+  } while (std::chrono::steady_clock::now() < deadline);
+
+  return false;
+}
+
+int LibSerialPortTransport::Read(uint8_t* buffer, size_t size,
+                                 unsigned int timeout) {
+  if (m_pSerialPort == NULL) {
+    return -1;
+  }
+
+  return (int)sp_blocking_read(m_pSerialPort, buffer, size, timeout);
+}
+
+int LibSerialPortTransport::Write(const uint8_t* buffer, size_t size,
+                                  unsigned int timeout) {
+  if (m_pSerialPort == NULL) {
+    return -1;
+  }
+
+  return (int)sp_blocking_write(m_pSerialPort, buffer, size, timeout);
+}
+
+int LibSerialPortTransport::Writev(const SerialBuffer* buffers, size_t count,
+                                   unsigned int timeout) {
+  // Gather the buffers to submit them with a single write.
+  uint8_t gathered[LIBSERIALPORT_TRANSPORT_WRITEV_BUFFER_SIZE];
+  size_t size = 0;
+  int written = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (size + buffers[i].size > sizeof(gathered)) {
+      int result = Write(gathered, size, timeout);
+      if (result < 0) {
+        return result;
+      }
+      written += result;
+      size = 0;
+    }
+
+    if (buffers[i].size > sizeof(gathered)) {
+      int result = Write(buffers[i].data, buffers[i].size, timeout);
+      if (result < 0) {
+        return result;
+      }
+      written += result;
+    } else {
+      memcpy(gathered + size, buffers[i].data, buffers[i].size);
+      size += buffers[i].size;
+    }
+  }
+
+  if (size > 0) {
+    int result = Write(gathered, size, timeout);
+    if (result < 0) {
+      return result;
+    }
+    written += result;
+  }
+
+  return written;
+}
+
+void LibSerialPortTransport::Drain() {
+  if (m_pSerialPort != NULL) {
+    sp_drain(m_pSerialPort);
+  }
+}
+
+void LibSerialPortTransport::Flush() {
+  if (m_pSerialPort != NULL) {
+    sp_flush(m_pSerialPort, SP_BUF_BOTH);
+  }
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "SerialTransport.h"
+#include "libserialport.h"
+
+#define LIBSERIALPORT_TRANSPORT_WRITEV_BUFFER_SIZE 512
+
+// Portable transport based on libserialport.
+class LibSerialPortTransport : public SerialTransport {
+ public:
+  LibSerialPortTransport();
+  ~LibSerialPortTransport();
+
+  bool Open(const char* device, int baudRate) override;
+  void Close() override;
+  bool IsOpen() override;
+
+  bool SetBaudRate(int baudRate) override;
+
+  int InputWaiting() override;
+  bool WaitForInput(size_t bytes,
+                    std::chrono::steady_clock::time_point deadline) override;
+
+  int Read(uint8_t* buffer, size_t size, unsigned int timeout) override;
+  int Write(const uint8_t* buffer, size_t size, unsigned int timeout) override;
+  int Writev(const SerialBuffer* buffers, size_t count,
+             unsigned int timeout) override;
+
+  void Drain() override;
+  void Flush() override;
+
+ private:
+  struct sp_port* m_pSerialPort;
+  struct sp_port_config* m_pSerialPortConfig;
+};
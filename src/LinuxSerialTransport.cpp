@@ -0,0 +1,367 @@
+#include "LinuxSerialTransport.h"
+
+#if defined(__linux__)
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/serial.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <cstring>
+
+// glibc doesn't expose termios2, which is required to set baud rates like
+// 250000 that don't have a B* constant. This is the asm-generic layout.
+#ifndef BOTHER
+#define BOTHER 0010000
+struct termios2 {
+  tcflag_t c_iflag;
+  tcflag_t c_oflag;
+  tcflag_t c_cflag;
+  tcflag_t c_lflag;
+  cc_t c_line;
+  cc_t c_cc[19];
+  speed_t c_ispeed;
+  speed_t c_ospeed;
+};
+#endif
+
+#define LINUX_SERIAL_TRANSPORT_MAX_IOVECS 64
+
+static_assert(sizeof(struct termios) <= 128,
+              "m_originalTermios is too small for struct termios");
+
+static speed_t GetSpeedConstant(int baudRate) {
+  switch (baudRate) {
+    case 9600:
+      return B9600;
+    case 19200:
+      return B19200;
+    case 38400:
+      return B38400;
+    case 57600:
+      return B57600;
+    case 115200:
+      return B115200;
+    case 230400:
+      return B230400;
+    case 460800:
+      return B460800;
+    case 500000:
+      return B500000;
+    case 921600:
+      return B921600;
+    case 1000000:
+      return B1000000;
+    case 2000000:
+      return B2000000;
+  }
+
+  return 0;
+}
+
+LinuxSerialTransport::LinuxSerialTransport() {}
+
+LinuxSerialTransport::~LinuxSerialTransport() { Close(); }
+
+bool LinuxSerialTransport::Open(const char* device, int baudRate) {
+  m_fd = open(device, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+  if (m_fd < 0) {
+    return false;
+  }
+
+  struct termios tio;
+  if (tcgetattr(m_fd, &tio) != 0) {
+    Close();
+    return false;
+  }
+  memcpy(m_originalTermios, &tio, sizeof(tio));
+  m_hasOriginalTermios = true;
+
+  // Raw 8N1 without flow control. VMIN and VTIME are zero, reads never block
+  // because waiting is done with epoll.
+  cfmakeraw(&tio);
+  tio.c_cflag |= CLOCAL | CREAD;
+  tio.c_cflag &= ~(CSTOPB | PARENB | CRTSCTS);
+  tio.c_iflag &= ~(IXON | IXOFF | IXANY);
+  tio.c_cc[VMIN] = 0;
+  tio.c_cc[VTIME] = 0;
+  if (tcsetattr(m_fd, TCSANOW, &tio) != 0) {
+    Close();
+    return false;
+  }
+
+  // Not all drivers support the low latency mode, pseudo terminals for
+  // example don't. FTDI adapters reduce their latency timer from 16ms to 1ms.
+  struct serial_struct serial;
+  if (ioctl(m_fd, TIOCGSERIAL, &serial) == 0) {
+    serial.flags |= ASYNC_LOW_LATENCY;
+    ioctl(m_fd, TIOCSSERIAL, &serial);
+  }
+
+  if (!SetBaudRate(baudRate)) {
+    Close();
+    return false;
+  }
+
+  m_epollFd = epoll_create1(EPOLL_CLOEXEC);
+  m_timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (m_epollFd < 0 || m_timerFd < 0) {
+    Close();
+    return false;
+  }
+
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN;
+  event.data.fd = m_timerFd;
+  if (epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_timerFd, &event) != 0) {
+    Close();
+    return false;
+  }
+
+  // The serial device itself is (re-)armed for the events to wait for by
+  // Wait().
+  event.events = 0;
+  event.data.fd = m_fd;
+  if (epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_fd, &event) != 0) {
+    Close();
+    return false;
+  }
+
+  return true;
+}
+
+void LinuxSerialTransport::Close() {
+  m_hangUp = false;
+
+  if (m_timerFd >= 0) {
+    close(m_timerFd);
+    m_timerFd = -1;
+  }
+
+  if (m_epollFd >= 0) {
+    close(m_epollFd);
+    m_epollFd = -1;
+  }
+
+  if (m_fd >= 0) {
+    if (m_hasOriginalTermios) {
+      struct termios tio;
+      memcpy(&tio, m_originalTermios, sizeof(tio));
+      tcsetattr(m_fd, TCSANOW, &tio);
+      m_hasOriginalTermios = false;
+    }
+    close(m_fd);
+    m_fd = -1;
+  }
+}
+
+bool LinuxSerialTransport::IsOpen() { return m_fd >= 0; }
+
+bool LinuxSerialTransport::SetBaudRate(int baudRate) {
+  if (m_fd < 0) {
+    return false;
+  }
+
+  speed_t speed = GetSpeedConstant(baudRate);
+  if (speed != 0) {
+    struct termios tio;
+    return tcgetattr(m_fd, &tio) == 0 && cfsetispeed(&tio, speed) == 0 &&
+           cfsetospeed(&tio, speed) == 0 && tcsetattr(m_fd, TCSANOW, &tio) == 0;
+  }
+
+  struct termios2 tio2;
+  if (ioctl(m_fd, TCGETS2, &tio2) != 0) {
+    return false;
+  }
+  tio2.c_cflag &= ~CBAUD;
+  tio2.c_cflag |= BOTHER;
+  tio2.c_ispeed = baudRate;
+  tio2.c_ospeed = baudRate;
+  return ioctl(m_fd, TCSETS2, &tio2) == 0;
+}
+
+int LinuxSerialTransport::InputWaiting() {
+  int waiting;
+  if (m_fd < 0 || m_hangUp || ioctl(m_fd, FIONREAD, &waiting) != 0) {
+    return -1;
+  }
+
+  return waiting;
+}
+
+// Waits for the given epoll events on the serial device. A timerfd armed to
+// the absolute deadline is part of the epoll set, so the deadline is met with
+// the resolution of the monotonic clock instead of epoll's milliseconds.
+bool LinuxSerialTransport::Wait(
+    uint32_t events, std::chrono::steady_clock::time_point deadline) {
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = events;
+  event.data.fd = m_fd;
+  if (epoll_ctl(m_epollFd, EPOLL_CTL_MOD, m_fd, &event) != 0) {
+    return false;
+  }
+
+  // std::chrono::steady_clock is based on CLOCK_MONOTONIC.
+  auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                deadline.time_since_epoch())
+                .count();
+  if (ns <= 0) {
+    return false;
+  }
+  struct itimerspec timer;
+  memset(&timer, 0, sizeof(timer));
+  timer.it_value.tv_sec = ns / 1000000000;
+  timer.it_value.tv_nsec = ns % 1000000000;
+  if (timerfd_settime(m_timerFd, TFD_TIMER_ABSTIME, &timer, NULL) != 0) {
+    return false;
+  }
+
+  struct epoll_event ready[2];
+  int count;
+  do {
+    count = epoll_wait(m_epollFd, ready, 2, -1);
+  } while (count < 0 && errno == EINTR);
+
+  bool deviceReady = false;
+  for (int i = 0; i < count; i++) {
+    if (ready[i].data.fd == m_timerFd) {
+      uint64_t expirations;
+      if (read(m_timerFd, &expirations, sizeof(expirations)) < 0) {
+        // Nothing to do, the timer is re-armed by the next call anyway.
+      }
+    } else if (ready[i].events & (EPOLLERR | EPOLLHUP)) {
+      m_hangUp = true;
+      return false;
+    } else {
+      deviceReady = true;
+    }
+  }
+
+  return deviceReady;
+}
+
+bool LinuxSerialTransport::WaitForInput(
+    size_t bytes, std::chrono::steady_clock::time_point deadline) {
+  while (true) {
+    int waiting = InputWaiting();
+    if (waiting < 0) {
+      return false;
+    }
+    if ((size_t)waiting >= bytes) {
+      return true;
+    }
+    if (std::chrono::steady_clock::now() >= deadline) {
+      return false;
+    }
+    // Level triggered, returns as soon as any byte is waiting.
+    Wait(EPOLLIN, deadline);
+  }
+}
+
+int LinuxSerialTransport::Read(uint8_t* buffer, size_t size,
+                               unsigned int timeout) {
+  if (m_fd < 0) {
+    return -1;
+  }
+
+  std::chrono::steady_clock::time_point deadline =
+      std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+  size_t received = 0;
+  while (received < size) {
+    ssize_t result = read(m_fd, buffer + received, size - received);
+    if (result > 0) {
+      received += result;
+      continue;
+    }
+    if ((result < 0 && errno != EAGAIN && errno != EINTR) || m_hangUp) {
+      return -1;
+    }
+    if (std::chrono::steady_clock::now() >= deadline) {
+      break;
+    }
+    Wait(EPOLLIN, deadline);
+  }
+
+  return (int)received;
+}
+
+int LinuxSerialTransport::Write(const uint8_t* buffer, size_t size,
+                                unsigned int timeout) {
+  SerialBuffer serialBuffer = {buffer, size};
+  return Writev(&serialBuffer, 1, timeout);
+}
+
+int LinuxSerialTransport::Writev(const SerialBuffer* buffers, size_t count,
+                                 unsigned int timeout) {
+  if (m_fd < 0) {
+    return -1;
+  }
+
+  std::chrono::steady_clock::time_point deadline =
+      std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+  struct iovec iov[LINUX_SERIAL_TRANSPORT_MAX_IOVECS];
+  int written = 0;
+  size_t next = 0;
+  size_t offset = 0;
+  while (next < count) {
+    int iovcnt = 0;
+    for (size_t i = next;
+         i < count && iovcnt < LINUX_SERIAL_TRANSPORT_MAX_IOVECS; i++) {
+      size_t skip = (i == next) ? offset : 0;
+      iov[iovcnt].iov_base = (void*)(buffers[i].data + skip);
+      iov[iovcnt].iov_len = buffers[i].size - skip;
+      iovcnt++;
+    }
+
+    ssize_t result = writev(m_fd, iov, iovcnt);
+    if (result < 0) {
+      if (errno != EAGAIN && errno != EINTR) {
+        return -1;
+      }
+      result = 0;
+    }
+    written += result;
+
+    // Skip what has been written, a partial write might end within a buffer.
+    size_t remaining = result;
+    while (next < count && remaining >= buffers[next].size - offset) {
+      remaining -= buffers[next].size - offset;
+      offset = 0;
+      next++;
+    }
+    offset += remaining;
+
+    if (m_hangUp) {
+      return -1;
+    }
+    if (next < count) {
+      if (std::chrono::steady_clock::now() >= deadline) {
+        break;
+      }
+      Wait(EPOLLOUT, deadline);
+    }
+  }
+
+  return written;
+}
+
+void LinuxSerialTransport::Drain() {
+  if (m_fd >= 0) {
+    tcdrain(m_fd);
+  }
+}
+
+void LinuxSerialTransport::Flush() {
+  if (m_fd >= 0) {
+    tcflush(m_fd, TCIOFLUSH);
+  }
+}
+
+#endif
@@ -0,0 +1,48 @@
+#pragma once
+
+#if defined(__linux__)
+
+#include "SerialTransport.h"
+
+// Native Linux transport based on termios and epoll. Compared to
+// libserialport it enables the low latency mode of the tty driver, waits for
+// input using epoll with a precise deadline instead of polling and submits
+// batches using writev.
+class LinuxSerialTransport : public SerialTransport {
+ public:
+  LinuxSerialTransport();
+  ~LinuxSerialTransport();
+
+  bool Open(const char* device, int baudRate) override;
+  void Close() override;
+  bool IsOpen() override;
+
+  bool SetBaudRate(int baudRate) override;
+
+  int InputWaiting() override;
+  bool WaitForInput(size_t bytes,
+                    std::chrono::steady_clock::time_point deadline) override;
+
+  int Read(uint8_t* buffer, size_t size, unsigned int timeout) override;
+  int Write(const uint8_t* buffer, size_t size, unsigned int timeout) override;
+  int Writev(const SerialBuffer* buffers, size_t count,
+             unsigned int timeout) override;
+
+  void Drain() override;
+  void Flush() override;
+
+ private:
+  bool Wait(uint32_t events, std::chrono::steady_clock::time_point deadline);
+
+  int m_fd = -1;
+  int m_epollFd = -1;
+  int m_timerFd = -1;
+  // Set when the device reported an error or hang up, for example because an
+  // USB adapter got unplugged.
+  bool m_hangUp = false;
+  bool m_hasOriginalTermios = false;
+  // Storage for the original struct termios, restored when closing the port.
+  unsigned char m_originalTermios[128];
+};
+
+#endif
@@ -1,8 +1,14 @@
 #include "PPUC.h"
 
+#include <stdarg.h>
+
 #include <cstring>
+#include <future>
 
 #include "Adafruit_NeoPixel.h"
+#include "PPUCBridge.h"
+#include "PPUCStressTest.h"
+#include "PPUCTestEngine.h"
 #include "RS485Comm.h"
 #include "io-boards/Event.h"
 #include "io-boards/PPUCPlatforms.h"
@@ -10,21 +16,409 @@
 PPUC::PPUC() {
   m_rom = (char*)malloc(16);
   m_serial = (char*)malloc(128);
-
-  m_pRS485Comm = new RS485Comm();
+  m_pTestEngine = new PPUCTestEngine(this);
+  m_pStressTest = new PPUCStressTest(this);
+  m_pAwaiters = new PPUCAwaiters(this);
 }
 
 PPUC::~PPUC() {
-  m_pRS485Comm->Disconnect();
-  delete m_pRS485Comm;
+  if (m_connectResult.valid()) {
+    m_connectResult.wait();
+  }
+
+  delete m_pTestEngine;
+  delete m_pStressTest;
+
+  StopSharedMemoryBridge();
+  DeleteBuses();
+  delete m_pAwaiters;
+
+  if (m_pBridge) {
+    delete m_pBridge;
+  }
 }
 
 void PPUC::SetLogMessageCallback(PPUC_LogMessageCallback callback,
                                  const void* userData) {
-  m_pRS485Comm->SetLogMessageCallback(callback, userData);
+  m_logMessageCallback = callback;
+  m_logMessageUserData = userData;
+
+  std::shared_lock<std::shared_mutex> lock(m_busesMutex);
+  for (RS485Comm* bus : m_buses) {
+    bus->SetLogMessageCallback(callback, userData);
+  }
+}
+
+void PPUC::LogMessage(const char* format, ...) {
+  if (!m_logMessageCallback) {
+    return;
+  }
+
+  va_list args;
+  va_start(args, format);
+  (*(m_logMessageCallback))(format, args, m_logMessageUserData);
+  va_end(args);
+}
+
+void PPUC::Disconnect() {
+  // A running connect would replace the buses while they get disconnected.
+  std::unique_lock<std::mutex> lock(m_connectMutex);
+  m_connectDone.wait(lock, [this]() { return !m_connectRunning; });
+  m_connectRunning = true;
+  lock.unlock();
+
+  // The buses are taken out under the exclusive lock. Disconnecting them
+  // while holding it would block serial threads that wait for the shared
+  // lock in a callback.
+  DeleteBuses();
+
+  EndConnect();
+}
+
+void PPUC::CreateBuses() {
+  DeleteBuses();
+
+  // Without a serialPorts configuration all boards share a single bus.
+  std::vector<PPUCSerialPort> serialPorts = m_serialPorts;
+  if (serialPorts.empty()) {
+    serialPorts.push_back(PPUCSerialPort());
+    serialPorts[0].threadConfig = m_serialThreadConfig;
+    serialPorts[0].baudRate = m_baudRate;
+    serialPorts[0].maxBaudRate = m_maxBaudRate;
+    serialPorts[0].transport = m_transport;
+    serialPorts[0].crc = m_crc;
+    serialPorts[0].pollShare = m_pollShare;
+  }
+  // A serial device set via SetSerial() overrides the first configured port.
+  serialPorts[0].device = m_serial;
+
+  std::vector<RS485Comm*> buses;
+  std::map<uint8_t, uint8_t> boardBus;
+  for (size_t i = 0; i < serialPorts.size(); i++) {
+    RS485Comm* bus = new RS485Comm();
+    bus->SetLogMessageCallback(m_logMessageCallback, m_logMessageUserData);
+    bus->SetDebug(m_debug);
+    bus->SetThreadConfig(m_hasSerialThreadConfig ? m_serialThreadConfig
+                                                 : serialPorts[i].threadConfig);
+    bus->SetBaudRate(serialPorts[i].baudRate);
+    bus->SetMaxBaudRate(serialPorts[i].maxBaudRate);
+    bus->SetTransport(serialPorts[i].transport);
+    bus->SetCrc(serialPorts[i].crc);
+    bus->SetPollShare(serialPorts[i].pollShare);
+    bus->SetQueuePolicy(m_queuePolicy);
+    bus->SetSwitchCallback(&PPUC::SwitchCallback, this);
+    bus->SetSentCallback(&PPUC::SentCallback, this);
+    bus->SetBoardStateCallback(m_boardStateCallback, m_boardStateUserData);
+    bus->SetBoardEventCallback(m_boardEventCallback, m_boardEventUserData);
+    bus->SetSwitchRuleCallback(m_switchRuleCallback, m_switchRuleUserData);
+    buses.push_back(bus);
+
+    for (uint8_t board : serialPorts[i].boards) {
+      boardBus[board] = (uint8_t)i;
+    }
+  }
+  m_serialPorts = serialPorts;
+
+  m_busesMutex.lock();
+  m_buses = buses;
+  m_boardBus = boardBus;
+  m_busesMutex.unlock();
+}
+
+void PPUC::DeleteBuses() {
+  // The frame in progress was routed to the old buses.
+  m_frameMutex.lock();
+  ClearFrame();
+  m_frameMutex.unlock();
+
+  // Other threads use the buses only while they hold the shared lock. The old
+  // buses get disconnected after releasing it, so serial threads waiting for
+  // the lock in a callback are able to finish.
+  std::vector<RS485Comm*> buses;
+  m_busesMutex.lock();
+  buses.swap(m_buses);
+  m_boardBus.clear();
+  m_solenoidBuses.clear();
+  m_lampBuses.clear();
+  m_busesMutex.unlock();
+
+  for (RS485Comm* bus : buses) {
+    bus->Disconnect();
+    delete bus;
+  }
+  m_pAwaiters->CancelSent();
+}
+
+// Readers check the flag while holding the shared lock, so none of them is
+// using the buses or the routes anymore once it is set. The device catalog
+// built by the connect gets published at its end.
+void PPUC::SetConnecting(bool connecting) {
+  m_busesMutex.lock();
+  m_connecting = connecting;
+  if (!connecting && m_pConnectDevices) {
+    m_devices = std::move(m_pConnectDevices);
+  }
+  m_busesMutex.unlock();
+}
+
+std::shared_ptr<const PPUCDeviceCatalog> PPUC::GetDeviceCatalog() {
+  std::shared_lock<std::shared_mutex> lock(m_busesMutex);
+  return m_devices;
+}
+
+RS485Comm* PPUC::GetBus(uint8_t board) {
+  auto it = m_boardBus.find(board);
+  if (it != m_boardBus.end()) {
+    return m_buses[it->second];
+  }
+
+  // Boards that aren't assigned to a serial port explicitly are connected to
+  // the first one.
+  return m_buses[0];
+}
+
+void PPUC::AddRoute(std::map<uint16_t, uint32_t>& routes, uint16_t number,
+                    uint8_t board) {
+  auto it = m_boardBus.find(board);
+  routes[number] |= ((uint32_t)1) << (it != m_boardBus.end() ? it->second : 0);
+}
+
+// Optional brightness levels, hysteresis and update rate of lamps and
+// flashers driven by intensity.
+void PPUC::ConfigureIntensity(const YAML::Node& output, uint8_t sourceId,
+                              uint8_t board) {
+  if (!output["brightnessLevels"] && !output["hysteresis"] &&
+      !output["maxUpdateRate"]) {
+    return;
+  }
+
+  uint16_t levels = INTENSITY_FILTER_DEFAULT_LEVELS;
+  uint8_t hysteresis = INTENSITY_FILTER_DEFAULT_HYSTERESIS;
+  uint16_t maxRate = INTENSITY_FILTER_DEFAULT_MAX_RATE;
+  if (output["brightnessLevels"]) {
+    levels = output["brightnessLevels"].as<uint16_t>();
+  }
+  if (output["hysteresis"]) {
+    // Parsed wider than the uint8_t it ends up in to catch values that would
+    // wrap around.
+    uint16_t value = output["hysteresis"].as<uint16_t>();
+    if (value > 255) {
+      LogMessage("PPUC: hysteresis %d of output %d exceeds 255, using 255",
+                 value, output["number"].as<uint16_t>());
+      value = 255;
+    }
+    hysteresis = (uint8_t)value;
+  }
+  if (output["maxUpdateRate"]) {
+    maxRate = output["maxUpdateRate"].as<uint16_t>();
+  }
+  GetBus(board)->ConfigureIntensity(sourceId, output["number"].as<uint16_t>(),
+                                    levels, hysteresis, maxRate);
 }
 
-void PPUC::Disconnect() { m_pRS485Comm->Disconnect(); }
+// Returns the buses that drive the solenoid or lamp, all buses for other
+// events or unknown numbers.
+uint32_t PPUC::GetRoutes(uint8_t sourceId, uint16_t number) {
+  std::map<uint16_t, uint32_t>* routes = nullptr;
+  if (sourceId == EVENT_SOURCE_SOLENOID) {
+    routes = &m_solenoidBuses;
+  } else if (sourceId == EVENT_SOURCE_LIGHT) {
+    routes = &m_lampBuses;
+  }
+  if (routes) {
+    auto it = routes->find(number);
+    if (it != routes->end()) {
+      return it->second;
+    }
+  }
+
+  return 0xffffffff;
+}
+
+// Queues an event to the buses, delayed by delay ms if not 0. Returns
+// PPUC_QUEUE_FULL if any bus dropped it.
+uint8_t PPUC::QueueEvent(Event* event, uint32_t delay) {
+  std::shared_lock<std::shared_mutex> lock(m_busesMutex);
+  if (m_buses.empty() || m_connecting) {
+    delete event;
+    return PPUC_QUEUE_NOT_CONNECTED;
+  }
+
+  std::chrono::steady_clock::time_point at =
+      std::chrono::steady_clock::now() + std::chrono::milliseconds(delay);
+  // Only the thread that owns the frame adds its events to it.
+  bool frame = false;
+  std::unique_lock<std::mutex> frameLock(m_frameMutex, std::defer_lock);
+  if (delay == 0 && m_inFrame) {
+    frameLock.lock();
+    frame = m_inFrame && m_frameThread == std::this_thread::get_id() &&
+            m_frameEvents.size() == m_buses.size();
+    if (!frame) {
+      frameLock.unlock();
+    }
+  }
+  auto queue = [this, delay, at, frame](size_t bus, Event* event) {
+    if (frame) {
+      m_frameEvents[bus].push_back(event);
+      return (uint8_t)PPUC_QUEUE_OK;
+    }
+    if (delay == 0) {
+      return m_buses[bus]->QueueEvent(event);
+    }
+    m_buses[bus]->ScheduleEvent(event, at);
+    return (uint8_t)PPUC_QUEUE_OK;
+  };
+
+  if (m_buses.size() == 1) {
+    return queue(0, event);
+  }
+
+  // Send events for known solenoids and lamps only to the buses with boards
+  // that drive them. Everything else is broadcasted to all buses.
+  uint32_t buses = GetRoutes(event->sourceId, event->eventId);
+
+  int lastBus = -1;
+  for (size_t i = 0; i < m_buses.size(); i++) {
+    if (buses & (((uint32_t)1) << i)) {
+      lastBus = (int)i;
+    }
+  }
+  if (lastBus < 0) {
+    delete event;
+    return PPUC_QUEUE_OK;
+  }
+
+  // Every bus owns its events, so all but the last one get a copy.
+  uint8_t result = PPUC_QUEUE_OK;
+  for (int i = 0; i < lastBus; i++) {
+    if (buses & (((uint32_t)1) << i)) {
+      result |= queue(i, new Event(*event));
+    }
+  }
+
+  return result | queue(lastBus, event);
+}
+
+bool PPUC::BeginFrame() {
+  std::shared_lock<std::shared_mutex> lock(m_busesMutex);
+  std::lock_guard<std::mutex> frameLock(m_frameMutex);
+  if (m_inFrame && m_frameThread != std::this_thread::get_id()) {
+    return false;
+  }
+
+  ClearFrame();
+  m_frameEvents.resize(m_buses.size());
+  m_frameThread = std::this_thread::get_id();
+  m_inFrame = true;
+
+  return true;
+}
+
+uint8_t PPUC::CommitFrame() {
+  std::vector<std::vector<Event*>> frameEvents;
+  m_frameMutex.lock();
+  if (!m_inFrame || m_frameThread != std::this_thread::get_id()) {
+    m_frameMutex.unlock();
+    return PPUC_QUEUE_OK;
+  }
+  m_inFrame = false;
+  frameEvents.swap(m_frameEvents);
+  m_frameMutex.unlock();
+
+  std::shared_lock<std::shared_mutex> lock(m_busesMutex);
+  uint8_t result = PPUC_QUEUE_OK;
+  for (size_t i = 0; i < frameEvents.size(); i++) {
+    if (i < m_buses.size()) {
+      result |= m_buses[i]->QueueFrame(frameEvents[i].data(),
+                                       frameEvents[i].size());
+    } else {
+      for (Event* event : frameEvents[i]) {
+        delete event;
+      }
+    }
+  }
+
+  return result;
+}
+
+// Has to be called with the frame mutex locked.
+void PPUC::ClearFrame() {
+  m_inFrame = false;
+  for (auto& events : m_frameEvents) {
+    for (Event* event : events) {
+      delete event;
+    }
+    events.clear();
+  }
+}
+
+void PPUC::SendConfigEvent(ConfigEvent* configEvent) {
+  GetBus(configEvent->boardId)->SendConfigEvent(configEvent);
+
+  m_connectProgress.configEventsSent++;
+  ReportConnectProgress(PPUC_CONNECT_PHASE_UPLOAD);
+}
+
+void PPUC::SetConnectProgressCallback(PPUC_ConnectProgressCallback callback,
+                                      const void* userData) {
+  m_connectProgressCallback = callback;
+  m_connectProgressUserData = userData;
+}
+
+void PPUC::ReportConnectProgress(uint8_t phase) {
+  m_connectProgress.phase = phase;
+  if (m_connectProgressCallback) {
+    (*(m_connectProgressCallback))(&m_connectProgress,
+                                   m_connectProgressUserData);
+  }
+}
+
+std::shared_future<bool> PPUC::ConnectAsync() {
+  std::lock_guard<std::mutex> lock(m_connectMutex);
+  if (m_connectRunning) {
+    // Join a running ConnectAsync(). A synchronous Connect() has no future to
+    // join, so the call is rejected.
+    if (m_connectResult.valid() &&
+        m_connectResult.wait_for(std::chrono::seconds(0)) !=
+            std::future_status::ready) {
+      return m_connectResult;
+    }
+    LogMessage("PPUC: a connect is running already");
+    std::promise<bool> rejected;
+    rejected.set_value(false);
+    return rejected.get_future().share();
+  }
+
+  m_connectRunning = true;
+  SetConnecting(true);
+  m_connectResult =
+      std::async(std::launch::async, [this]() {
+        bool connected = RunConnect();
+        EndConnect();
+        return connected;
+      }).share();
+
+  return m_connectResult;
+}
+
+// Only one connect or disconnect runs at a time. Returns false if one is
+// running already.
+bool PPUC::BeginConnect() {
+  std::lock_guard<std::mutex> lock(m_connectMutex);
+  if (m_connectRunning) {
+    return false;
+  }
+  m_connectRunning = true;
+
+  return true;
+}
+
+void PPUC::EndConnect() {
+  m_connectMutex.lock();
+  m_connectRunning = false;
+  m_connectMutex.unlock();
+  m_connectDone.notify_all();
+}
 
 uint8_t PPUC::ResolveLedType(std::string type) {
   if (type.compare("RGB")) return NEO_RGB;
@@ -71,8 +465,60 @@ void PPUC::LoadConfiguration(const char* configFile) {
   m_debug = m_ppucConfig["debug"].as<bool>();
   std::string c_rom = m_ppucConfig["rom"].as<std::string>();
   strcpy(m_rom, c_rom.c_str());
-  std::string c_serial = m_ppucConfig["serialPort"].as<std::string>();
-  strcpy(m_serial, c_serial.c_str());
+  if (m_ppucConfig["baudRate"]) {
+    m_baudRate = m_ppucConfig["baudRate"].as<int>();
+  }
+  if (m_ppucConfig["maxBaudRate"]) {
+    m_maxBaudRate = m_ppucConfig["maxBaudRate"].as<int>();
+  }
+  m_transport = ResolveTransport(m_ppucConfig["transport"], m_transport);
+  if (m_ppucConfig["crc"]) {
+    m_crc = m_ppucConfig["crc"].as<bool>();
+  }
+  if (m_ppucConfig["pollShare"]) {
+    m_pollShare = m_ppucConfig["pollShare"].as<uint8_t>();
+  }
+  if (m_ppucConfig["queuePolicy"]) {
+    m_queuePolicy =
+        m_ppucConfig["queuePolicy"].as<std::string>() == "drop"
+            ? PPUC_QUEUE_POLICY_DROP
+            : PPUC_QUEUE_POLICY_BLOCK;
+  }
+
+  m_serialPorts.clear();
+  const YAML::Node& serialPorts = m_ppucConfig["serialPorts"];
+  if (serialPorts) {
+    for (YAML::Node n_serialPort : serialPorts) {
+      // The bus masks used for routing are 32 bits wide.
+      if (m_serialPorts.size() == 32) {
+        break;
+      }
+
+      PPUCSerialPort serialPort;
+      serialPort.device = n_serialPort["device"].as<std::string>();
+      for (YAML::Node n_board : n_serialPort["boards"]) {
+        serialPort.boards.push_back(n_board.as<uint8_t>());
+      }
+      serialPort.baudRate = n_serialPort["baudRate"]
+                                ? n_serialPort["baudRate"].as<int>()
+                                : m_baudRate;
+      serialPort.maxBaudRate = n_serialPort["maxBaudRate"]
+                                   ? n_serialPort["maxBaudRate"].as<int>()
+                                   : m_maxBaudRate;
+      serialPort.transport =
+          ResolveTransport(n_serialPort["transport"], m_transport);
+      serialPort.crc =
+          n_serialPort["crc"] ? n_serialPort["crc"].as<bool>() : m_crc;
+      serialPort.pollShare = n_serialPort["pollShare"]
+                                 ? n_serialPort["pollShare"].as<uint8_t>()
+                                 : m_pollShare;
+      m_serialPorts.push_back(serialPort);
+    }
+    strcpy(m_serial, m_serialPorts[0].device.c_str());
+  } else {
+    std::string c_serial = m_ppucConfig["serialPort"].as<std::string>();
+    strcpy(m_serial, c_serial.c_str());
+  }
   std::string c_platform = m_ppucConfig["platform"].as<std::string>();
   m_platform = PLATFORM_WPC;
   if (strcmp(c_platform.c_str(), "DE") == 0) {
@@ -82,10 +528,76 @@ void PPUC::LoadConfiguration(const char* configFile) {
   } else if (strcmp(c_platform.c_str(), "SYS11") == 0) {
     m_platform = PLATFORM_SYS11;
   }
+
+  const YAML::Node& serialThread = m_ppucConfig["serialThread"];
+  if (serialThread) {
+    ParseThreadConfig(serialThread, m_serialThreadConfig);
+  }
+
+  // Serial ports might override the global serialThread settings.
+  if (serialPorts) {
+    size_t i = 0;
+    for (YAML::Node n_serialPort : serialPorts) {
+      if (i == m_serialPorts.size()) {
+        break;
+      }
+      m_serialPorts[i].threadConfig = m_serialThreadConfig;
+      if (n_serialPort["serialThread"]) {
+        ParseThreadConfig(n_serialPort["serialThread"],
+                          m_serialPorts[i].threadConfig);
+      }
+      i++;
+    }
+  }
+}
+
+uint8_t PPUC::ResolveTransport(const YAML::Node& node, uint8_t transport) {
+  if (node) {
+    std::string c_transport = node.as<std::string>();
+    if (strcmp(c_transport.c_str(), "native") == 0) {
+      return PPUC_TRANSPORT_NATIVE;
+    } else if (strcmp(c_transport.c_str(), "libserialport") == 0) {
+      return PPUC_TRANSPORT_LIBSERIALPORT;
+    }
+  }
+
+  return transport;
+}
+
+void PPUC::ParseThreadConfig(const YAML::Node& node,
+                             PPUCThreadConfig& threadConfig) {
+  if (node["policy"]) {
+    std::string c_policy = node["policy"].as<std::string>();
+    if (strcmp(c_policy.c_str(), "fifo") == 0) {
+      threadConfig.policy = PPUC_THREAD_POLICY_FIFO;
+    } else if (strcmp(c_policy.c_str(), "rr") == 0) {
+      threadConfig.policy = PPUC_THREAD_POLICY_RR;
+    } else {
+      threadConfig.policy = PPUC_THREAD_POLICY_DEFAULT;
+    }
+  }
+  if (node["priority"]) {
+    threadConfig.priority = node["priority"].as<int>();
+  }
+  if (node["affinity"]) {
+    threadConfig.affinity.clear();
+    for (YAML::Node n_cpu : node["affinity"]) {
+      threadConfig.affinity.push_back(n_cpu.as<int>());
+    }
+  }
+  if (node["name"]) {
+    threadConfig.name = node["name"].as<std::string>();
+  }
+  if (node["timerSlack"]) {
+    threadConfig.timerSlack = node["timerSlack"].as<uint32_t>();
+  }
 }
 
 void PPUC::SetDebug(bool debug) {
-  m_pRS485Comm->SetDebug(debug);
+  std::shared_lock<std::shared_mutex> lock(m_busesMutex);
+  for (RS485Comm* bus : m_buses) {
+    bus->SetDebug(debug);
+  }
   m_debug = debug;
 }
 
@@ -99,15 +611,38 @@ void PPUC::SetSerial(const char* serial) { strcpy(m_serial, serial); }
 
 const char* PPUC::GetSerial() { return m_serial; }
 
+void PPUC::SetSerialThreadConfig(const PPUCThreadConfig& config) {
+  m_serialThreadConfig = config;
+  m_hasSerialThreadConfig = true;
+}
+
+int PPUC::GetSerialThreadConfigResult() {
+  int result = PPUC_THREAD_CONFIG_OK;
+  std::shared_lock<std::shared_mutex> lock(m_busesMutex);
+  for (RS485Comm* bus : m_buses) {
+    result |= bus->GetThreadConfigResult();
+  }
+  return result;
+}
+
+PPUCBusStatistics PPUC::GetBusStatistics(uint8_t bus) {
+  std::shared_lock<std::shared_mutex> lock(m_busesMutex);
+  if (bus < m_buses.size()) {
+    return m_buses[bus]->GetStatistics();
+  }
+
+  return PPUCBusStatistics();
+}
+
 void PPUC::SendTriggerConfigBlock(const YAML::Node& items, uint32_t type,
                                   uint8_t board, uint32_t port) {
   if (items) {
     for (YAML::Node n_item : items) {
       uint8_t index = 0;
-      m_pRS485Comm->SendConfigEvent(
+      SendConfigEvent(
           new ConfigEvent(board, (uint8_t)CONFIG_TOPIC_TRIGGER, index++,
                           (uint8_t)CONFIG_TOPIC_PORT, port));
-      m_pRS485Comm->SendConfigEvent(
+      SendConfigEvent(
           new ConfigEvent(board, (uint8_t)CONFIG_TOPIC_TRIGGER, index++,
                           (uint8_t)CONFIG_TOPIC_TYPE, type));
       std::string c_source = n_item["source"].as<std::string>();
@@ -117,13 +652,13 @@ void PPUC::SendTriggerConfigBlock(const YAML::Node& items, uint32_t type,
       } else if (strcmp(c_source.c_str(), "L") == 0) {
         source = EVENT_SOURCE_LIGHT;
       }
-      m_pRS485Comm->SendConfigEvent(
+      SendConfigEvent(
           new ConfigEvent(board, (uint8_t)CONFIG_TOPIC_TRIGGER, index++,
                           (uint8_t)CONFIG_TOPIC_SOURCE, source));
-      m_pRS485Comm->SendConfigEvent(new ConfigEvent(
+      SendConfigEvent(new ConfigEvent(
           board, (uint8_t)CONFIG_TOPIC_TRIGGER, index++,
           (uint8_t)CONFIG_TOPIC_NUMBER, n_item["number"].as<uint32_t>()));
-      m_pRS485Comm->SendConfigEvent(new ConfigEvent(
+      SendConfigEvent(new ConfigEvent(
           board, (uint8_t)CONFIG_TOPIC_LAMPS, index++,
           (uint8_t)CONFIG_TOPIC_VALUE, n_item["value"].as<uint32_t>()));
     }
@@ -141,16 +676,16 @@ void PPUC::SendLedConfigBlock(const YAML::Node& items, uint32_t type,
       }
 
       uint8_t index = 0;
-      m_pRS485Comm->SendConfigEvent(
+      SendConfigEvent(
           new ConfigEvent(board, (uint8_t)CONFIG_TOPIC_LAMPS, index++,
                           (uint8_t)CONFIG_TOPIC_PORT, port));
-      m_pRS485Comm->SendConfigEvent(
+      SendConfigEvent(
           new ConfigEvent(board, (uint8_t)CONFIG_TOPIC_LAMPS, index++,
                           (uint8_t)CONFIG_TOPIC_TYPE, type));
-      m_pRS485Comm->SendConfigEvent(new ConfigEvent(
+      SendConfigEvent(new ConfigEvent(
           board, (uint8_t)CONFIG_TOPIC_LAMPS, index++,
           (uint8_t)CONFIG_TOPIC_NUMBER, n_item["number"].as<uint32_t>()));
-      m_pRS485Comm->SendConfigEvent(
+      SendConfigEvent(
           new ConfigEvent(board, (uint8_t)CONFIG_TOPIC_LAMPS, index++,
                           (uint8_t)CONFIG_TOPIC_LED_NUMBER,
                           n_item["ledNumber"].as<uint32_t>()));
@@ -159,27 +694,83 @@ void PPUC::SendLedConfigBlock(const YAML::Node& items, uint32_t type,
       std::stringstream ss;
       ss << std::hex << n_item["color"].as<std::string>();
       ss >> color;
-      m_pRS485Comm->SendConfigEvent(
+      SendConfigEvent(
           new ConfigEvent(board, (uint8_t)CONFIG_TOPIC_LAMPS, index++,
                           (uint8_t)CONFIG_TOPIC_COLOR, color));
 
-      m_lamps.push_back(
-          PPUCLamp(board, port, (uint8_t)type, n_item["number"].as<uint8_t>(),
-                   n_item["description"].as<std::string>(), color));
+      m_pConnectDevices->AddLamp(board, port, (uint8_t)type,
+                        n_item["number"].as<uint8_t>(),
+                        n_item["description"].as<std::string>(), color);
+      AddRoute(m_lampBuses, n_item["number"].as<uint16_t>(), board);
+      ConfigureIntensity(n_item, EVENT_SOURCE_LIGHT, board);
+      if (type == LED_TYPE_FLASHER) {
+        // Flashers could also be driven like solenoids.
+        AddRoute(m_solenoidBuses, n_item["number"].as<uint16_t>(), board);
+        ConfigureIntensity(n_item, EVENT_SOURCE_SOLENOID, board);
+      }
+    }
+  }
+}
+
+bool PPUC::ConnectBuses() {
+  CreateBuses();
+
+  // Bring up all buses in parallel, each of them has to wait for the reset of
+  // its boards.
+  std::vector<std::future<bool>> connected;
+  for (size_t i = 0; i < m_buses.size(); i++) {
+    connected.push_back(std::async(std::launch::async, [this, i]() {
+      return m_buses[i]->Connect(m_serialPorts[i].device.c_str());
+    }));
+  }
+
+  bool success = true;
+  for (size_t i = 0; i < connected.size(); i++) {
+    if (!connected[i].get()) {
+      if (m_debug) {
+        // @todo user logger
+        printf("Unable to open serial port %s\n",
+               m_serialPorts[i].device.c_str());
+      }
+      success = false;
     }
   }
+
+  return success;
 }
 
 bool PPUC::Connect() {
-  if (m_pRS485Comm->Connect(m_serial)) {
+  if (!BeginConnect()) {
+    LogMessage("PPUC: a connect is running already");
+    return false;
+  }
+
+  SetConnecting(true);
+  bool connected = RunConnect();
+  EndConnect();
+
+  return connected;
+}
+
+bool PPUC::RunConnect() {
+  m_pAwaiters->OnConnecting();
+  m_connectProgress = PPUCConnectProgress();
+  ReportConnectProgress(PPUC_CONNECT_PHASE_BUSES);
+  m_pConnectDevices = std::make_shared<PPUCDeviceCatalog>();
+
+  if (ConnectBuses()) {
+    for (RS485Comm* bus : m_buses) {
+      m_connectProgress.boardsFound += bus->GetActiveBoardCount();
+    }
+
     uint8_t index = 0;
     const YAML::Node& boards = m_ppucConfig["boards"];
     for (YAML::Node n_board : boards) {
-      m_pRS485Comm->SendConfigEvent(new ConfigEvent(
+      SendConfigEvent(new ConfigEvent(
           n_board["number"].as<uint8_t>(), (uint8_t)CONFIG_TOPIC_PLATFORM, 0,
           (uint8_t)CONFIG_TOPIC_PLATFORM, m_platform));
 
-      m_pRS485Comm->SendConfigEvent(
+      SendConfigEvent(
           new ConfigEvent(n_board["number"].as<uint8_t>(),
                           (uint8_t)CONFIG_TOPIC_COIN_DOOR_CLOSED_SWITCH, 0,
                           (uint8_t)CONFIG_TOPIC_NUMBER,
@@ -187,7 +778,7 @@ bool PPUC::Connect() {
       m_coinDoorClosedSwitch =
           m_ppucConfig["coinDoorClosedSwitch"].as<uint8_t>();
 
-      m_pRS485Comm->SendConfigEvent(
+      SendConfigEvent(
           new ConfigEvent(n_board["number"].as<uint8_t>(),
                           (uint8_t)CONFIG_TOPIC_GAME_ON_SOLENOID, 0,
                           (uint8_t)CONFIG_TOPIC_NUMBER,
@@ -195,7 +786,8 @@ bool PPUC::Connect() {
       m_gameOnSolenoid = m_ppucConfig["gameOnSolenoid"].as<uint8_t>();
 
       if (n_board["pollEvents"].as<bool>()) {
-        m_pRS485Comm->RegisterSwitchBoard(n_board["number"].as<uint8_t>());
+        GetBus(n_board["number"].as<uint8_t>())
+            ->RegisterSwitchBoard(n_board["number"].as<uint8_t>());
       }
     }
 
@@ -210,19 +802,38 @@ bool PPUC::Connect() {
         }
 
         index = 0;
-        m_pRS485Comm->SendConfigEvent(new ConfigEvent(
+        SendConfigEvent(new ConfigEvent(
             n_switch["board"].as<uint8_t>(), (uint8_t)CONFIG_TOPIC_SWITCHES,
             index++, (uint8_t)CONFIG_TOPIC_PORT,
             n_switch["port"].as<uint32_t>()));
-        m_pRS485Comm->SendConfigEvent(new ConfigEvent(
+        SendConfigEvent(new ConfigEvent(
             n_switch["board"].as<uint8_t>(), (uint8_t)CONFIG_TOPIC_SWITCHES,
             index++, (uint8_t)CONFIG_TOPIC_NUMBER,
             n_switch["number"].as<uint32_t>()));
 
-        m_switches.push_back(PPUCSwitch(
-            n_switch["board"].as<uint8_t>(), n_switch["port"].as<uint8_t>(),
-            n_switch["number"].as<uint8_t>(),
-            n_switch["description"].as<std::string>()));
+        // Optional host side debounce and chatter filter.
+        uint16_t debounce = 0;
+        uint16_t maxRate = 0;
+        bool quarantine = false;
+        if (n_switch["debounce"]) {
+          debounce = n_switch["debounce"].as<uint16_t>();
+        }
+        if (n_switch["maxRate"]) {
+          maxRate = n_switch["maxRate"].as<uint16_t>();
+        }
+        if (n_switch["quarantine"]) {
+          quarantine = n_switch["quarantine"].as<bool>();
+        }
+        if (debounce > 0 || maxRate > 0) {
+          GetBus(n_switch["board"].as<uint8_t>())
+              ->ConfigureSwitchFilter(n_switch["number"].as<uint16_t>(),
+                                      debounce, maxRate, quarantine);
+        }
+
+        m_pConnectDevices->AddSwitch(n_switch["board"].as<uint8_t>(),
+                            n_switch["port"].as<uint8_t>(),
+                            n_switch["number"].as<uint8_t>(),
+                            n_switch["description"].as<std::string>());
       }
     }
 
@@ -230,12 +841,12 @@ bool PPUC::Connect() {
     const YAML::Node& switchMatrix = m_ppucConfig["switchMatrix"];
     if (switchMatrix) {
       index = 0;
-      m_pRS485Comm->SendConfigEvent(
+      SendConfigEvent(
           new ConfigEvent(switchMatrix["board"].as<uint8_t>(),
                           (uint8_t)CONFIG_TOPIC_SWITCH_MATRIX, index++,
                           (uint8_t)CONFIG_TOPIC_ACTIVE_LOW,
                           switchMatrix["activeLow"].as<bool>()));
-      m_pRS485Comm->SendConfigEvent(
+      SendConfigEvent(
           new ConfigEvent(switchMatrix["board"].as<uint8_t>(),
                           (uint8_t)CONFIG_TOPIC_SWITCH_MATRIX, index++,
                           (uint8_t)CONFIG_TOPIC_MAX_PULSE_TIME,
@@ -243,16 +854,16 @@ bool PPUC::Connect() {
       const YAML::Node& switcheMatrixColumns =
           m_ppucConfig["switchMatrix"]["columns"];
       for (YAML::Node n_switchMatrixColumn : switcheMatrixColumns) {
-        m_pRS485Comm->SendConfigEvent(
+        SendConfigEvent(
             new ConfigEvent(switchMatrix["board"].as<uint8_t>(),
                             (uint8_t)CONFIG_TOPIC_SWITCH_MATRIX, index++,
                             (uint8_t)CONFIG_TOPIC_TYPE, MATRIX_TYPE_COLUMN));
-        m_pRS485Comm->SendConfigEvent(
+        SendConfigEvent(
             new ConfigEvent(switchMatrix["board"].as<uint8_t>(),
                             (uint8_t)CONFIG_TOPIC_SWITCH_MATRIX, index++,
                             (uint8_t)CONFIG_TOPIC_NUMBER,
                             n_switchMatrixColumn["number"].as<uint32_t>()));
-        m_pRS485Comm->SendConfigEvent(
+        SendConfigEvent(
             new ConfigEvent(switchMatrix["board"].as<uint8_t>(),
                             (uint8_t)CONFIG_TOPIC_SWITCH_MATRIX, index++,
                             (uint8_t)CONFIG_TOPIC_PORT,
@@ -261,16 +872,16 @@ bool PPUC::Connect() {
       const YAML::Node& switcheMatrixRows =
           m_ppucConfig["switchMatrix"]["rows"];
       for (YAML::Node n_switchMatrixRow : switcheMatrixRows) {
-        m_pRS485Comm->SendConfigEvent(
+        SendConfigEvent(
             new ConfigEvent(switchMatrix["board"].as<uint8_t>(),
                             (uint8_t)CONFIG_TOPIC_SWITCH_MATRIX, index++,
                             (uint8_t)CONFIG_TOPIC_TYPE, MATRIX_TYPE_ROW));
-        m_pRS485Comm->SendConfigEvent(
+        SendConfigEvent(
             new ConfigEvent(switchMatrix["board"].as<uint8_t>(),
                             (uint8_t)CONFIG_TOPIC_SWITCH_MATRIX, index++,
                             (uint8_t)CONFIG_TOPIC_NUMBER,
                             n_switchMatrixRow["number"].as<uint32_t>()));
-        m_pRS485Comm->SendConfigEvent(
+        SendConfigEvent(
             new ConfigEvent(switchMatrix["board"].as<uint8_t>(),
                             (uint8_t)CONFIG_TOPIC_SWITCH_MATRIX, index++,
                             (uint8_t)CONFIG_TOPIC_PORT,
@@ -289,35 +900,35 @@ bool PPUC::Connect() {
         }
 
         index = 0;
-        m_pRS485Comm->SendConfigEvent(new ConfigEvent(
+        SendConfigEvent(new ConfigEvent(
             n_pwmOutput["board"].as<uint8_t>(), (uint8_t)CONFIG_TOPIC_PWM,
             index++, (uint8_t)CONFIG_TOPIC_PORT,
             n_pwmOutput["port"].as<uint32_t>()));
-        m_pRS485Comm->SendConfigEvent(new ConfigEvent(
+        SendConfigEvent(new ConfigEvent(
             n_pwmOutput["board"].as<uint8_t>(), (uint8_t)CONFIG_TOPIC_PWM,
             index++, (uint8_t)CONFIG_TOPIC_NUMBER,
             n_pwmOutput["number"].as<uint32_t>()));
-        m_pRS485Comm->SendConfigEvent(new ConfigEvent(
+        SendConfigEvent(new ConfigEvent(
             n_pwmOutput["board"].as<uint8_t>(), (uint8_t)CONFIG_TOPIC_PWM,
             index++, (uint8_t)CONFIG_TOPIC_POWER,
             n_pwmOutput["power"].as<uint32_t>()));
-        m_pRS485Comm->SendConfigEvent(new ConfigEvent(
+        SendConfigEvent(new ConfigEvent(
             n_pwmOutput["board"].as<uint8_t>(), (uint8_t)CONFIG_TOPIC_PWM,
             index++, (uint8_t)CONFIG_TOPIC_MIN_PULSE_TIME,
             n_pwmOutput["minPulseTime"].as<uint32_t>()));
-        m_pRS485Comm->SendConfigEvent(new ConfigEvent(
+        SendConfigEvent(new ConfigEvent(
             n_pwmOutput["board"].as<uint8_t>(), (uint8_t)CONFIG_TOPIC_PWM,
             index++, (uint8_t)CONFIG_TOPIC_MAX_PULSE_TIME,
             n_pwmOutput["maxPulseTime"].as<uint32_t>()));
-        m_pRS485Comm->SendConfigEvent(new ConfigEvent(
+        SendConfigEvent(new ConfigEvent(
             n_pwmOutput["board"].as<uint8_t>(), (uint8_t)CONFIG_TOPIC_PWM,
             index++, (uint8_t)CONFIG_TOPIC_HOLD_POWER,
             n_pwmOutput["holdPower"].as<uint32_t>()));
-        m_pRS485Comm->SendConfigEvent(new ConfigEvent(
+        SendConfigEvent(new ConfigEvent(
             n_pwmOutput["board"].as<uint8_t>(), (uint8_t)CONFIG_TOPIC_PWM,
             index++, (uint8_t)CONFIG_TOPIC_HOLD_POWER_ACTIVATION_TIME,
             n_pwmOutput["holdPowerActivationTime"].as<uint32_t>()));
-        m_pRS485Comm->SendConfigEvent(new ConfigEvent(
+        SendConfigEvent(new ConfigEvent(
             n_pwmOutput["board"].as<uint8_t>(), (uint8_t)CONFIG_TOPIC_PWM,
             index++, (uint8_t)CONFIG_TOPIC_FAST_SWITCH,
             n_pwmOutput["fastFlipSwitch"].as<uint32_t>()));
@@ -330,7 +941,7 @@ bool PPUC::Connect() {
         } else if (strcmp(c_type.c_str(), "motor") == 0) {
           type = PWM_TYPE_MOTOR;
         }
-        m_pRS485Comm->SendConfigEvent(new ConfigEvent(
+        SendConfigEvent(new ConfigEvent(
             n_pwmOutput["board"].as<uint8_t>(), (uint8_t)CONFIG_TOPIC_PWM,
             index++, (uint8_t)CONFIG_TOPIC_TYPE, type));
 
@@ -338,47 +949,47 @@ bool PPUC::Connect() {
         if (pwm_effects) {
           for (YAML::Node n_pwm_effect : pwm_effects) {
             index = 0;
-            m_pRS485Comm->SendConfigEvent(
+            SendConfigEvent(
                 new ConfigEvent(n_pwmOutput["board"].as<uint8_t>(),
                                 (uint8_t)CONFIG_TOPIC_PWM_EFFECT, index++,
                                 (uint8_t)CONFIG_TOPIC_PORT,
                                 n_pwmOutput["port"].as<uint32_t>()));
-            m_pRS485Comm->SendConfigEvent(
+            SendConfigEvent(
                 new ConfigEvent(n_pwmOutput["board"].as<uint8_t>(),
                                 (uint8_t)CONFIG_TOPIC_PWM_EFFECT, index++,
                                 (uint8_t)CONFIG_TOPIC_DURATION,
                                 n_pwm_effect["duration"].as<uint32_t>()));
-            m_pRS485Comm->SendConfigEvent(
+            SendConfigEvent(
                 new ConfigEvent(n_pwmOutput["board"].as<uint8_t>(),
                                 (uint8_t)CONFIG_TOPIC_PWM_EFFECT, index++,
                                 (uint8_t)CONFIG_TOPIC_EFFECT,
                                 n_pwm_effect["effect"].as<uint32_t>()));
-            m_pRS485Comm->SendConfigEvent(
+            SendConfigEvent(
                 new ConfigEvent(n_pwmOutput["board"].as<uint8_t>(),
                                 (uint8_t)CONFIG_TOPIC_PWM_EFFECT, index++,
                                 (uint8_t)CONFIG_TOPIC_FREQUENCY,
                                 n_pwm_effect["frequency"].as<uint32_t>()));
-            m_pRS485Comm->SendConfigEvent(
+            SendConfigEvent(
                 new ConfigEvent(n_pwmOutput["board"].as<uint8_t>(),
                                 (uint8_t)CONFIG_TOPIC_PWM_EFFECT, index++,
                                 (uint8_t)CONFIG_TOPIC_MAX_INTENSITY,
                                 n_pwm_effect["maxIntensity"].as<uint32_t>()));
-            m_pRS485Comm->SendConfigEvent(
+            SendConfigEvent(
                 new ConfigEvent(n_pwmOutput["board"].as<uint8_t>(),
                                 (uint8_t)CONFIG_TOPIC_PWM_EFFECT, index++,
                                 (uint8_t)CONFIG_TOPIC_MIN_INTENSITY,
                                 n_pwm_effect["minIntensity"].as<uint32_t>()));
-            m_pRS485Comm->SendConfigEvent(
+            SendConfigEvent(
                 new ConfigEvent(n_pwmOutput["board"].as<uint8_t>(),
                                 (uint8_t)CONFIG_TOPIC_PWM_EFFECT, index++,
                                 (uint8_t)CONFIG_TOPIC_MODE,
                                 n_pwm_effect["mode"].as<uint32_t>()));
-            m_pRS485Comm->SendConfigEvent(
+            SendConfigEvent(
                 new ConfigEvent(n_pwmOutput["board"].as<uint8_t>(),
                                 (uint8_t)CONFIG_TOPIC_PWM_EFFECT, index++,
                                 (uint8_t)CONFIG_TOPIC_PRIORITY,
                                 n_pwm_effect["priority"].as<uint32_t>()));
-            m_pRS485Comm->SendConfigEvent(
+            SendConfigEvent(
                 new ConfigEvent(n_pwmOutput["board"].as<uint8_t>(),
                                 (uint8_t)CONFIG_TOPIC_PWM_EFFECT, index++,
                                 (uint8_t)CONFIG_TOPIC_REPEAT,
@@ -393,11 +1004,14 @@ bool PPUC::Connect() {
           }
         }
 
-        m_coils.push_back(
-            PPUCCoil(n_pwmOutput["board"].as<uint8_t>(),
-                     n_pwmOutput["port"].as<uint8_t>(), (uint8_t)type,
-                     n_pwmOutput["number"].as<uint8_t>(),
-                     n_pwmOutput["description"].as<std::string>()));
+        m_pConnectDevices->AddCoil(n_pwmOutput["board"].as<uint8_t>(),
+                          n_pwmOutput["port"].as<uint8_t>(), (uint8_t)type,
+                          n_pwmOutput["number"].as<uint8_t>(),
+                          n_pwmOutput["description"].as<std::string>());
+        AddRoute(m_solenoidBuses, n_pwmOutput["number"].as<uint16_t>(),
+                 n_pwmOutput["board"].as<uint8_t>());
+        ConfigureIntensity(n_pwmOutput, EVENT_SOURCE_SOLENOID,
+                           n_pwmOutput["board"].as<uint8_t>());
       }
     }
 
@@ -406,54 +1020,66 @@ bool PPUC::Connect() {
     if (ledStripes) {
       for (YAML::Node n_ledStripe : ledStripes) {
         index = 0;
-        m_pRS485Comm->SendConfigEvent(new ConfigEvent(
+        SendConfigEvent(new ConfigEvent(
             n_ledStripe["board"].as<uint8_t>(),
             (uint8_t)CONFIG_TOPIC_LED_STRING, index++,
             (uint8_t)CONFIG_TOPIC_PORT, n_ledStripe["port"].as<uint32_t>()));
-        m_pRS485Comm->SendConfigEvent(new ConfigEvent(
+        SendConfigEvent(new ConfigEvent(
             n_ledStripe["board"].as<uint8_t>(),
             (uint8_t)CONFIG_TOPIC_LED_STRING, index++,
             (uint8_t)CONFIG_TOPIC_TYPE,
             ResolveLedType(n_ledStripe["ledType"].as<std::string>())));
-        m_pRS485Comm->SendConfigEvent(
+        SendConfigEvent(
             new ConfigEvent(n_ledStripe["board"].as<uint8_t>(),
                             (uint8_t)CONFIG_TOPIC_LED_STRING, index++,
                             (uint8_t)CONFIG_TOPIC_BRIGHTNESS,
                             n_ledStripe["brightness"].as<uint32_t>()));
-        m_pRS485Comm->SendConfigEvent(
+        SendConfigEvent(
             new ConfigEvent(n_ledStripe["board"].as<uint8_t>(),
                             (uint8_t)CONFIG_TOPIC_LED_STRING, index++,
                             (uint8_t)CONFIG_TOPIC_AMOUNT_LEDS,
                             n_ledStripe["amount"].as<uint32_t>()));
-        m_pRS485Comm->SendConfigEvent(
+        SendConfigEvent(
             new ConfigEvent(n_ledStripe["board"].as<uint8_t>(),
                             (uint8_t)CONFIG_TOPIC_LED_STRING, index++,
                             (uint8_t)CONFIG_TOPIC_AFTER_GLOW,
                             n_ledStripe["afterGlow"].as<uint32_t>()));
-        m_pRS485Comm->SendConfigEvent(
+        SendConfigEvent(
             new ConfigEvent(n_ledStripe["board"].as<uint8_t>(),
                             (uint8_t)CONFIG_TOPIC_LED_STRING, index++,
                             (uint8_t)CONFIG_TOPIC_LIGHT_UP,
                             n_ledStripe["lightUp"].as<uint32_t>()));
 
+        // Stripes of RGB LED types share the offset of white and red.
+        uint8_t ledType =
+            ResolveLedType(n_ledStripe["ledType"].as<std::string>());
+        GetBus(n_ledStripe["board"].as<uint8_t>())
+            ->RegisterLedStripe(
+                n_ledStripe["board"].as<uint8_t>(),
+                n_ledStripe["port"].as<uint8_t>(),
+                n_ledStripe["amount"].as<uint16_t>(),
+                ((ledType >> 6) & 3) != ((ledType >> 4) & 3),
+                n_ledStripe["airtime"] ? n_ledStripe["airtime"].as<uint8_t>()
+                                       : LED_STRIPE_DEFAULT_AIRTIME_SHARE);
+
         const YAML::Node& segments = n_ledStripe["segments"];
         if (segments) {
           for (YAML::Node n_segment : segments) {
-            m_pRS485Comm->SendConfigEvent(
+            SendConfigEvent(
                 new ConfigEvent(n_ledStripe["board"].as<uint8_t>(),
                                 (uint8_t)CONFIG_TOPIC_LED_SEGMENT, index++,
                                 (uint8_t)CONFIG_TOPIC_PORT,
                                 n_ledStripe["port"].as<uint32_t>()));
-            m_pRS485Comm->SendConfigEvent(
+            SendConfigEvent(
                 new ConfigEvent(n_ledStripe["board"].as<uint8_t>(),
                                 (uint8_t)CONFIG_TOPIC_LED_SEGMENT, index++,
                                 (uint8_t)CONFIG_TOPIC_NUMBER,
                                 n_segment["number"].as<uint32_t>()));
-            m_pRS485Comm->SendConfigEvent(new ConfigEvent(
+            SendConfigEvent(new ConfigEvent(
                 n_ledStripe["board"].as<uint8_t>(),
                 (uint8_t)CONFIG_TOPIC_LED_SEGMENT, index++,
                 (uint8_t)CONFIG_TOPIC_FROM, n_segment["from"].as<uint32_t>()));
-            m_pRS485Comm->SendConfigEvent(new ConfigEvent(
+            SendConfigEvent(new ConfigEvent(
                 n_ledStripe["board"].as<uint8_t>(),
                 (uint8_t)CONFIG_TOPIC_LED_SEGMENT, index++,
                 (uint8_t)CONFIG_TOPIC_TO, n_segment["to"].as<uint32_t>()));
@@ -464,12 +1090,12 @@ bool PPUC::Connect() {
         if (led_effects) {
           for (YAML::Node n_led_effect : led_effects) {
             index = 0;
-            m_pRS485Comm->SendConfigEvent(
+            SendConfigEvent(
                 new ConfigEvent(n_ledStripe["board"].as<uint8_t>(),
                                 (uint8_t)CONFIG_TOPIC_LED_EFFECT, index++,
                                 (uint8_t)CONFIG_TOPIC_PORT,
                                 n_ledStripe["port"].as<uint32_t>()));
-            m_pRS485Comm->SendConfigEvent(
+            SendConfigEvent(
                 new ConfigEvent(n_ledStripe["board"].as<uint8_t>(),
                                 (uint8_t)CONFIG_TOPIC_LED_EFFECT, index++,
                                 (uint8_t)CONFIG_TOPIC_LED_SEGMENT,
@@ -478,41 +1104,41 @@ bool PPUC::Connect() {
             std::stringstream ss;
             ss << std::hex << n_led_effect["color"].as<std::string>();
             ss >> color;
-            m_pRS485Comm->SendConfigEvent(
+            SendConfigEvent(
                 new ConfigEvent(n_ledStripe["board"].as<uint8_t>(),
                                 (uint8_t)CONFIG_TOPIC_LED_EFFECT, index++,
                                 (uint8_t)CONFIG_TOPIC_COLOR, color));
-            m_pRS485Comm->SendConfigEvent(
+            SendConfigEvent(
                 new ConfigEvent(n_ledStripe["board"].as<uint8_t>(),
                                 (uint8_t)CONFIG_TOPIC_LED_EFFECT, index++,
                                 (uint8_t)CONFIG_TOPIC_DURATION,
                                 n_led_effect["duration"].as<uint32_t>()));
-            m_pRS485Comm->SendConfigEvent(
+            SendConfigEvent(
                 new ConfigEvent(n_ledStripe["board"].as<uint8_t>(),
                                 (uint8_t)CONFIG_TOPIC_LED_EFFECT, index++,
                                 (uint8_t)CONFIG_TOPIC_EFFECT,
                                 n_led_effect["effect"].as<uint32_t>()));
-            m_pRS485Comm->SendConfigEvent(
+            SendConfigEvent(
                 new ConfigEvent(n_ledStripe["board"].as<uint8_t>(),
                                 (uint8_t)CONFIG_TOPIC_LED_EFFECT, index++,
                                 (uint8_t)CONFIG_TOPIC_REVERSE,
                                 n_led_effect["reverse"].as<uint32_t>()));
-            m_pRS485Comm->SendConfigEvent(
+            SendConfigEvent(
                 new ConfigEvent(n_ledStripe["board"].as<uint8_t>(),
                                 (uint8_t)CONFIG_TOPIC_LED_EFFECT, index++,
                                 (uint8_t)CONFIG_TOPIC_SPEED,
                                 n_led_effect["speed"].as<uint32_t>()));
-            m_pRS485Comm->SendConfigEvent(
+            SendConfigEvent(
                 new ConfigEvent(n_ledStripe["board"].as<uint8_t>(),
                                 (uint8_t)CONFIG_TOPIC_LED_EFFECT, index++,
                                 (uint8_t)CONFIG_TOPIC_MODE,
                                 n_led_effect["mode"].as<uint32_t>()));
-            m_pRS485Comm->SendConfigEvent(
+            SendConfigEvent(
                 new ConfigEvent(n_ledStripe["board"].as<uint8_t>(),
                                 (uint8_t)CONFIG_TOPIC_LED_EFFECT, index++,
                                 (uint8_t)CONFIG_TOPIC_PRIORITY,
                                 n_led_effect["priority"].as<uint32_t>()));
-            m_pRS485Comm->SendConfigEvent(
+            SendConfigEvent(
                 new ConfigEvent(n_ledStripe["board"].as<uint8_t>(),
                                 (uint8_t)CONFIG_TOPIC_LED_EFFECT, index++,
                                 (uint8_t)CONFIG_TOPIC_REPEAT,
@@ -539,237 +1165,525 @@ bool PPUC::Connect() {
       }
     }
 
+    // Switch rules have to be in place before the serial threads start.
+    const YAML::Node& switchRules = m_ppucConfig["switchRules"];
+    if (switchRules) {
+      for (YAML::Node n_switchRule : switchRules) {
+        PPUCSwitchRule rule;
+        rule.switchNumber = n_switchRule["switch"].as<uint8_t>();
+        if (n_switchRule["state"]) {
+          rule.switchState = n_switchRule["state"].as<uint8_t>();
+        }
+        rule.solenoid = n_switchRule["solenoid"].as<uint8_t>();
+        rule.duration = n_switchRule["duration"].as<uint32_t>();
+        if (n_switchRule["recycle"]) {
+          rule.recycle = n_switchRule["recycle"].as<uint32_t>();
+        }
+        ApplySwitchRule(rule);
+      }
+    }
+    for (const PPUCSwitchRule& rule : m_switchRules) {
+      ApplySwitchRule(rule);
+    }
+
+    // Make sure that boards using checksums received the complete
+    // configuration.
+    for (RS485Comm* bus : m_buses) {
+      bus->FlushConfigEvents();
+    }
+
     // Wait before continuing.
+    ReportConnectProgress(PPUC_CONNECT_PHASE_SETTLE);
     std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+    SetConnecting(false);
 
     // Turn on the GI for non WPC platforms.
     if (PLATFORM_WPC != m_platform) {
-      m_pRS485Comm->QueueEvent(new Event(EVENT_SOURCE_GI, /* string */ 1,
-                                         /* full brightness */ 8));
+      QueueEvent(new Event(EVENT_SOURCE_GI, /* string */ 1,
+                           /* full brightness */ 8));
     }
 
     // Tell I/O boards to read initial switch states, for example coin door
     // closed.
-    m_pRS485Comm->QueueEvent(new Event(EVENT_READ_SWITCHES));
+    QueueEvent(new Event(EVENT_READ_SWITCHES));
+
+    for (RS485Comm* bus : m_buses) {
+      bus->Run();
+    }
 
-    m_pRS485Comm->Run();
+    ReportConnectProgress(PPUC_CONNECT_PHASE_DONE);
+    m_pAwaiters->OnConnected(true);
 
     return true;
   }
 
+  SetConnecting(false);
+  ReportConnectProgress(PPUC_CONNECT_PHASE_FAILED);
+  m_pAwaiters->OnConnected(false);
+
   return false;
 }
 
-void PPUC::SetSolenoidState(int number, int state) {
+void PPUC::SetQueuePolicy(uint8_t queuePolicy) {
+  m_queuePolicy = queuePolicy;
+  std::shared_lock<std::shared_mutex> lock(m_busesMutex);
+  for (RS485Comm* bus : m_buses) {
+    bus->SetQueuePolicy(queuePolicy);
+  }
+}
+
+uint8_t PPUC::SetSolenoidState(int number, int state) {
   uint16_t solNo = number;
   uint8_t solState = state == 0 ? 0 : 1;
-  m_pRS485Comm->QueueEvent(new Event(EVENT_SOURCE_SOLENOID, solNo, solState));
+  return QueueEvent(new Event(EVENT_SOURCE_SOLENOID, solNo, solState));
 }
 
-void PPUC::SetLampState(int number, int state) {
+bool PPUC::SetLedFrame(uint8_t board, uint8_t port, const uint32_t* colors,
+                       uint16_t count, uint16_t first) {
+  std::shared_lock<std::shared_mutex> lock(m_busesMutex);
+  if (m_buses.empty() || m_connecting) {
+    return false;
+  }
+
+  return GetBus(board)->SetLedFrame(board, port, colors, count, first);
+}
+
+uint8_t PPUC::SetLampState(int number, int state) {
   uint16_t lampNo = number;
   uint8_t lampState = state == 0 ? 0 : 1;
-  m_pRS485Comm->QueueEvent(new Event(EVENT_SOURCE_LIGHT, lampNo, lampState));
+  return QueueEvent(new Event(EVENT_SOURCE_LIGHT, lampNo, lampState));
+}
+
+uint8_t PPUC::SetSolenoidIntensity(int number, uint8_t intensity) {
+  return SetIntensity(EVENT_SOURCE_SOLENOID, number, intensity);
+}
+
+uint8_t PPUC::SetLampIntensity(int number, uint8_t intensity) {
+  return SetIntensity(EVENT_SOURCE_LIGHT, number, intensity);
+}
+
+uint8_t PPUC::SetIntensity(uint8_t sourceId, uint16_t number,
+                           uint8_t intensity) {
+  std::shared_lock<std::shared_mutex> lock(m_busesMutex);
+  if (m_buses.empty() || m_connecting) {
+    return PPUC_QUEUE_NOT_CONNECTED;
+  }
+
+  // Intensities replace each other instead of queueing up, so they never get
+  // dropped.
+  uint32_t buses = GetRoutes(sourceId, number);
+  for (size_t i = 0; i < m_buses.size(); i++) {
+    if (buses & (((uint32_t)1) << i)) {
+      m_buses[i]->SetIntensity(sourceId, number, intensity);
+    }
+  }
+
+  return PPUC_QUEUE_OK;
+}
+
+uint8_t PPUC::PulseSolenoid(int number, uint32_t duration) {
+  std::shared_lock<std::shared_mutex> lock(m_busesMutex);
+  if (m_buses.empty() || m_connecting) {
+    return PPUC_QUEUE_NOT_CONNECTED;
+  }
+
+  uint16_t solNo = number;
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  uint32_t buses = GetRoutes(EVENT_SOURCE_SOLENOID, solNo);
+  for (size_t i = 0; i < m_buses.size(); i++) {
+    if (buses & (((uint32_t)1) << i)) {
+      m_buses[i]->SchedulePulse(new Event(EVENT_SOURCE_SOLENOID, solNo, 1),
+                                new Event(EVENT_SOURCE_SOLENOID, solNo, 0),
+                                duration, now);
+    }
+  }
+
+  return PPUC_QUEUE_OK;
+}
+
+uint8_t PPUC::ScheduleSolenoidState(int number, int state, uint32_t delay) {
+  uint16_t solNo = number;
+  uint8_t solState = state == 0 ? 0 : 1;
+  return QueueEvent(new Event(EVENT_SOURCE_SOLENOID, solNo, solState), delay);
+}
+
+uint8_t PPUC::ScheduleLampState(int number, int state, uint32_t delay) {
+  uint16_t lampNo = number;
+  uint8_t lampState = state == 0 ? 0 : 1;
+  return QueueEvent(new Event(EVENT_SOURCE_LIGHT, lampNo, lampState), delay);
 }
 
 PPUCSwitchState* PPUC::GetNextSwitchState() {
-  return m_pRS485Comm->GetNextSwitchState();
+  std::shared_lock<std::shared_mutex> lock(m_busesMutex);
+  if (m_connecting) {
+    return nullptr;
+  }
+
+  // Serve the buses round robin, so a busy bus can't starve the others.
+  for (size_t i = 0; i < m_buses.size(); i++) {
+    RS485Comm* bus = m_buses[m_nextSwitchBus++ % m_buses.size()];
+    PPUCSwitchState* switchState = bus->GetNextSwitchState();
+    if (switchState) {
+      return switchState;
+    }
+  }
+
+  return nullptr;
 }
 
 void PPUC::StartUpdates() {
-  m_pRS485Comm->QueueEvent(new Event(EVENT_RUN, 1, 1));
+  QueueEvent(new Event(EVENT_RUN, 1, 1));
 }
 
 void PPUC::StopUpdates() {
-  m_pRS485Comm->QueueEvent(new Event(EVENT_RUN, 1, 0));
+  QueueEvent(new Event(EVENT_RUN, 1, 0));
+}
+
+bool PPUC::StartSharedMemoryBridge(const char* name) {
+  m_busesMutex.lock_shared();
+  bool connected = !m_buses.empty();
+  m_busesMutex.unlock_shared();
+  if (!connected) {
+    return false;
+  }
+
+  if (!m_pBridge) {
+    m_pBridge = new PPUCBridge(this);
+  }
+
+  return m_pBridge.load()->Start(name);
+}
+
+void PPUC::StopSharedMemoryBridge() {
+  if (m_pBridge) {
+    m_pBridge.load()->Stop();
+  }
+}
+
+void CALLBACK PPUC::SwitchCallback(int number, int state,
+                                   const void* userData) {
+  PPUCBridge* pBridge = ((PPUC*)userData)->m_pBridge;
+  if (pBridge) {
+    pBridge->PublishSwitchState(number, state);
+  }
+  ((PPUC*)userData)->m_pAwaiters->OnSwitch(number, state);
+}
+
+void CALLBACK PPUC::SentCallback(const void* userData) {
+  ((PPUC*)userData)->m_pAwaiters->OnSent();
+}
+
+PPUCSwitchAwaitable PPUC::NextSwitchEvent() {
+  return PPUCSwitchAwaitable(m_pAwaiters, PPUC_AWAIT_NEXT_SWITCH);
+}
+
+PPUCSwitchAwaitable PPUC::SwitchChanged(uint8_t number) {
+  return PPUCSwitchAwaitable(m_pAwaiters, PPUC_AWAIT_SWITCH_CHANGED, number);
+}
+
+PPUCResultAwaitable PPUC::Sent() {
+  PPUCResultAwaitable awaitable(m_pAwaiters, PPUC_AWAIT_SENT);
+  std::shared_lock<std::shared_mutex> lock(m_busesMutex);
+  for (RS485Comm* bus : m_buses) {
+    awaitable.positions.push_back(bus->GetQueuePosition());
+  }
+
+  return awaitable;
+}
+
+PPUCResultAwaitable PPUC::Connected() {
+  return PPUCResultAwaitable(m_pAwaiters, PPUC_AWAIT_CONNECTED);
+}
+
+void PPUC::SetResumeCallback(PPUC_ResumeCallback callback,
+                             const void* userData) {
+  m_pAwaiters->SetResumeCallback(callback, userData);
 }
 
 std::vector<PPUCCoil> PPUC::GetCoils() {
-  std::sort(
-      m_coils.begin(), m_coils.end(),
-      [](const PPUCCoil& a, const PPUCCoil& b) { return a.number < b.number; });
+  std::vector<PPUCCoil> coils;
+  std::shared_ptr<const PPUCDeviceCatalog> devices = GetDeviceCatalog();
+  coils.reserve(devices->GetCoils().GetSize());
+  for (const auto& coil : devices->GetCoils()) {
+    coils.push_back(PPUCCoil(coil.GetBoard(), coil.GetPort(), coil.GetType(),
+                             coil.GetNumber(),
+                             std::string(coil.GetDescription())));
+  }
 
-  return m_coils;
+  return coils;
 }
 
 std::vector<PPUCLamp> PPUC::GetLamps() {
-  std::sort(
-      m_lamps.begin(), m_lamps.end(),
-      [](const PPUCLamp& a, const PPUCLamp& b) { return a.number < b.number; });
+  std::vector<PPUCLamp> lamps;
+  std::shared_ptr<const PPUCDeviceCatalog> devices = GetDeviceCatalog();
+  lamps.reserve(devices->GetLamps().GetSize());
+  for (const auto& lamp : devices->GetLamps()) {
+    lamps.push_back(PPUCLamp(lamp.GetBoard(), lamp.GetPort(), lamp.GetType(),
+                             lamp.GetNumber(),
+                             std::string(lamp.GetDescription()),
+                             lamp.GetColor()));
+  }
 
-  return m_lamps;
+  return lamps;
 }
 
 std::vector<PPUCSwitch> PPUC::GetSwitches() {
-  std::sort(m_switches.begin(), m_switches.end(),
-            [](const PPUCSwitch& a, const PPUCSwitch& b) {
-              return a.number < b.number;
-            });
+  std::vector<PPUCSwitch> switches;
+  std::shared_ptr<const PPUCDeviceCatalog> devices = GetDeviceCatalog();
+  switches.reserve(devices->GetSwitches().GetSize());
+  for (const auto& vswitch : devices->GetSwitches()) {
+    switches.push_back(PPUCSwitch(vswitch.GetBoard(), vswitch.GetPort(),
+                                  vswitch.GetNumber(),
+                                  std::string(vswitch.GetDescription())));
+  }
 
-  return m_switches;
+  return switches;
 }
 
-void PPUC::CoilTest(u_int8_t number) {
-  printf("Coil Test\n");
-  printf("=========\n");
+bool PPUC::IsSwitchQuarantined(uint8_t number) {
+  std::shared_lock<std::shared_mutex> lock(m_busesMutex);
+  if (m_buses.empty() || m_connecting) {
+    return false;
+  }
 
-  for (const auto& coil : GetCoils()) {
-    if (coil.type == PWM_TYPE_SOLENOID || coil.type == PWM_TYPE_FLASHER) {
-      if (number != 0 && coil.number != number) {
-        continue;
-      }
-      printf("\nBoard: %d\nPort: %d\nNumber: %d\nDescription: %s\n", coil.board,
-             coil.port, coil.number, coil.description.c_str());
-      SetSolenoidState(coil.number, 1);
-      std::this_thread::sleep_for(std::chrono::milliseconds(200));
-      SetSolenoidState(coil.number, 0);
-      std::this_thread::sleep_for(std::chrono::milliseconds(1000));
-    }
+  ptrdiff_t index = m_devices->GetSwitches().Find(number);
+  if (index < 0) {
+    return false;
   }
+
+  return GetBus(m_devices->GetSwitches()[index].GetBoard())
+      ->IsSwitchQuarantined(number);
 }
 
-void PPUC::LampTest(u_int8_t number) {
-  printf("Lamp Test\n");
-  printf("=========\n");
+void PPUC::ReleaseSwitch(uint8_t number) {
+  std::shared_lock<std::shared_mutex> lock(m_busesMutex);
+  if (m_connecting) {
+    return;
+  }
 
-  if (number != 0) {
-    for (const auto& lamp : GetLamps()) {
-      if (lamp.type == LED_TYPE_LAMP && lamp.number == number) {
-        printf(
-            "\nBoard: %d\nPort: %d\nNumber: %d\nDescription: %s\Color: "
-            "%08X\n",
-            lamp.board, lamp.port, lamp.number, lamp.description.c_str(),
-            lamp.color);
-        SetLampState(lamp.number, 1);
-      }
-    }
+  const PPUCDeviceTable& switches = m_devices->GetSwitches();
+  for (ptrdiff_t index = switches.Find(number);
+       index >= 0 && (size_t)index < switches.GetSize() &&
+       switches[index].GetNumber() == number && !m_buses.empty();
+       index++) {
+    GetBus(switches[index].GetBoard())->ReleaseSwitch(number);
+  }
+}
 
-    for (const auto& coil : GetCoils()) {
-      if (coil.type == PWM_TYPE_LAMP && coil.number == number) {
-        printf("\nBoard: %d\nPort: %d\nNumber: %d\nDescription: %s\n",
-               coil.board, coil.port, coil.number, coil.description.c_str());
-        SetSolenoidState(coil.number, 1);
-      }
-    }
+bool PPUC::IsBoardActive(uint8_t board) {
+  std::shared_lock<std::shared_mutex> lock(m_busesMutex);
+  return !m_buses.empty() && !m_connecting &&
+         GetBus(board)->IsBoardActive(board);
+}
 
-    std::this_thread::sleep_for(std::chrono::milliseconds(10000));
+std::vector<PPUCStressResult> PPUC::RunStressTest(
+    const PPUCStressConfig& config) {
+  m_busesMutex.lock_shared();
+  bool connected = !m_buses.empty() && !m_connecting;
+  m_busesMutex.unlock_shared();
+  if (!connected) {
+    return std::vector<PPUCStressResult>();
+  }
 
-    for (const auto& lamp : GetLamps()) {
-      SetLampState(lamp.number, 0);
-    }
+  return m_pStressTest->Run(config);
+}
+
+void PPUC::CancelStressTest() { m_pStressTest->Cancel(); }
+
+void PPUC::SetStressCallback(PPUC_StressCallback callback,
+                             const void* userData) {
+  m_pStressTest->SetCallback(callback, userData);
+}
+
+void PPUC::SetBoardStateCallback(PPUC_BoardStateCallback callback,
+                                 const void* userData) {
+  m_boardStateCallback = callback;
+  m_boardStateUserData = userData;
 
-    for (const auto& coil : GetCoils()) {
-      SetSolenoidState(coil.number, 0);
+  std::shared_lock<std::shared_mutex> lock(m_busesMutex);
+  for (RS485Comm* bus : m_buses) {
+    bus->SetBoardStateCallback(callback, userData);
+  }
+}
+
+void PPUC::SetBoardEventCallback(PPUC_BoardEventCallback callback,
+                                 const void* userData) {
+  m_boardEventCallback = callback;
+  m_boardEventUserData = userData;
+
+  std::shared_lock<std::shared_mutex> lock(m_busesMutex);
+  for (RS485Comm* bus : m_buses) {
+    bus->SetBoardEventCallback(callback, userData);
+  }
+}
+
+bool PPUC::IsSolenoidFaulted(uint8_t number) {
+  std::shared_lock<std::shared_mutex> lock(m_busesMutex);
+  for (RS485Comm* bus : m_buses) {
+    if (bus->IsSolenoidFaulted(number)) {
+      return true;
     }
+  }
+
+  return false;
+}
+
+void PPUC::ClearSolenoidFault(uint8_t number) {
+  std::shared_lock<std::shared_mutex> lock(m_busesMutex);
+  for (RS485Comm* bus : m_buses) {
+    bus->ClearSolenoidFault(number);
+  }
+}
+
+bool PPUC::AddSwitchRule(const PPUCSwitchRule& rule) {
+  if (rule.duration == 0) {
+    return false;
+  }
+
+  m_switchRules.push_back(rule);
+
+  return true;
+}
+
+void PPUC::ClearSwitchRules() { m_switchRules.clear(); }
+
+void PPUC::SetSwitchRuleCallback(PPUC_SwitchRuleCallback callback,
+                                 const void* userData) {
+  m_switchRuleCallback = callback;
+  m_switchRuleUserData = userData;
+
+  std::shared_lock<std::shared_mutex> lock(m_busesMutex);
+  for (RS485Comm* bus : m_buses) {
+    bus->SetSwitchRuleCallback(callback, userData);
+  }
+}
+
+// The rule is evaluated by the bus of the switch's board and fires the
+// solenoid on every bus that drives it.
+void PPUC::ApplySwitchRule(const PPUCSwitchRule& rule) {
+  if (rule.duration == 0) {
+    return;
+  }
+
+  std::vector<RS485Comm*> sources;
+  const PPUCDeviceTable& switches = m_pConnectDevices->GetSwitches();
+  ptrdiff_t index = switches.Find(rule.switchNumber);
+  if (index >= 0) {
+    sources.push_back(GetBus(switches[index].GetBoard()));
   } else {
-    for (const auto& lamp : GetLamps()) {
-      if (lamp.type == LED_TYPE_LAMP) {
-        printf(
-            "\nBoard: %d\nPort: %d\nNumber: %d\nDescription: %s\Color: %08X\n",
-            lamp.board, lamp.port, lamp.number, lamp.description.c_str(),
-            lamp.color);
-        SetLampState(lamp.number, 1);
-        std::this_thread::sleep_for(std::chrono::milliseconds(2000));
-        SetLampState(lamp.number, 0);
-        std::this_thread::sleep_for(std::chrono::milliseconds(1000));
-      }
+    sources = m_buses;
+  }
 
-      for (const auto& coil : GetCoils()) {
-        if (coil.type == PWM_TYPE_LAMP) {
-          printf("\nBoard: %d\nPort: %d\nNumber: %d\nDescription: %s\n",
-                 coil.board, coil.port, coil.number, coil.description.c_str());
-          SetSolenoidState(coil.number, 1);
-          std::this_thread::sleep_for(std::chrono::milliseconds(2000));
-          SetSolenoidState(coil.number, 0);
-          std::this_thread::sleep_for(std::chrono::milliseconds(1000));
-        }
+  uint32_t targets = 0xffffffff;
+  auto it = m_solenoidBuses.find(rule.solenoid);
+  if (it != m_solenoidBuses.end()) {
+    targets = it->second;
+  }
+
+  for (RS485Comm* source : sources) {
+    for (size_t i = 0; i < m_buses.size(); i++) {
+      if (targets & (((uint32_t)1) << i)) {
+        source->AddSwitchRule(rule, m_buses[i]);
       }
     }
   }
 }
 
-void PPUC::FlasherTest(u_int8_t number) {
-  printf("\nFlasher Test\n");
-  printf("=========\n");
+void PPUC::SetTestCallback(PPUC_TestCallback callback, const void* userData) {
+  m_testCallback = callback;
+  m_testCallbackUserData = userData;
+  m_pTestEngine->SetCallback(callback, userData);
+}
 
-  for (const auto& lamp : GetLamps()) {
-    if (lamp.type == LED_TYPE_FLASHER) {
-      if (number != 0 && lamp.number != number) {
-        continue;
-      }
-      printf(
-          "\nBoard: %d\nPort: %d\nNumber: %d\nDescription: %s\Color: "
-          "%08X\n",
-          lamp.board, lamp.port, lamp.number, lamp.description.c_str(),
-          lamp.color);
-      for (uint8_t i = 0; i < 3; i++) {
-        SetSolenoidState(lamp.number, 1);
-        std::this_thread::sleep_for(std::chrono::milliseconds(200));
-        SetSolenoidState(lamp.number, 0);
-        std::this_thread::sleep_for(std::chrono::milliseconds(1000));
-      }
+bool PPUC::StartTest(const PPUCTestPlan& plan) {
+  return m_pTestEngine->Start(plan);
+}
+
+void PPUC::CancelTest() { m_pTestEngine->Cancel(); }
+
+bool PPUC::IsTestRunning() { return m_pTestEngine->IsRunning(); }
+
+std::vector<PPUCTestResult> PPUC::WaitForTest() {
+  return m_pTestEngine->Wait();
+}
+
+void CALLBACK PPUC::LegacyTestCallback(const PPUCTestResult* result,
+                                       const void* /* userData */) {
+  if (result->devices == PPUC_TEST_SWITCHES) {
+    if (result->result != PPUC_TEST_RESULT_RUNNING &&
+        result->result != PPUC_TEST_RESULT_CANCELLED) {
+      printf("Switch updated: #%d, %d\nDescription: %s\n", result->number,
+             result->state, result->description.c_str());
     }
+  } else if (result->result == PPUC_TEST_RESULT_RUNNING) {
+    printf("\nBoard: %d\nPort: %d\nNumber: %d\nDescription: %s\n",
+           result->board, result->port, result->number,
+           result->description.c_str());
+  } else if (result->result == PPUC_TEST_RESULT_FAILED) {
+    printf("Board %d did not respond\n", result->board);
   }
+}
 
-  for (const auto& coil : GetCoils()) {
-    if (coil.type == PWM_TYPE_FLASHER) {
-      if (number != 0 && coil.number != number) {
-        continue;
-      }
-      printf("\nBoard: %d\nPort: %d\nNumber: %d\nDescription: %s\n", coil.board,
-             coil.port, coil.number, coil.description.c_str());
-      for (uint8_t i = 0; i < 3; i++) {
-        SetSolenoidState(coil.number, 1);
-        std::this_thread::sleep_for(std::chrono::milliseconds(200));
-        SetSolenoidState(coil.number, 0);
-        std::this_thread::sleep_for(std::chrono::milliseconds(1000));
-      }
-    }
+// Runs a test plan in the foreground, printing the progress like the tests
+// did before the test engine existed.
+void PPUC::RunLegacyTest(const PPUCTestPlan& plan) {
+  m_pTestEngine->SetCallback(&PPUC::LegacyTestCallback, this);
+  if (m_pTestEngine->Start(plan)) {
+    m_pTestEngine->Wait();
   }
+  m_pTestEngine->SetCallback(m_testCallback, m_testCallbackUserData);
 }
 
-void PPUC::GITest(u_int8_t number) {
-  printf("\nGI Test\n");
+void PPUC::CoilTest(u_int8_t number) {
+  printf("Coil Test\n");
   printf("=========\n");
 
-  for (uint8_t i = 1; i <= 8; i++) {
-    if (PLATFORM_WPC != m_platform && i > 1) {
-      break;
-    }
+  PPUCTestPlan plan;
+  plan.devices = PPUC_TEST_COILS;
+  plan.number = number;
+  RunLegacyTest(plan);
+}
 
-    if (number != 0 && number != i) {
-      continue;
-    }
+void PPUC::LampTest(u_int8_t number) {
+  printf("Lamp Test\n");
+  printf("=========\n");
 
-    printf("Setting GI String %d to brightness to %d\n", i, 8);
-    m_pRS485Comm->QueueEvent(new Event(EVENT_SOURCE_GI, /* string */ i,
-                                       /* full brightness */ 8));
-    std::this_thread::sleep_for(std::chrono::milliseconds(5000));
-    m_pRS485Comm->QueueEvent(new Event(EVENT_SOURCE_GI, /* string */ i, 0));
-    std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+  PPUCTestPlan plan;
+  plan.devices = PPUC_TEST_LAMPS;
+  plan.number = number;
+  if (number != 0) {
+    // Keep a single lamp on long enough to find it on the playfield.
+    plan.onTime = 10000;
   }
+  RunLegacyTest(plan);
+}
+
+void PPUC::FlasherTest(u_int8_t number) {
+  printf("\nFlasher Test\n");
+  printf("=========\n");
+
+  PPUCTestPlan plan;
+  plan.devices = PPUC_TEST_FLASHERS;
+  plan.number = number;
+  RunLegacyTest(plan);
 }
 
+void PPUC::GITest(u_int8_t number) {
+  printf("\nGI Test\n");
+  printf("=========\n");
+
+  PPUCTestPlan plan;
+  plan.devices = PPUC_TEST_GI;
+  plan.number = number;
+  RunLegacyTest(plan);
+}
+
+// Runs until CancelTest() gets called from another thread.
 void PPUC::SwitchTest() {
   printf("Switch Test\n");
   printf("=========\n");
 
-  PPUCSwitchState* switchState;
-  while (true) {
-    if ((switchState = GetNextSwitchState()) != nullptr) {
-      auto it = std::find_if(m_switches.begin(), m_switches.end(),
-                             [switchState](const PPUCSwitch& vswitch) {
-                               return vswitch.number == switchState->number;
-                             });
-
-      if (it != m_switches.end()) {
-        printf("Switch updated: #%d, %d\nDescription: %s", switchState->number,
-               switchState->state, it->description.c_str());
-      } else {
-        printf("Switch updated: #%d, %d\n", switchState->number,
-               switchState->state);
-      }
-    }
-    std::this_thread::sleep_for(std::chrono::milliseconds(200));
-  }
+  PPUCTestPlan plan;
+  plan.devices = PPUC_TEST_SWITCHES;
+  RunLegacyTest(plan);
 }
@@ -19,12 +19,33 @@
 #define PPUCAPI __attribute__((visibility("default")))
 #endif
 
+#include <atomic>
+#include <condition_variable>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <vector>
+
+#include "PPUCAwaiters.h"
+#include "PPUCDeviceCatalog.h"
 #include "PPUC_structs.h"
 #include "yaml-cpp/yaml.h"
 
 class RS485Comm;
+class PPUCBridge;
+class PPUCTestEngine;
+class PPUCStressTest;
+struct Event;
+struct ConfigEvent;
 
 class PPUCAPI PPUC {
+  friend class PPUCTestEngine;
+  friend class PPUCAwaiters;
+  friend class PPUCStressTest;
+
  public:
   PPUC();
   ~PPUC();
@@ -39,14 +60,95 @@ class PPUCAPI PPUC {
   const char* GetRom();
   void SetSerial(const char* serial);
   const char* GetSerial();
+  void SetSerialThreadConfig(const PPUCThreadConfig& config);
+  int GetSerialThreadConfigResult();
+  PPUCBusStatistics GetBusStatistics(uint8_t bus);
+  // Returns false if another connect is running.
   bool Connect();
+  // Runs Connect() in the background, so the host is able to boot in
+  // parallel. Solenoid, lamp and LED updates are ignored and no switch states
+  // are returned until the connection is established. Calls during a running
+  // ConnectAsync() return its result.
+  std::shared_future<bool> ConnectAsync();
+  void SetConnectProgressCallback(PPUC_ConnectProgressCallback callback,
+                                  const void* userData);
+  // Waits for a running connect and closes the buses.
   void Disconnect();
   void StartUpdates();
   void StopUpdates();
 
-  void SetSolenoidState(int number, int state);
-  void SetLampState(int number, int state);
+  // Publishes the switch states and accepts solenoid and lamp commands from
+  // PPUCClient instances in other processes. Has to be started after
+  // Connect().
+  bool StartSharedMemoryBridge(const char* name = "ppuc");
+  void StopSharedMemoryBridge();
+
+  // Solenoid and lamp updates return PPUC_QUEUE_OK or the reason why they got
+  // dropped. What happens if an event queue is full depends on the queue
+  // policy.
+  void SetQueuePolicy(uint8_t queuePolicy);
+  uint8_t SetSolenoidState(int number, int state);
+  uint8_t SetLampState(int number, int state);
+  // Sets the brightness of a lamp or flasher in 0..255. It is quantized to
+  // the brightnessLevels of the output and only sent if the level changes by
+  // more than the configured hysteresis, at most maxUpdateRate times per
+  // second. The latest intensity always wins, so these updates never get
+  // dropped. Don't mix them with SetLampState() or SetSolenoidState() for
+  // the same output.
+  uint8_t SetLampIntensity(int number, uint8_t intensity);
+  uint8_t SetSolenoidIntensity(int number, uint8_t intensity);
+  // Turns a solenoid on and off again after duration ms. The serial thread
+  // takes care of the timing, so the pulse doesn't depend on the host. The
+  // pulse bypasses the event queue and its width is measured from the moment
+  // the on event got written. It is not part of a frame.
+  uint8_t PulseSolenoid(int number, uint32_t duration);
+  uint8_t ScheduleSolenoidState(int number, int state, uint32_t delay);
+  uint8_t ScheduleLampState(int number, int state, uint32_t delay);
+  // Solenoid, lamp and GI updates of the calling thread between BeginFrame()
+  // and CommitFrame() are collected and handed over to the serial threads in
+  // one step. Every bus sends its part of the frame back to back, without
+  // switch polling in between. Scheduled updates are not part of a frame.
+  // A frame belongs to the thread that began it, BeginFrame() returns false
+  // while another thread's frame is in progress.
+  bool BeginFrame();
+  uint8_t CommitFrame();
+  // Sets the colors in 0xWWRRGGBB format of count LEDs of a stripe, starting
+  // at LED first. Only the changes get transmitted, limited to the airtime
+  // share configured for the stripe.
+  bool SetLedFrame(uint8_t board, uint8_t port, const uint32_t* colors,
+                   uint16_t count, uint16_t first = 0);
   PPUCSwitchState* GetNextSwitchState();
+  // Switch rules from the switchRules configuration and the ones added here
+  // are handed to the serial threads on Connect(). They fire on switch edges
+  // only, not on the initial switch states. Returns false if the rule has no
+  // pulse duration.
+  bool AddSwitchRule(const PPUCSwitchRule& rule);
+  void ClearSwitchRules();
+  void SetSwitchRuleCallback(PPUC_SwitchRuleCallback callback,
+                             const void* userData);
+  // Switches exceeding their configured maxRate get quarantined if configured
+  // so. Their edges are dropped until they get released.
+  bool IsSwitchQuarantined(uint8_t number);
+  void ReleaseSwitch(uint8_t number);
+
+  // Awaitables for coroutine based hosts, for example
+  // PPUCSwitchState switchState = co_await ppuc.NextSwitchEvent();
+  // Coroutines get resumed by the serial thread that completes them, unless a
+  // resume callback hands them over to an executor of the host. They must
+  // not be suspended when PPUC gets destroyed.
+  //
+  // Takes the next switch state from the queue, like GetNextSwitchState().
+  PPUCSwitchAwaitable NextSwitchEvent();
+  // Returns the next state of the given switch without taking it from the
+  // queue.
+  PPUCSwitchAwaitable SwitchChanged(uint8_t number);
+  // Returns true once all solenoid, lamp and GI updates queued so far got
+  // written to the buses, false if the buses got disconnected before.
+  PPUCResultAwaitable Sent();
+  // Returns the result of the running or last Connect() or ConnectAsync(),
+  // including the configuration upload.
+  PPUCResultAwaitable Connected();
+  void SetResumeCallback(PPUC_ResumeCallback callback, const void* userData);
 
   uint8_t GetCoinDoorClosedSwitch() { return m_coinDoorClosedSwitch; };
   uint8_t GetGameOnSolenoid() { return m_gameOnSolenoid; };
@@ -57,17 +159,116 @@ class PPUCAPI PPUC {
   void GITest(uint8_t number);
   void SwitchTest();
 
+  // Runs a hardware test in the background and reports the results of the
+  // devices via the callback. Devices of different boards get tested in
+  // parallel. The host must not poll switch states during a switch test.
+  bool StartTest(const PPUCTestPlan& plan);
+  void CancelTest();
+  bool IsTestRunning();
+  // Blocks until the test finished.
+  std::vector<PPUCTestResult> WaitForTest();
+  void SetTestCallback(PPUC_TestCallback callback, const void* userData);
+  bool IsBoardActive(uint8_t board);
+
+  // Floods the buses with harmless traffic at increasing rates and reports
+  // the sustained throughput, errors and poll latencies per step. Blocks
+  // until the test is done or got cancelled from another thread.
+  std::vector<PPUCStressResult> RunStressTest(const PPUCStressConfig& config);
+  void CancelStressTest();
+  void SetStressCallback(PPUC_StressCallback callback, const void* userData);
+  // Boards that stop responding are left out of the switch polling until they
+  // recover. The callback is called by the serial thread of the board's bus.
+  void SetBoardStateCallback(PPUC_BoardStateCallback callback,
+                             const void* userData);
+  // Faults and telemetry reported by the boards. The serial thread switches a
+  // faulted solenoid off and drops all further commands to it before the
+  // callback gets called. The solenoid stays blocked until the board clears
+  // the fault or ClearSolenoidFault() gets called.
+  void SetBoardEventCallback(PPUC_BoardEventCallback callback,
+                             const void* userData);
+  bool IsSolenoidFaulted(uint8_t number);
+  void ClearSolenoidFault(uint8_t number);
+
+  // Copies of the device tables, sorted by number. Prefer GetDeviceCatalog(),
+  // which doesn't copy anything. The catalog is replaced as a whole at the
+  // end of a connect, the returned one stays valid as long as it is held.
   std::vector<PPUCCoil> GetCoils();
   std::vector<PPUCLamp> GetLamps();
   std::vector<PPUCSwitch> GetSwitches();
+  std::shared_ptr<const PPUCDeviceCatalog> GetDeviceCatalog();
 
  private:
   YAML::Node m_ppucConfig;
-  RS485Comm* m_pRS485Comm;
+  // One RS485Comm, each with its own thread and queues, per serial port.
+  // Replaced by Connect() only. Other threads have to hold the shared lock
+  // while they use the buses or the routes, and must not touch them while
+  // connecting.
+  std::vector<RS485Comm*> m_buses;
+  std::shared_mutex m_busesMutex;
+  std::vector<PPUCSerialPort> m_serialPorts;
+  // Maps board numbers to the index of the bus they are connected to.
+  std::map<uint8_t, uint8_t> m_boardBus;
+  // Maps solenoid and lamp numbers to a bit mask of the buses that have a
+  // board which drives them.
+  std::map<uint16_t, uint32_t> m_solenoidBuses;
+  std::map<uint16_t, uint32_t> m_lampBuses;
+  size_t m_nextSwitchBus = 0;
+  std::atomic<PPUCBridge*> m_pBridge = nullptr;
+  PPUCTestEngine* m_pTestEngine;
+  PPUCStressTest* m_pStressTest;
+  PPUCAwaiters* m_pAwaiters;
+  static void CALLBACK SentCallback(const void* userData);
+  PPUC_TestCallback m_testCallback = nullptr;
+  const void* m_testCallbackUserData = nullptr;
+  void RunLegacyTest(const PPUCTestPlan& plan);
+  static void CALLBACK LegacyTestCallback(const PPUCTestResult* result,
+                                          const void* userData);
+  std::atomic<bool> m_connecting = false;
+  // Set for the whole Connect() or Disconnect(), unlike m_connecting which
+  // ends before the serial threads get started. Guards m_connectResult as
+  // well.
+  std::mutex m_connectMutex;
+  std::condition_variable m_connectDone;
+  bool m_connectRunning = false;
+  std::shared_future<bool> m_connectResult;
+  PPUCConnectProgress m_connectProgress;
+  PPUC_ConnectProgressCallback m_connectProgressCallback = nullptr;
+  const void* m_connectProgressUserData = nullptr;
+  void ReportConnectProgress(uint8_t phase);
+  static void CALLBACK SwitchCallback(int number, int state,
+                                      const void* userData);
+  PPUC_LogMessageCallback m_logMessageCallback = nullptr;
+  const void* m_logMessageUserData = nullptr;
+  void LogMessage(const char* format, ...);
+  PPUC_BoardStateCallback m_boardStateCallback = nullptr;
+  const void* m_boardStateUserData = nullptr;
+  PPUC_BoardEventCallback m_boardEventCallback = nullptr;
+  const void* m_boardEventUserData = nullptr;
+  std::vector<PPUCSwitchRule> m_switchRules;
+  PPUC_SwitchRuleCallback m_switchRuleCallback = nullptr;
+  const void* m_switchRuleUserData = nullptr;
+  void ApplySwitchRule(const PPUCSwitchRule& rule);
+  PPUCThreadConfig m_serialThreadConfig;
+  int m_baudRate = 115200;
+  int m_maxBaudRate = 0;
+  uint8_t m_transport = PPUC_TRANSPORT_LIBSERIALPORT;
+  bool m_crc = false;
+  uint8_t m_pollShare = 50;
+  uint8_t m_queuePolicy = PPUC_QUEUE_POLICY_BLOCK;
+  // Guards the frame state, m_inFrame lets other updates skip the lock.
+  std::mutex m_frameMutex;
+  std::atomic<bool> m_inFrame = false;
+  std::thread::id m_frameThread;
+  // Events of the current frame per bus.
+  std::vector<std::vector<Event*>> m_frameEvents;
+  void ClearFrame();
+  bool m_hasSerialThreadConfig = false;
   uint8_t ResolveLedType(std::string type);
-  std::vector<PPUCCoil> m_coils;
-  std::vector<PPUCLamp> m_lamps;
-  std::vector<PPUCSwitch> m_switches;
+  // Guarded by m_busesMutex. Connect() builds a new catalog in
+  // m_pConnectDevices and publishes it when it ends.
+  std::shared_ptr<const PPUCDeviceCatalog> m_devices =
+      std::make_shared<PPUCDeviceCatalog>();
+  std::shared_ptr<PPUCDeviceCatalog> m_pConnectDevices;
 
   bool m_debug = false;
   char* m_rom;
@@ -76,8 +277,28 @@ class PPUCAPI PPUC {
   uint8_t m_coinDoorClosedSwitch;
   uint8_t m_gameOnSolenoid;
 
+  uint8_t ResolveTransport(const YAML::Node& node, uint8_t transport);
+  void ParseThreadConfig(const YAML::Node& node,
+                         PPUCThreadConfig& threadConfig);
+  void CreateBuses();
+  void DeleteBuses();
+  void SetConnecting(bool connecting);
+  bool BeginConnect();
+  void EndConnect();
+  bool RunConnect();
+  bool ConnectBuses();
+  RS485Comm* GetBus(uint8_t board);
+  void AddRoute(std::map<uint16_t, uint32_t>& routes, uint16_t number,
+                uint8_t board);
+  uint32_t GetRoutes(uint8_t sourceId, uint16_t number);
+  uint8_t QueueEvent(Event* event, uint32_t delay = 0);
+  uint8_t SetIntensity(uint8_t sourceId, uint16_t number, uint8_t intensity);
+  void SendConfigEvent(ConfigEvent* configEvent);
+
   void SendTriggerConfigBlock(const YAML::Node& items, uint32_t type,
                               uint8_t board, uint32_t port);
   void SendLedConfigBlock(const YAML::Node& items, uint32_t type, uint8_t board,
                           uint32_t port);
+  void ConfigureIntensity(const YAML::Node& output, uint8_t sourceId,
+                          uint8_t board);
 };
@@ -0,0 +1,196 @@
+#include "PPUCAwaiters.h"
+
+#include "PPUC.h"
+#include "RS485Comm.h"
+
+bool PPUCSwitchAwaitable::await_suspend(std::coroutine_handle<> handle) {
+  return awaiters->Suspend(this, handle);
+}
+
+bool PPUCResultAwaitable::await_suspend(std::coroutine_handle<> handle) {
+  return awaiters->Suspend(this, handle);
+}
+
+PPUCAwaiters::PPUCAwaiters(PPUC* pPPUC) { m_pPPUC = pPPUC; }
+
+void PPUCAwaiters::SetResumeCallback(PPUC_ResumeCallback callback,
+                                     const void* userData) {
+  m_mutex.lock();
+  m_resumeCallback = callback;
+  m_resumeUserData = userData;
+  m_mutex.unlock();
+}
+
+bool PPUCAwaiters::Suspend(PPUCAwaiter* awaiter,
+                           std::coroutine_handle<> handle) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (IsComplete(awaiter)) {
+    return false;
+  }
+
+  awaiter->handle = handle;
+  m_awaiters.push_back(awaiter);
+  if (awaiter->type == PPUC_AWAIT_SENT) {
+    m_sentAwaiters++;
+  }
+
+  return true;
+}
+
+// Has to be called with the mutex locked.
+bool PPUCAwaiters::IsComplete(PPUCAwaiter* awaiter) {
+  switch (awaiter->type) {
+    case PPUC_AWAIT_NEXT_SWITCH: {
+      // Switch states that are queued already are returned first, and the
+      // awaiter takes its state from the queue, so no other consumer gets it
+      // as well.
+      PPUCSwitchState* switchState = m_pPPUC->GetNextSwitchState();
+      if (switchState) {
+        awaiter->switchState = *switchState;
+        delete switchState;
+        return true;
+      }
+      return false;
+    }
+
+    case PPUC_AWAIT_SENT: {
+      std::shared_lock<std::shared_mutex> lock(m_pPPUC->m_busesMutex);
+      if (awaiter->positions.size() != m_pPPUC->m_buses.size()) {
+        // The buses got replaced, the events are gone.
+        awaiter->result = false;
+        return true;
+      }
+      for (size_t i = 0; i < awaiter->positions.size(); i++) {
+        if (m_pPPUC->m_buses[i]->GetSentPosition() < awaiter->positions[i]) {
+          return false;
+        }
+      }
+      awaiter->result = true;
+      return true;
+    }
+
+    case PPUC_AWAIT_CONNECTED:
+      awaiter->result = m_connected;
+      return !m_connecting;
+
+    default:
+      return false;
+  }
+}
+
+void PPUCAwaiters::OnSwitch(int number, int state) {
+  std::vector<PPUCAwaiter*> resume;
+
+  m_mutex.lock();
+  for (auto it = m_awaiters.begin(); it != m_awaiters.end();) {
+    PPUCAwaiter* awaiter = *it;
+    bool complete = false;
+    if (awaiter->type == PPUC_AWAIT_SWITCH_CHANGED) {
+      if (awaiter->number == number) {
+        awaiter->switchState = PPUCSwitchState(number, state);
+        complete = true;
+      }
+    } else if (awaiter->type == PPUC_AWAIT_NEXT_SWITCH) {
+      // Another consumer might have taken the state from the queue already.
+      complete = IsComplete(awaiter);
+    }
+
+    if (complete) {
+      resume.push_back(awaiter);
+      it = m_awaiters.erase(it);
+    } else {
+      it++;
+    }
+  }
+  m_mutex.unlock();
+
+  Resume(resume);
+}
+
+void PPUCAwaiters::OnSent() {
+  if (m_sentAwaiters == 0) {
+    return;
+  }
+
+  std::vector<PPUCAwaiter*> resume;
+
+  m_mutex.lock();
+  for (auto it = m_awaiters.begin(); it != m_awaiters.end();) {
+    if ((*it)->type == PPUC_AWAIT_SENT && IsComplete(*it)) {
+      resume.push_back(*it);
+      it = m_awaiters.erase(it);
+      m_sentAwaiters--;
+    } else {
+      it++;
+    }
+  }
+  m_mutex.unlock();
+
+  Resume(resume);
+}
+
+void PPUCAwaiters::OnConnecting() {
+  m_mutex.lock();
+  m_connecting = true;
+  m_connected = false;
+  m_mutex.unlock();
+}
+
+void PPUCAwaiters::OnConnected(bool connected) {
+  std::vector<PPUCAwaiter*> resume;
+
+  m_mutex.lock();
+  m_connecting = false;
+  m_connected = connected;
+  for (auto it = m_awaiters.begin(); it != m_awaiters.end();) {
+    if ((*it)->type == PPUC_AWAIT_CONNECTED) {
+      (*it)->result = connected;
+      resume.push_back(*it);
+      it = m_awaiters.erase(it);
+    } else {
+      it++;
+    }
+  }
+  m_mutex.unlock();
+
+  Resume(resume);
+}
+
+void PPUCAwaiters::CancelSent() {
+  std::vector<PPUCAwaiter*> resume;
+
+  m_mutex.lock();
+  for (auto it = m_awaiters.begin(); it != m_awaiters.end();) {
+    if ((*it)->type == PPUC_AWAIT_SENT) {
+      (*it)->result = false;
+      resume.push_back(*it);
+      it = m_awaiters.erase(it);
+      m_sentAwaiters--;
+    } else {
+      it++;
+    }
+  }
+  m_mutex.unlock();
+
+  Resume(resume);
+}
+
+// Resumes outside of the lock, the coroutines might await again right away.
+void PPUCAwaiters::Resume(std::vector<PPUCAwaiter*>& awaiters) {
+  if (awaiters.empty()) {
+    return;
+  }
+
+  m_mutex.lock();
+  PPUC_ResumeCallback callback = m_resumeCallback;
+  const void* userData = m_resumeUserData;
+  m_mutex.unlock();
+
+  for (PPUCAwaiter* awaiter : awaiters) {
+    if (callback) {
+      (*(callback))(awaiter->handle.address(), userData);
+    } else {
+      awaiter->handle.resume();
+    }
+  }
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#ifndef PPUCAPI
+#ifdef _MSC_VER
+#define PPUCAPI __declspec(dllexport)
+#else
+#define PPUCAPI __attribute__((visibility("default")))
+#endif
+#endif
+
+#include <inttypes.h>
+
+#include <atomic>
+#include <coroutine>
+#include <mutex>
+#include <vector>
+
+#include "PPUC_structs.h"
+
+#define PPUC_AWAIT_NEXT_SWITCH 0
+#define PPUC_AWAIT_SWITCH_CHANGED 1
+#define PPUC_AWAIT_SENT 2
+#define PPUC_AWAIT_CONNECTED 3
+
+class PPUC;
+class PPUCAwaiters;
+
+// State of a suspended coroutine. It lives in the coroutine frame as part of
+// the awaitable until the coroutine gets resumed.
+struct PPUCAwaiter {
+  PPUCAwaiters* awaiters;
+  uint8_t type;
+  int number = 0;
+  // Queue positions of the buses that have to be sent for PPUC_AWAIT_SENT.
+  std::vector<uint64_t> positions;
+  PPUCSwitchState switchState = PPUCSwitchState(0, 0);
+  bool result = false;
+  std::coroutine_handle<> handle;
+
+  PPUCAwaiter(PPUCAwaiters* a, uint8_t t, int n = 0)
+      : awaiters(a), type(t), number(n) {}
+};
+
+// co_await returns the switch state.
+class PPUCAPI PPUCSwitchAwaitable : public PPUCAwaiter {
+ public:
+  PPUCSwitchAwaitable(PPUCAwaiters* awaiters, uint8_t type, int number = 0)
+      : PPUCAwaiter(awaiters, type, number) {}
+
+  bool await_ready() { return false; }
+  bool await_suspend(std::coroutine_handle<> handle);
+  PPUCSwitchState await_resume() { return switchState; }
+};
+
+// co_await returns true on success.
+class PPUCAPI PPUCResultAwaitable : public PPUCAwaiter {
+ public:
+  PPUCResultAwaitable(PPUCAwaiters* awaiters, uint8_t type)
+      : PPUCAwaiter(awaiters, type) {}
+
+  bool await_ready() { return false; }
+  bool await_suspend(std::coroutine_handle<> handle);
+  bool await_resume() { return result; }
+};
+
+// Coroutines waiting for switch changes, sent events or the end of a
+// connect. They get resumed by the thread that completes them, usually a
+// serial thread, or handed over to the resume callback.
+class PPUCAwaiters {
+ public:
+  PPUCAwaiters(PPUC* pPPUC);
+
+  void SetResumeCallback(PPUC_ResumeCallback callback, const void* userData);
+
+  // Returns false if the awaiter is complete already and must not suspend.
+  bool Suspend(PPUCAwaiter* awaiter, std::coroutine_handle<> handle);
+
+  void OnSwitch(int number, int state);
+  void OnSent();
+  void OnConnecting();
+  void OnConnected(bool connected);
+  // Resumes the coroutines waiting for events that got lost with the buses.
+  void CancelSent();
+
+ private:
+  bool IsComplete(PPUCAwaiter* awaiter);
+  void Resume(std::vector<PPUCAwaiter*>& awaiters);
+
+  PPUC* m_pPPUC;
+  PPUC_ResumeCallback m_resumeCallback = nullptr;
+  const void* m_resumeUserData = nullptr;
+
+  std::vector<PPUCAwaiter*> m_awaiters;
+  // Lets the serial threads skip the lock if nobody waits for sent events.
+  std::atomic<uint32_t> m_sentAwaiters = 0;
+  bool m_connecting = false;
+  bool m_connected = false;
+  std::mutex m_mutex;
+};
@@ -0,0 +1,143 @@
+#include "PPUCBridge.h"
+
+#include <chrono>
+#include <cstring>
+
+#include "PPUC.h"
+
+PPUCBridge::PPUCBridge(PPUC* pPPUC) { m_pPPUC = pPPUC; }
+
+PPUCBridge::~PPUCBridge() { Stop(); }
+
+bool PPUCBridge::Start(const char* name) {
+  Stop();
+
+  if (!m_sharedMemory.Create(name, sizeof(PPUCSharedState))) {
+    return false;
+  }
+
+  // A previous daemon might have left its state behind.
+  PPUCSharedState* pState = (PPUCSharedState*)m_sharedMemory.GetData();
+  memset((void*)pState, 0, sizeof(PPUCSharedState));
+  pState->version = PPUC_SHARED_STATE_VERSION;
+  pState->magic.store(PPUC_SHARED_STATE_MAGIC, std::memory_order_release);
+
+  m_publishMutex.lock();
+  m_pState = pState;
+  m_publishMutex.unlock();
+
+  m_running = true;
+  m_pThread = new std::thread([this]() { Run(); });
+
+  return true;
+}
+
+void PPUCBridge::Stop() {
+  m_running = false;
+  if (m_pThread) {
+    m_pThread->join();
+
+    delete m_pThread;
+    m_pThread = NULL;
+  }
+
+  m_publishMutex.lock();
+  if (m_pState) {
+    m_pState->magic.store(0, std::memory_order_release);
+    m_pState = nullptr;
+  }
+  m_sharedMemory.Close();
+  m_publishMutex.unlock();
+}
+
+void PPUCBridge::PublishSwitchState(int number, int state) {
+  if (number < 0 || number >= PPUC_SHARED_STATE_SWITCH_WORDS * 64) {
+    return;
+  }
+
+  m_publishMutex.lock();
+  if (m_pState) {
+    uint32_t sequence =
+        m_pState->switchSequence.load(std::memory_order_relaxed);
+    m_pState->switchSequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    std::atomic<uint64_t>& word = m_pState->switches[number / 64];
+    uint64_t bit = ((uint64_t)1) << (number % 64);
+    if (state) {
+      word.fetch_or(bit, std::memory_order_relaxed);
+    } else {
+      word.fetch_and(~bit, std::memory_order_relaxed);
+    }
+
+    m_pState->switchSequence.store(sequence + 2, std::memory_order_release);
+
+    uint64_t index =
+        m_pState->switchEventIndex.load(std::memory_order_relaxed);
+    m_pState->switchEvents[index % PPUC_SHARED_STATE_SWITCH_EVENTS].store(
+        PPUCEncodeSwitchEvent(index, (uint8_t)number, state ? 1 : 0),
+        std::memory_order_release);
+    m_pState->switchEventIndex.store(index + 1, std::memory_order_release);
+  }
+  m_publishMutex.unlock();
+}
+
+bool PPUCBridge::ProcessCommands(PPUCCommandRing* ring) {
+  uint32_t tail = ring->tail.load(std::memory_order_relaxed);
+  uint32_t generation = ring->generation.load(std::memory_order_acquire);
+  if (generation != ring->processedGeneration) {
+    // The ring got claimed by another client, skip the commands of the
+    // previous one.
+    ring->processedGeneration = generation;
+    tail = ring->start.load(std::memory_order_relaxed);
+    ring->tail.store(tail, std::memory_order_release);
+  }
+
+  uint32_t head = ring->head.load(std::memory_order_acquire);
+  if (tail == head) {
+    return false;
+  }
+  if (head - tail > PPUC_SHARED_STATE_COMMANDS) {
+    // A client can't be more than a full ring ahead, never walk through
+    // garbage.
+    ring->tail.store(head, std::memory_order_release);
+    return false;
+  }
+
+  while (tail != head) {
+    uint32_t command = ring->commands[tail % PPUC_SHARED_STATE_COMMANDS];
+    uint16_t number = (command >> 8) & 0xffff;
+    uint8_t state = command & 0xff;
+    switch (command >> 24) {
+      case PPUC_COMMAND_SOLENOID:
+        m_pPPUC->SetSolenoidState(number, state);
+        break;
+
+      case PPUC_COMMAND_LAMP:
+        m_pPPUC->SetLampState(number, state);
+        break;
+    }
+    tail++;
+  }
+  ring->tail.store(tail, std::memory_order_release);
+
+  return true;
+}
+
+void PPUCBridge::Run() {
+  while (m_running) {
+    bool processed = false;
+    for (int i = 0; i < PPUC_SHARED_STATE_CLIENTS; i++) {
+      PPUCCommandRing* ring = &m_pState->rings[i];
+      if (ring->owner.load(std::memory_order_acquire) != 0) {
+        processed |= ProcessCommands(ring);
+      }
+    }
+    m_pState->heartbeat.fetch_add(1, std::memory_order_relaxed);
+
+    if (!processed) {
+      std::this_thread::sleep_for(
+          std::chrono::microseconds(PPUC_BRIDGE_POLL_INTERVAL));
+    }
+  }
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <inttypes.h>
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+#include "PPUCSharedState.h"
+#include "SharedMemory.h"
+
+// Time in microseconds the bridge thread sleeps if none of the clients sent a
+// command.
+#define PPUC_BRIDGE_POLL_INTERVAL 100
+
+class PPUC;
+
+// Daemon side of the shared memory bridge. Publishes the switch states of all
+// buses and forwards the solenoid and lamp commands of the clients to PPUC.
+class PPUCBridge {
+ public:
+  PPUCBridge(PPUC* pPPUC);
+  ~PPUCBridge();
+
+  bool Start(const char* name);
+  void Stop();
+
+  // Called by the serial threads for every switch change.
+  void PublishSwitchState(int number, int state);
+
+ private:
+  void Run();
+  bool ProcessCommands(PPUCCommandRing* ring);
+
+  PPUC* m_pPPUC;
+  SharedMemory m_sharedMemory;
+  PPUCSharedState* m_pState = nullptr;
+  // Serializes the publishers of multiple buses, the seqlock only supports a
+  // single writer.
+  std::mutex m_publishMutex;
+  std::thread* m_pThread = nullptr;
+  std::atomic<bool> m_running = false;
+};
@@ -0,0 +1,183 @@
+#include "PPUCClient.h"
+
+#include "PPUCSharedState.h"
+#include "SharedMemory.h"
+
+static_assert(PPUC_SHARED_STATE_SWITCH_WORDS == 4,
+              "PPUCClient::m_switches has to match the shared switch bitmap");
+
+PPUCClient::PPUCClient() { m_pSharedMemory = new SharedMemory(); }
+
+PPUCClient::~PPUCClient() {
+  Disconnect();
+
+  delete m_pSharedMemory;
+}
+
+bool PPUCClient::Connect(const char* name) {
+  Disconnect();
+
+  if (!m_pSharedMemory->Open(name, sizeof(PPUCSharedState))) {
+    return false;
+  }
+
+  m_pState = (PPUCSharedState*)m_pSharedMemory->GetData();
+  if (m_pState->magic.load(std::memory_order_acquire) !=
+          PPUC_SHARED_STATE_MAGIC ||
+      m_pState->version != PPUC_SHARED_STATE_VERSION) {
+    Disconnect();
+    return false;
+  }
+
+  // Claim a free command ring, or one of a client that died without
+  // releasing it.
+  uint32_t pid = SharedMemory::GetProcessId();
+  for (int i = 0; i < PPUC_SHARED_STATE_CLIENTS && !m_pRing; i++) {
+    PPUCCommandRing* ring = &m_pState->rings[i];
+    uint32_t owner = ring->owner.load(std::memory_order_relaxed);
+    if ((owner == 0 || !SharedMemory::ProcessExists(owner)) &&
+        ring->owner.compare_exchange_strong(owner, pid,
+                                            std::memory_order_acq_rel)) {
+      // Let the daemon drop commands a dead client left behind.
+      ring->start.store(ring->head.load(std::memory_order_relaxed),
+                        std::memory_order_relaxed);
+      ring->generation.fetch_add(1, std::memory_order_release);
+      m_pRing = ring;
+    }
+  }
+  if (!m_pRing) {
+    Disconnect();
+    return false;
+  }
+
+  Resync();
+
+  return true;
+}
+
+void PPUCClient::Disconnect() {
+  if (m_pRing) {
+    m_pRing->owner.store(0, std::memory_order_release);
+    m_pRing = nullptr;
+  }
+  m_pState = nullptr;
+  m_pSharedMemory->Close();
+
+  while (!m_pendingSwitches.empty()) {
+    delete m_pendingSwitches.front();
+    m_pendingSwitches.pop();
+  }
+}
+
+bool PPUCClient::IsConnected() {
+  return m_pState && m_pState->magic.load(std::memory_order_acquire) ==
+                         PPUC_SHARED_STATE_MAGIC;
+}
+
+bool PPUCClient::SendCommand(uint8_t type, int number, int state) {
+  if (!m_pRing) {
+    return false;
+  }
+
+  uint32_t head = m_pRing->head.load(std::memory_order_relaxed);
+  uint32_t tail = m_pRing->tail.load(std::memory_order_acquire);
+  if (head - tail >= PPUC_SHARED_STATE_COMMANDS) {
+    return false;
+  }
+
+  m_pRing->commands[head % PPUC_SHARED_STATE_COMMANDS] =
+      PPUCEncodeCommand(type, (uint16_t)number, state == 0 ? 0 : 1);
+  m_pRing->head.store(head + 1, std::memory_order_release);
+
+  return true;
+}
+
+bool PPUCClient::SetSolenoidState(int number, int state) {
+  return SendCommand(PPUC_COMMAND_SOLENOID, number, state);
+}
+
+bool PPUCClient::SetLampState(int number, int state) {
+  return SendCommand(PPUC_COMMAND_LAMP, number, state);
+}
+
+// Reads a consistent snapshot of the switch bitmap and queues the differences
+// to the last known states. Used on connect and if switch events got
+// overwritten before they were read.
+void PPUCClient::Resync() {
+  uint64_t switches[PPUC_SHARED_STATE_SWITCH_WORDS];
+  uint64_t index;
+  uint32_t sequence;
+  do {
+    sequence = m_pState->switchSequence.load(std::memory_order_acquire);
+    if (sequence & 1) {
+      continue;
+    }
+    index = m_pState->switchEventIndex.load(std::memory_order_acquire);
+    for (int i = 0; i < PPUC_SHARED_STATE_SWITCH_WORDS; i++) {
+      switches[i] = m_pState->switches[i].load(std::memory_order_relaxed);
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+  } while ((sequence & 1) ||
+           sequence !=
+               m_pState->switchSequence.load(std::memory_order_relaxed));
+
+  for (int i = 0; i < PPUC_SHARED_STATE_SWITCH_WORDS; i++) {
+    uint64_t changed = switches[i] ^ m_switches[i];
+    for (int bit = 0; bit < 64; bit++) {
+      if (changed & (((uint64_t)1) << bit)) {
+        m_pendingSwitches.push(
+            new PPUCSwitchState(i * 64 + bit, (switches[i] >> bit) & 1));
+      }
+    }
+    m_switches[i] = switches[i];
+  }
+  m_switchEventIndex = index;
+}
+
+PPUCSwitchState* PPUCClient::GetNextSwitchState() {
+  if (!m_pState) {
+    return nullptr;
+  }
+
+  if (m_pendingSwitches.empty() &&
+      m_switchEventIndex <
+          m_pState->switchEventIndex.load(std::memory_order_acquire)) {
+    uint64_t event =
+        m_pState
+            ->switchEvents[m_switchEventIndex % PPUC_SHARED_STATE_SWITCH_EVENTS]
+            .load(std::memory_order_acquire);
+    if ((event >> 32) != (m_switchEventIndex & 0xffffffff)) {
+      // We've been too slow, the daemon overwrote events already.
+      Resync();
+    } else {
+      int number = (event >> 8) & 0xff;
+      int state = event & 0xff;
+      uint64_t bit = ((uint64_t)1) << (number % 64);
+      if (state) {
+        m_switches[number / 64] |= bit;
+      } else {
+        m_switches[number / 64] &= ~bit;
+      }
+      m_switchEventIndex++;
+
+      return new PPUCSwitchState(number, state);
+    }
+  }
+
+  if (m_pendingSwitches.empty()) {
+    return nullptr;
+  }
+
+  PPUCSwitchState* switchState = m_pendingSwitches.front();
+  m_pendingSwitches.pop();
+
+  return switchState;
+}
+
+int PPUCClient::GetSwitchState(int number) {
+  if (number < 0 || number >= PPUC_SHARED_STATE_SWITCH_WORDS * 64) {
+    return 0;
+  }
+
+  return (m_switches[number / 64] >> (number % 64)) & 1;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#ifndef PPUCAPI
+#ifdef _MSC_VER
+#define PPUCAPI __declspec(dllexport)
+#else
+#define PPUCAPI __attribute__((visibility("default")))
+#endif
+#endif
+
+#include <inttypes.h>
+
+#include <queue>
+
+#include "PPUC_structs.h"
+
+class SharedMemory;
+struct PPUCSharedState;
+struct PPUCCommandRing;
+
+// Connects to a PPUC instance running the shared memory bridge in another
+// process, see PPUC::StartSharedMemoryBridge().
+class PPUCAPI PPUCClient {
+ public:
+  PPUCClient();
+  ~PPUCClient();
+
+  bool Connect(const char* name = "ppuc");
+  void Disconnect();
+  // Returns false if the daemon stopped the bridge.
+  bool IsConnected();
+
+  // Return false if the command ring is full.
+  bool SetSolenoidState(int number, int state);
+  bool SetLampState(int number, int state);
+
+  // Returns the next switch change like PPUC::GetNextSwitchState(). The caller
+  // has to delete the returned PPUCSwitchState.
+  PPUCSwitchState* GetNextSwitchState();
+  // Returns the current state of a switch.
+  int GetSwitchState(int number);
+
+ private:
+  bool SendCommand(uint8_t type, int number, int state);
+  void Resync();
+
+  SharedMemory* m_pSharedMemory;
+  PPUCSharedState* m_pState = nullptr;
+  PPUCCommandRing* m_pRing = nullptr;
+  uint64_t m_switchEventIndex = 0;
+  // Last known switch states, one bit per switch.
+  uint64_t m_switches[4] = {0};
+  std::queue<PPUCSwitchState*> m_pendingSwitches;
+};
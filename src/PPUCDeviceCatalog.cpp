@@ -0,0 +1,101 @@
+#include "PPUCDeviceCatalog.h"
+
+#include <algorithm>
+#include <cstring>
+
+std::string_view PPUCStringArena::Intern(std::string_view string) {
+  auto it = m_strings.find(string);
+  if (it != m_strings.end()) {
+    return *it;
+  }
+
+  char* data;
+  if (string.size() > PPUC_STRING_ARENA_BLOCK_SIZE) {
+    // Oversized strings get a block of their own.
+    m_blocks.push_back(std::make_unique<char[]>(string.size()));
+    data = m_blocks.back().get();
+    m_used = PPUC_STRING_ARENA_BLOCK_SIZE;
+  } else {
+    if (m_blocks.empty() ||
+        m_used + string.size() > PPUC_STRING_ARENA_BLOCK_SIZE) {
+      m_blocks.push_back(
+          std::make_unique<char[]>(PPUC_STRING_ARENA_BLOCK_SIZE));
+      m_used = 0;
+    }
+    data = m_blocks.back().get() + m_used;
+    m_used += string.size();
+  }
+
+  memcpy(data, string.data(), string.size());
+  std::string_view interned(data, string.size());
+  m_strings.insert(interned);
+
+  return interned;
+}
+
+void PPUCStringArena::Clear() {
+  m_strings.clear();
+  m_blocks.clear();
+  m_used = PPUC_STRING_ARENA_BLOCK_SIZE;
+}
+
+void PPUCDeviceTable::Add(uint8_t board, uint8_t port, uint8_t type,
+                          uint8_t number, std::string_view description,
+                          uint32_t color) {
+  // Keep the table sorted by number, devices with the same number stay in the
+  // order they were added.
+  size_t index =
+      std::upper_bound(m_numbers.begin(), m_numbers.end(), number) -
+      m_numbers.begin();
+
+  m_boards.insert(m_boards.begin() + index, board);
+  m_ports.insert(m_ports.begin() + index, port);
+  m_types.insert(m_types.begin() + index, type);
+  m_numbers.insert(m_numbers.begin() + index, number);
+  m_colors.insert(m_colors.begin() + index, color);
+  m_descriptions.insert(m_descriptions.begin() + index, description);
+}
+
+void PPUCDeviceTable::Clear() {
+  m_boards.clear();
+  m_ports.clear();
+  m_types.clear();
+  m_numbers.clear();
+  m_colors.clear();
+  m_descriptions.clear();
+}
+
+ptrdiff_t PPUCDeviceTable::Find(uint8_t number) const {
+  auto it = std::lower_bound(m_numbers.begin(), m_numbers.end(), number);
+  if (it == m_numbers.end() || *it != number) {
+    return -1;
+  }
+
+  return it - m_numbers.begin();
+}
+
+void PPUCDeviceCatalog::AddCoil(uint8_t board, uint8_t port, uint8_t type,
+                                uint8_t number, std::string_view description) {
+  m_coils.Add(board, port, type, number, m_descriptions.Intern(description),
+              0);
+}
+
+void PPUCDeviceCatalog::AddLamp(uint8_t board, uint8_t port, uint8_t type,
+                                uint8_t number, std::string_view description,
+                                uint32_t color) {
+  m_lamps.Add(board, port, type, number, m_descriptions.Intern(description),
+              color);
+}
+
+void PPUCDeviceCatalog::AddSwitch(uint8_t board, uint8_t port, uint8_t number,
+                                  std::string_view description) {
+  m_switches.Add(board, port, 0, number, m_descriptions.Intern(description),
+                 0);
+}
+
+void PPUCDeviceCatalog::Clear() {
+  m_coils.Clear();
+  m_lamps.Clear();
+  m_switches.Clear();
+  m_descriptions.Clear();
+}
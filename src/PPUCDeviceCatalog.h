@@ -0,0 +1,140 @@
+#pragma once
+
+#ifndef PPUCAPI
+#ifdef _MSC_VER
+#define PPUCAPI __declspec(dllexport)
+#else
+#define PPUCAPI __attribute__((visibility("default")))
+#endif
+#endif
+
+#include <inttypes.h>
+
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+#define PPUC_STRING_ARENA_BLOCK_SIZE 4096
+
+// Stores every distinct string once in blocks that never move, so the views
+// returned by Intern() stay valid as long as the arena exists.
+class PPUCAPI PPUCStringArena {
+ public:
+  std::string_view Intern(std::string_view string);
+  void Clear();
+
+ private:
+  std::vector<std::unique_ptr<char[]>> m_blocks;
+  size_t m_used = PPUC_STRING_ARENA_BLOCK_SIZE;
+  std::unordered_set<std::string_view> m_strings;
+};
+
+// Devices of one kind in columns, sorted by number. Bulk filters can scan a
+// single column, for example GetBoards(), without touching the others.
+class PPUCAPI PPUCDeviceTable {
+ public:
+  // A single row of the table. Views don't own anything and stay valid as
+  // long as the catalog exists.
+  class View {
+   public:
+    View(const PPUCDeviceTable* table, size_t index)
+        : m_table(table), m_index(index) {}
+
+    uint8_t GetBoard() const { return m_table->m_boards[m_index]; }
+    uint8_t GetPort() const { return m_table->m_ports[m_index]; }
+    uint8_t GetType() const { return m_table->m_types[m_index]; }
+    uint8_t GetNumber() const { return m_table->m_numbers[m_index]; }
+    uint32_t GetColor() const { return m_table->m_colors[m_index]; }
+    std::string_view GetDescription() const {
+      return m_table->m_descriptions[m_index];
+    }
+
+   private:
+    const PPUCDeviceTable* m_table;
+    size_t m_index;
+  };
+
+  class Iterator {
+   public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = View;
+    using difference_type = std::ptrdiff_t;
+    using pointer = void;
+    using reference = View;
+
+    Iterator(const PPUCDeviceTable* table, size_t index)
+        : m_table(table), m_index(index) {}
+
+    View operator*() const { return View(m_table, m_index); }
+    Iterator& operator++() {
+      m_index++;
+      return *this;
+    }
+    Iterator operator++(int) {
+      Iterator it = *this;
+      m_index++;
+      return it;
+    }
+    bool operator==(const Iterator& other) const {
+      return m_index == other.m_index;
+    }
+    bool operator!=(const Iterator& other) const {
+      return m_index != other.m_index;
+    }
+
+   private:
+    const PPUCDeviceTable* m_table;
+    size_t m_index;
+  };
+
+  void Add(uint8_t board, uint8_t port, uint8_t type, uint8_t number,
+           std::string_view description, uint32_t color);
+  void Clear();
+
+  size_t GetSize() const { return m_numbers.size(); }
+  View operator[](size_t index) const { return View(this, index); }
+  Iterator begin() const { return Iterator(this, 0); }
+  Iterator end() const { return Iterator(this, m_numbers.size()); }
+  // Returns the index of the first device with the given number or -1.
+  ptrdiff_t Find(uint8_t number) const;
+
+  const std::vector<uint8_t>& GetBoards() const { return m_boards; }
+  const std::vector<uint8_t>& GetPorts() const { return m_ports; }
+  const std::vector<uint8_t>& GetTypes() const { return m_types; }
+  const std::vector<uint8_t>& GetNumbers() const { return m_numbers; }
+  const std::vector<uint32_t>& GetColors() const { return m_colors; }
+
+ private:
+  std::vector<uint8_t> m_boards;
+  std::vector<uint8_t> m_ports;
+  std::vector<uint8_t> m_types;
+  std::vector<uint8_t> m_numbers;
+  std::vector<uint32_t> m_colors;
+  std::vector<std::string_view> m_descriptions;
+};
+
+// Coils, lamps and switches of the loaded configuration. The descriptions of
+// all tables are interned into a single arena.
+class PPUCAPI PPUCDeviceCatalog {
+ public:
+  void AddCoil(uint8_t board, uint8_t port, uint8_t type, uint8_t number,
+               std::string_view description);
+  void AddLamp(uint8_t board, uint8_t port, uint8_t type, uint8_t number,
+               std::string_view description, uint32_t color);
+  void AddSwitch(uint8_t board, uint8_t port, uint8_t number,
+                 std::string_view description);
+  void Clear();
+
+  const PPUCDeviceTable& GetCoils() const { return m_coils; }
+  const PPUCDeviceTable& GetLamps() const { return m_lamps; }
+  const PPUCDeviceTable& GetSwitches() const { return m_switches; }
+
+ private:
+  PPUCStringArena m_descriptions;
+  PPUCDeviceTable m_coils;
+  PPUCDeviceTable m_lamps;
+  PPUCDeviceTable m_switches;
+};
@@ -0,0 +1,75 @@
+#pragma once
+
+// Layout of the shared memory region the process owning the RS485 buses
+// publishes the switch states through and receives solenoid and lamp commands
+// from other processes. Everything in here has to be address free, so only
+// lock-free atomics and plain data are allowed.
+
+#include <inttypes.h>
+
+#include <atomic>
+
+#define PPUC_SHARED_STATE_MAGIC 0x50505543  // "PPUC"
+#define PPUC_SHARED_STATE_VERSION 2
+
+// Switch numbers are 8 bit in the configuration.
+#define PPUC_SHARED_STATE_SWITCH_WORDS 4
+#define PPUC_SHARED_STATE_SWITCH_EVENTS 1024
+#define PPUC_SHARED_STATE_CLIENTS 8
+#define PPUC_SHARED_STATE_COMMANDS 1024
+
+#define PPUC_COMMAND_SOLENOID 1
+#define PPUC_COMMAND_LAMP 2
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free &&
+                  std::atomic<uint64_t>::is_always_lock_free,
+              "shared memory requires lock-free atomics");
+
+// Single producer, single consumer ring for the commands of one client
+// process.
+struct alignas(64) PPUCCommandRing {
+  // Process ID of the client using this ring, 0 if unused.
+  std::atomic<uint32_t> owner;
+  // Incremented by every client that claims the ring, after storing the head
+  // its commands start at in start. The daemon drops the commands before
+  // start once it sees a new generation, so a client never has to move head
+  // backwards.
+  std::atomic<uint32_t> generation;
+  std::atomic<uint32_t> start;
+  // Written by the client only.
+  alignas(64) std::atomic<uint32_t> head;
+  // Written by the daemon only, like the generation it processes commands
+  // of.
+  alignas(64) std::atomic<uint32_t> tail;
+  uint32_t processedGeneration;
+  uint32_t commands[PPUC_SHARED_STATE_COMMANDS];
+};
+
+struct PPUCSharedState {
+  // Written last by the daemon when the region is ready.
+  std::atomic<uint32_t> magic;
+  uint32_t version;
+  // Incremented by the daemon while it is running.
+  std::atomic<uint32_t> heartbeat;
+
+  // Seqlock protecting the switch bitmap, odd while it gets updated.
+  alignas(64) std::atomic<uint32_t> switchSequence;
+  std::atomic<uint64_t> switches[PPUC_SHARED_STATE_SWITCH_WORDS];
+
+  // Broadcast ring of switch changes. Every entry contains the lower 32 bits
+  // of its index, so readers detect entries that got overwritten already.
+  alignas(64) std::atomic<uint64_t> switchEventIndex;
+  std::atomic<uint64_t> switchEvents[PPUC_SHARED_STATE_SWITCH_EVENTS];
+
+  PPUCCommandRing rings[PPUC_SHARED_STATE_CLIENTS];
+};
+
+inline uint32_t PPUCEncodeCommand(uint8_t type, uint16_t number,
+                                  uint8_t state) {
+  return ((uint32_t)type << 24) | ((uint32_t)number << 8) | state;
+}
+
+inline uint64_t PPUCEncodeSwitchEvent(uint64_t index, uint8_t number,
+                                      uint8_t state) {
+  return ((index & 0xffffffff) << 32) | ((uint64_t)number << 8) | state;
+}
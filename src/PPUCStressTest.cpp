@@ -0,0 +1,163 @@
+#include "PPUCStressTest.h"
+
+#include <chrono>
+#include <thread>
+
+#include "PPUC.h"
+#include "RS485Comm.h"
+#include "io-boards/Event.h"
+
+PPUCStressTest::PPUCStressTest(PPUC* pPPUC) { m_pPPUC = pPPUC; }
+
+void PPUCStressTest::SetCallback(PPUC_StressCallback callback,
+                                 const void* userData) {
+  m_callback = callback;
+  m_callbackUserData = userData;
+}
+
+std::vector<PPUCStressResult> PPUCStressTest::Run(
+    const PPUCStressConfig& config) {
+  std::vector<PPUCStressResult> results;
+  m_cancelled = false;
+  m_traffic = 0;
+  m_lampStates.assign(config.lamps.size(), 0);
+
+  // Blocking on full queues would throttle the test to what the bus takes.
+  uint8_t queuePolicy = m_pPPUC->m_queuePolicy;
+  m_pPPUC->SetQueuePolicy(PPUC_QUEUE_POLICY_DROP);
+
+  for (uint32_t rate = config.startRate; rate <= config.maxRate && rate > 0;
+       rate += config.rateStep) {
+    PPUCStressResult result = RunStep(config, rate);
+    if (m_cancelled) {
+      break;
+    }
+
+    results.push_back(result);
+    if (m_callback) {
+      (*(m_callback))(&result, m_callbackUserData);
+    }
+
+    if ((config.stopWhenSaturated &&
+         result.framesPerSecond * 10ull < rate * 9ull) ||
+        config.rateStep == 0) {
+      break;
+    }
+  }
+
+  for (uint8_t lamp : config.lamps) {
+    m_pPPUC->SetLampState(lamp, 0);
+  }
+  m_pPPUC->SetQueuePolicy(queuePolicy);
+
+  return results;
+}
+
+void PPUCStressTest::Cancel() { m_cancelled = true; }
+
+PPUCStressResult PPUCStressTest::RunStep(const PPUCStressConfig& config,
+                                         uint32_t rate) {
+  PPUCStressResult result;
+  result.rate = rate;
+
+  std::vector<PPUCBusStatistics> statistics;
+  std::vector<uint64_t> sent;
+  m_pPPUC->m_busesMutex.lock_shared();
+  for (RS485Comm* bus : m_pPPUC->m_buses) {
+    statistics.push_back(bus->GetStatistics());
+    sent.push_back(bus->GetSentPosition());
+    bus->ResetPollLatencies();
+  }
+  m_pPPUC->m_busesMutex.unlock_shared();
+
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  std::chrono::steady_clock::time_point end =
+      start + std::chrono::milliseconds(config.stepDuration);
+  std::chrono::steady_clock::time_point now = start;
+  uint64_t events = 0;
+  while (now < end && !m_cancelled) {
+    uint64_t due =
+        rate *
+        (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+            now - start)
+            .count() /
+        1000000;
+    for (; events < due; events++) {
+      if (m_pPPUC->QueueEvent(NextEvent(config)) == PPUC_QUEUE_OK) {
+        result.queued++;
+      } else {
+        result.dropped++;
+      }
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    now = std::chrono::steady_clock::now();
+  }
+
+  uint64_t elapsed =
+      std::chrono::duration_cast<std::chrono::microseconds>(now - start)
+          .count();
+  uint64_t frames = 0;
+  std::shared_lock<std::shared_mutex> lock(m_pPPUC->m_busesMutex);
+  if (m_pPPUC->m_buses.size() != statistics.size()) {
+    // The buses got replaced during the step.
+    return result;
+  }
+  for (size_t i = 0; i < m_pPPUC->m_buses.size(); i++) {
+    RS485Comm* bus = m_pPPUC->m_buses[i];
+    PPUCBusStatistics after = bus->GetStatistics();
+    frames += bus->GetSentPosition() - sent[i];
+    result.timeouts += after.timeouts - statistics[i].timeouts;
+    result.resyncs += after.resyncs - statistics[i].resyncs;
+    result.crcErrors += after.crcErrors - statistics[i].crcErrors;
+
+    for (uint8_t board = 0; board < RS485_COMM_MAX_BOARDS; board++) {
+      LatencyHistogram* pollLatency = bus->GetPollLatency(board);
+      if (!bus->IsBoardActive(board) && pollLatency->GetCount() == 0) {
+        continue;
+      }
+
+      PPUCStressBoardResult boardResult;
+      boardResult.board = board;
+      boardResult.polls = pollLatency->GetCount();
+      boardResult.latencyP50 = pollLatency->GetPercentile(50);
+      boardResult.latencyP95 = pollLatency->GetPercentile(95);
+      boardResult.latencyP99 = pollLatency->GetPercentile(99);
+      boardResult.latencyMax = pollLatency->GetMax();
+      result.boards.push_back(boardResult);
+    }
+  }
+  result.framesPerSecond =
+      elapsed > 0 ? (uint32_t)(frames * 1000000 / elapsed) : 0;
+
+  return result;
+}
+
+// Cycles through the enabled kinds of traffic.
+Event* PPUCStressTest::NextEvent(const PPUCStressConfig& config) {
+  uint8_t traffic = config.traffic;
+  if (config.lamps.empty()) {
+    traffic &= ~PPUC_STRESS_TRAFFIC_LAMPS;
+  }
+  if (traffic == 0) {
+    traffic = PPUC_STRESS_TRAFFIC_NULL;
+  }
+
+  uint8_t kind;
+  do {
+    kind = 1 << (m_traffic++ % 3);
+  } while (!(traffic & kind));
+
+  if (kind == PPUC_STRESS_TRAFFIC_PING) {
+    return new Event(EVENT_PING);
+  }
+  if (kind == PPUC_STRESS_TRAFFIC_LAMPS) {
+    size_t lamp = (m_traffic / 3) % config.lamps.size();
+    m_lampStates[lamp] ^= 1;
+    return new Event(EVENT_SOURCE_LIGHT, config.lamps[lamp],
+                     m_lampStates[lamp]);
+  }
+
+  return new Event(EVENT_NULL);
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <inttypes.h>
+
+#include <atomic>
+#include <vector>
+
+#include "PPUC_structs.h"
+
+class PPUC;
+struct Event;
+
+// Floods the buses with harmless traffic at increasing rates while the
+// switch boards get polled as usual, to find out how much traffic the wiring
+// of a machine sustains.
+class PPUCStressTest {
+ public:
+  PPUCStressTest(PPUC* pPPUC);
+
+  void SetCallback(PPUC_StressCallback callback, const void* userData);
+
+  // Blocks until all steps are done or the test got cancelled.
+  std::vector<PPUCStressResult> Run(const PPUCStressConfig& config);
+  void Cancel();
+
+ private:
+  PPUCStressResult RunStep(const PPUCStressConfig& config, uint32_t rate);
+  Event* NextEvent(const PPUCStressConfig& config);
+
+  PPUC* m_pPPUC;
+  PPUC_StressCallback m_callback = nullptr;
+  const void* m_callbackUserData = nullptr;
+
+  std::atomic<bool> m_cancelled = false;
+  uint32_t m_traffic = 0;
+  std::vector<uint8_t> m_lampStates;
+};
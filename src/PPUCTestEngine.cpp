@@ -0,0 +1,332 @@
+#include "PPUCTestEngine.h"
+
+#include <chrono>
+
+#include "PPUC.h"
+#include "io-boards/Event.h"
+#include "io-boards/PPUCPlatforms.h"
+
+PPUCTestEngine::PPUCTestEngine(PPUC* pPPUC) { m_pPPUC = pPPUC; }
+
+PPUCTestEngine::~PPUCTestEngine() {
+  Cancel();
+  Wait();
+}
+
+void PPUCTestEngine::SetCallback(PPUC_TestCallback callback,
+                                 const void* userData) {
+  m_callback = callback;
+  m_callbackUserData = userData;
+}
+
+bool PPUCTestEngine::Start(const PPUCTestPlan& plan) {
+  if (m_running) {
+    return false;
+  }
+  Wait();
+
+  m_boards.clear();
+  m_results.clear();
+  m_cancelled = false;
+  BuildOutputTests(plan);
+
+  m_running = true;
+  m_pThread = new std::thread([this, plan]() {
+    RunOutputTests();
+    if (plan.devices & PPUC_TEST_SWITCHES) {
+      RunSwitchTest(plan);
+    }
+    m_running = false;
+  });
+
+  return true;
+}
+
+void PPUCTestEngine::Cancel() {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_cancelled = true;
+  m_cancel.notify_all();
+}
+
+bool PPUCTestEngine::IsRunning() { return m_running; }
+
+std::vector<PPUCTestResult> PPUCTestEngine::Wait() {
+  if (m_pThread) {
+    m_pThread->join();
+
+    delete m_pThread;
+    m_pThread = NULL;
+  }
+
+  return m_results;
+}
+
+void PPUCTestEngine::AddDevice(uint8_t devices, uint8_t board, uint8_t port,
+                               uint8_t number, const std::string& description,
+                               bool solenoid, bool gi, uint32_t onTime,
+                               uint32_t offTime, uint8_t pulses) {
+  TestDevice device;
+  device.result.devices = devices;
+  device.result.board = board;
+  device.result.port = port;
+  device.result.number = number;
+  device.result.description = description;
+  device.solenoid = solenoid;
+  device.gi = gi;
+  device.onTime = onTime;
+  device.offTime = offTime;
+  device.pulses = pulses;
+
+  m_boards[board].push_back(device);
+}
+
+void PPUCTestEngine::AddDevice(uint8_t devices,
+                               const PPUCDeviceTable::View& device,
+                               bool solenoid, uint32_t onTime,
+                               uint32_t offTime, uint8_t pulses) {
+  AddDevice(devices, device.GetBoard(), device.GetPort(), device.GetNumber(),
+            std::string(device.GetDescription()), solenoid, false, onTime,
+            offTime, pulses);
+}
+
+void PPUCTestEngine::BuildOutputTests(const PPUCTestPlan& plan) {
+  uint32_t coilOnTime = plan.onTime ? plan.onTime : PPUC_TEST_COIL_ON_TIME;
+  uint32_t coilOffTime = plan.offTime ? plan.offTime : PPUC_TEST_COIL_OFF_TIME;
+  uint32_t lampOnTime = plan.onTime ? plan.onTime : PPUC_TEST_LAMP_ON_TIME;
+  uint32_t lampOffTime = plan.offTime ? plan.offTime : PPUC_TEST_LAMP_OFF_TIME;
+  std::shared_ptr<const PPUCDeviceCatalog> devices =
+      m_pPPUC->GetDeviceCatalog();
+
+  for (const auto& coil : devices->GetCoils()) {
+    if (plan.number != 0 && coil.GetNumber() != plan.number) {
+      continue;
+    }
+
+    if ((plan.devices & PPUC_TEST_COILS) &&
+        (coil.GetType() == PWM_TYPE_SOLENOID ||
+         coil.GetType() == PWM_TYPE_FLASHER)) {
+      AddDevice(PPUC_TEST_COILS, coil, true, coilOnTime, coilOffTime, 1);
+    }
+    if ((plan.devices & PPUC_TEST_FLASHERS) &&
+        coil.GetType() == PWM_TYPE_FLASHER) {
+      AddDevice(PPUC_TEST_FLASHERS, coil, true, coilOnTime, coilOffTime,
+                PPUC_TEST_FLASHER_PULSES);
+    }
+    if ((plan.devices & PPUC_TEST_LAMPS) && coil.GetType() == PWM_TYPE_LAMP) {
+      AddDevice(PPUC_TEST_LAMPS, coil, true, lampOnTime, lampOffTime, 1);
+    }
+  }
+
+  for (const auto& lamp : devices->GetLamps()) {
+    if (plan.number != 0 && lamp.GetNumber() != plan.number) {
+      continue;
+    }
+
+    if ((plan.devices & PPUC_TEST_LAMPS) && lamp.GetType() == LED_TYPE_LAMP) {
+      AddDevice(PPUC_TEST_LAMPS, lamp, false, lampOnTime, lampOffTime, 1);
+    }
+    // LED flashers are driven like solenoids.
+    if ((plan.devices & PPUC_TEST_FLASHERS) &&
+        lamp.GetType() == LED_TYPE_FLASHER) {
+      AddDevice(PPUC_TEST_FLASHERS, lamp, true, coilOnTime, coilOffTime,
+                PPUC_TEST_FLASHER_PULSES);
+    }
+  }
+
+  if (plan.devices & PPUC_TEST_GI) {
+    for (uint8_t i = 1; i <= 8; i++) {
+      if (PLATFORM_WPC != m_pPPUC->m_platform && i > 1) {
+        break;
+      }
+      if (plan.number != 0 && plan.number != i) {
+        continue;
+      }
+
+      AddDevice(PPUC_TEST_GI, PPUC_TEST_NO_BOARD, 0, i, "GI String", false,
+                true, plan.onTime ? plan.onTime : PPUC_TEST_GI_ON_TIME,
+                plan.offTime ? plan.offTime : PPUC_TEST_GI_OFF_TIME, 1);
+    }
+  }
+}
+
+void PPUCTestEngine::Fire(const TestDevice& device) {
+  if (device.gi) {
+    m_pPPUC->QueueEvent(new Event(EVENT_SOURCE_GI, device.result.number,
+                                  /* full brightness */ 8));
+    m_pPPUC->QueueEvent(new Event(EVENT_SOURCE_GI, device.result.number, 0),
+                        device.onTime);
+  } else if (device.solenoid) {
+    m_pPPUC->PulseSolenoid(device.result.number, device.onTime);
+  } else {
+    m_pPPUC->SetLampState(device.result.number, 1);
+    m_pPPUC->ScheduleLampState(device.result.number, 0, device.onTime);
+  }
+}
+
+void PPUCTestEngine::TurnOff(const TestDevice& device) {
+  if (device.gi) {
+    m_pPPUC->QueueEvent(new Event(EVENT_SOURCE_GI, device.result.number, 0));
+  } else if (device.solenoid) {
+    m_pPPUC->SetSolenoidState(device.result.number, 0);
+  } else {
+    m_pPPUC->SetLampState(device.result.number, 0);
+  }
+}
+
+void PPUCTestEngine::RunOutputTests() {
+  size_t round = 0;
+  bool cancelled = false;
+  while (!cancelled) {
+    // Take the next device of every board.
+    std::vector<TestDevice*> devices;
+    uint8_t pulses = 0;
+    for (auto& board : m_boards) {
+      if (round >= board.second.size()) {
+        continue;
+      }
+
+      TestDevice* device = &board.second[round];
+      Report(device->result);
+      if (board.first != PPUC_TEST_NO_BOARD &&
+          !m_pPPUC->IsBoardActive(board.first)) {
+        Finish(device->result, PPUC_TEST_RESULT_FAILED);
+        continue;
+      }
+
+      devices.push_back(device);
+      if (device->pulses > pulses) {
+        pulses = device->pulses;
+      }
+    }
+
+    bool done = true;
+    for (auto& board : m_boards) {
+      done &= round >= board.second.size();
+    }
+    if (done) {
+      break;
+    }
+
+    for (uint8_t pulse = 0; pulse < pulses && !cancelled; pulse++) {
+      uint32_t duration = 0;
+      for (TestDevice* device : devices) {
+        if (pulse < device->pulses) {
+          Fire(*device);
+          if (device->onTime + device->offTime > duration) {
+            duration = device->onTime + device->offTime;
+          }
+        }
+      }
+      cancelled = !Sleep(duration);
+    }
+
+    for (TestDevice* device : devices) {
+      if (cancelled) {
+        TurnOff(*device);
+        Finish(device->result, PPUC_TEST_RESULT_CANCELLED);
+      } else {
+        Finish(device->result, PPUC_TEST_RESULT_PASSED);
+      }
+    }
+
+    round++;
+  }
+
+  if (cancelled) {
+    for (auto& board : m_boards) {
+      for (size_t i = round; i < board.second.size(); i++) {
+        Finish(board.second[i].result, PPUC_TEST_RESULT_CANCELLED);
+      }
+    }
+  }
+}
+
+// Reports every switch change until all switches changed at least once, the
+// timeout passed or the test got cancelled. Switches that never changed are
+// failed.
+void PPUCTestEngine::RunSwitchTest(const PPUCTestPlan& plan) {
+  std::map<uint8_t, PPUCTestResult> switches;
+  std::shared_ptr<const PPUCDeviceCatalog> devices =
+      m_pPPUC->GetDeviceCatalog();
+  for (const auto& vswitch : devices->GetSwitches()) {
+    if (plan.number != 0 && vswitch.GetNumber() != plan.number) {
+      continue;
+    }
+
+    PPUCTestResult& result = switches[vswitch.GetNumber()];
+    result.devices = PPUC_TEST_SWITCHES;
+    result.board = vswitch.GetBoard();
+    result.port = vswitch.GetPort();
+    result.number = vswitch.GetNumber();
+    result.description = std::string(vswitch.GetDescription());
+    if (!m_pPPUC->IsBoardActive(vswitch.GetBoard())) {
+      Finish(result, PPUC_TEST_RESULT_FAILED);
+    }
+  }
+
+  size_t remaining = 0;
+  for (const auto& it : switches) {
+    remaining += it.second.result == PPUC_TEST_RESULT_RUNNING;
+  }
+
+  std::chrono::steady_clock::time_point deadline =
+      std::chrono::steady_clock::now() +
+      std::chrono::milliseconds(plan.switchTimeout);
+  bool cancelled = false;
+  while ((remaining > 0 || plan.switchTimeout == 0) && !cancelled &&
+         (plan.switchTimeout == 0 ||
+          std::chrono::steady_clock::now() < deadline)) {
+    PPUCSwitchState* switchState = m_pPPUC->GetNextSwitchState();
+    if (!switchState) {
+      cancelled = !Sleep(10);
+      continue;
+    }
+
+    auto it = switches.find((uint8_t)switchState->number);
+    if (it != switches.end()) {
+      it->second.state = switchState->state;
+      if (it->second.result == PPUC_TEST_RESULT_RUNNING) {
+        Finish(it->second, PPUC_TEST_RESULT_PASSED);
+        remaining--;
+      } else {
+        Report(it->second);
+      }
+    } else {
+      // Report switches missing in the configuration as well.
+      PPUCTestResult result;
+      result.devices = PPUC_TEST_SWITCHES;
+      result.board = PPUC_TEST_NO_BOARD;
+      result.port = 0;
+      result.number = (uint8_t)switchState->number;
+      result.result = PPUC_TEST_RESULT_PASSED;
+      result.state = switchState->state;
+      Report(result);
+    }
+    delete switchState;
+  }
+
+  for (auto& it : switches) {
+    if (it.second.result == PPUC_TEST_RESULT_RUNNING) {
+      Finish(it.second, cancelled ? PPUC_TEST_RESULT_CANCELLED
+                                  : PPUC_TEST_RESULT_FAILED);
+    }
+  }
+}
+
+void PPUCTestEngine::Finish(PPUCTestResult& result, uint8_t state) {
+  result.result = state;
+  m_results.push_back(result);
+  Report(result);
+}
+
+void PPUCTestEngine::Report(const PPUCTestResult& result) {
+  if (m_callback) {
+    (*(m_callback))(&result, m_callbackUserData);
+  }
+}
+
+bool PPUCTestEngine::Sleep(uint32_t ms) {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  return !m_cancel.wait_for(lock, std::chrono::milliseconds(ms),
+                            [this]() { return m_cancelled; });
+}
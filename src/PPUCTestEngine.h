@@ -0,0 +1,83 @@
+#pragma once
+
+#include <inttypes.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "PPUCDeviceCatalog.h"
+#include "PPUC_structs.h"
+
+// Default on and off times in ms per device group.
+#define PPUC_TEST_COIL_ON_TIME 200
+#define PPUC_TEST_COIL_OFF_TIME 1000
+#define PPUC_TEST_FLASHER_PULSES 3
+#define PPUC_TEST_LAMP_ON_TIME 2000
+#define PPUC_TEST_LAMP_OFF_TIME 1000
+#define PPUC_TEST_GI_ON_TIME 5000
+#define PPUC_TEST_GI_OFF_TIME 1000
+// Board number used for the GI strings, which aren't assigned to a board.
+#define PPUC_TEST_NO_BOARD 0xFF
+
+class PPUC;
+
+// Runs hardware tests in the background. Devices of different boards are
+// tested in parallel, one device per board at a time.
+class PPUCTestEngine {
+ public:
+  PPUCTestEngine(PPUC* pPPUC);
+  ~PPUCTestEngine();
+
+  void SetCallback(PPUC_TestCallback callback, const void* userData);
+
+  bool Start(const PPUCTestPlan& plan);
+  void Cancel();
+  bool IsRunning();
+  // Blocks until the test finished and returns the results of all devices.
+  std::vector<PPUCTestResult> Wait();
+
+ private:
+  struct TestDevice {
+    PPUCTestResult result;
+    bool solenoid;
+    bool gi;
+    uint32_t onTime;
+    uint32_t offTime;
+    uint8_t pulses;
+  };
+
+  void BuildOutputTests(const PPUCTestPlan& plan);
+  void AddDevice(uint8_t devices, uint8_t board, uint8_t port, uint8_t number,
+                 const std::string& description, bool solenoid, bool gi,
+                 uint32_t onTime, uint32_t offTime, uint8_t pulses);
+  void AddDevice(uint8_t devices, const PPUCDeviceTable::View& device,
+                 bool solenoid, uint32_t onTime, uint32_t offTime,
+                 uint8_t pulses);
+  void RunOutputTests();
+  void RunSwitchTest(const PPUCTestPlan& plan);
+  void Fire(const TestDevice& device);
+  void TurnOff(const TestDevice& device);
+  void Finish(PPUCTestResult& result, uint8_t state);
+  void Report(const PPUCTestResult& result);
+  // Waits for the given time or until the test gets cancelled. Returns false
+  // if cancelled.
+  bool Sleep(uint32_t ms);
+
+  PPUC* m_pPPUC;
+  PPUC_TestCallback m_callback = nullptr;
+  const void* m_callbackUserData = nullptr;
+
+  // Devices to test per board, in test order.
+  std::map<uint8_t, std::vector<TestDevice>> m_boards;
+  std::vector<PPUCTestResult> m_results;
+
+  std::thread* m_pThread = nullptr;
+  std::atomic<bool> m_running = false;
+  bool m_cancelled = false;
+  std::mutex m_mutex;
+  std::condition_variable m_cancel;
+};
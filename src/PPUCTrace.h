@@ -0,0 +1,45 @@
+#pragma once
+
+// Statically defined tracepoints (USDT) of the provider "ppuc" on the serial
+// hot path. They compile to a nop and cost nothing until a tracer attaches,
+// for example:
+//
+//   bpftrace -e 'usdt:./libppuc.so:ppuc:write_end { @[arg1] = count(); }'
+//
+// Probes:
+//   event_enqueue(source, event, value)  event_dequeue(count)
+//   frame_enqueue(count)                 write_start(bytes)
+//   write_end(bytes, written)            poll_send(board)
+//   rx_start()                           frame_decoded(source, event, value)
+//   resync()                             timeout()
+//   switch_bank(board, first, changes)
+//
+// They are only available on Linux with sys/sdt.h (systemtap-sdt-dev) and
+// can be disabled by building with -DENABLE_TRACE=OFF.
+
+#if !defined(PPUC_NO_TRACE) && defined(__linux__) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define PPUC_TRACE_ENABLED 1
+#endif
+#endif
+
+#ifdef PPUC_TRACE_ENABLED
+#define PPUC_TRACE0(name) DTRACE_PROBE(ppuc, name)
+#define PPUC_TRACE1(name, a) DTRACE_PROBE1(ppuc, name, a)
+#define PPUC_TRACE2(name, a, b) DTRACE_PROBE2(ppuc, name, a, b)
+#define PPUC_TRACE3(name, a, b, c) DTRACE_PROBE3(ppuc, name, a, b, c)
+#else
+#define PPUC_TRACE0(name) \
+  do {                    \
+  } while (0)
+#define PPUC_TRACE1(name, a) \
+  do {                       \
+  } while (0)
+#define PPUC_TRACE2(name, a, b) \
+  do {                          \
+  } while (0)
+#define PPUC_TRACE3(name, a, b, c) \
+  do {                             \
+  } while (0)
+#endif
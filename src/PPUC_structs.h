@@ -8,10 +8,272 @@
 
 #include <inttypes.h>
 #include <string>
+#include <vector>
 
 typedef void(CALLBACK* PPUC_LogMessageCallback)(const char* format,
                                                 va_list args,
                                                 const void* userData);
+typedef void(CALLBACK* PPUC_SwitchCallback)(int number, int state,
+                                            const void* userData);
+// Hands a suspended coroutine over to an executor of the host, which resumes
+// it using std::coroutine_handle<>::from_address(coroutine).resume().
+typedef void(CALLBACK* PPUC_ResumeCallback)(void* coroutine,
+                                            const void* userData);
+
+// A board that stopped responding to polls is left out of the poll rotation
+// and only probed once in a while until it responds again.
+#define PPUC_BOARD_STATE_ACTIVE 0
+#define PPUC_BOARD_STATE_UNRESPONSIVE 1
+
+typedef void(CALLBACK* PPUC_BoardStateCallback)(int board, int state,
+                                                const void* userData);
+
+// Events reported by the boards beside switch changes.
+#define PPUC_BOARD_EVENT_FAULT 0
+#define PPUC_BOARD_EVENT_TELEMETRY 1
+// Events the library doesn't know, passed through undecoded.
+#define PPUC_BOARD_EVENT_UNKNOWN 2
+
+// Fault codes of solenoids. Every code except PPUC_FAULT_CLEARED blocks all
+// further commands to the solenoid until the board clears the fault or the
+// host releases it.
+#define PPUC_FAULT_CLEARED 0
+#define PPUC_FAULT_BROKEN_COIL 1
+#define PPUC_FAULT_OVERHEATED 2
+#define PPUC_FAULT_OVERCURRENT 3
+
+// Telemetry channels and the unit of their readings.
+#define PPUC_TELEMETRY_TEMPERATURE 1  // 0.1 degrees Celsius
+#define PPUC_TELEMETRY_VOLTAGE 2      // mV
+#define PPUC_TELEMETRY_CURRENT 3      // mA
+
+struct PPUCBoardEvent {
+  uint8_t type = PPUC_BOARD_EVENT_UNKNOWN;
+  uint8_t board = 0;
+  // PPUC_FAULT_*, PPUC_TELEMETRY_* or the source ID of an unknown event.
+  uint8_t code = 0;
+  // Solenoid of a fault or event ID of an unknown event.
+  uint16_t number = 0;
+  // Reading of a telemetry channel or value of an unknown event.
+  uint16_t value = 0;
+};
+
+typedef void(CALLBACK* PPUC_BoardEventCallback)(const PPUCBoardEvent* event,
+                                                const void* userData);
+
+// Pulses a solenoid from the serial thread as soon as a switch reaches the
+// given state, without the round trip through the host. Useful for
+// slingshots, pop bumpers and kickers.
+struct PPUCSwitchRule {
+  uint8_t switchNumber = 0;
+  uint8_t switchState = 1;
+  uint8_t solenoid = 0;
+  // Pulse duration in ms.
+  uint32_t duration = 0;
+  // Minimum time in ms between two pulses, against switch chatter.
+  uint32_t recycle = 0;
+};
+
+// Called by the serial thread after a rule fired, so the host can account
+// for the pulse.
+typedef void(CALLBACK* PPUC_SwitchRuleCallback)(const PPUCSwitchRule* rule,
+                                                const void* userData);
+
+// Opening the serial ports, resetting and discovering the boards.
+#define PPUC_CONNECT_PHASE_BUSES 0
+#define PPUC_CONNECT_PHASE_UPLOAD 1
+// Waiting for the boards to apply the configuration.
+#define PPUC_CONNECT_PHASE_SETTLE 2
+#define PPUC_CONNECT_PHASE_DONE 3
+#define PPUC_CONNECT_PHASE_FAILED 4
+
+struct PPUCConnectProgress {
+  uint8_t phase = PPUC_CONNECT_PHASE_BUSES;
+  uint32_t configEventsSent = 0;
+  uint8_t boardsFound = 0;
+};
+
+typedef void(CALLBACK* PPUC_ConnectProgressCallback)(
+    const PPUCConnectProgress* progress, const void* userData);
+
+#define PPUC_THREAD_POLICY_DEFAULT 0
+#define PPUC_THREAD_POLICY_FIFO 1
+#define PPUC_THREAD_POLICY_RR 2
+
+// Result flags of applying a PPUCThreadConfig to the serial thread.
+#define PPUC_THREAD_CONFIG_OK 0
+#define PPUC_THREAD_CONFIG_POLICY_FAILED 1
+#define PPUC_THREAD_CONFIG_AFFINITY_FAILED 2
+#define PPUC_THREAD_CONFIG_NAME_FAILED 4
+#define PPUC_THREAD_CONFIG_TIMER_SLACK_FAILED 8
+
+struct PPUCThreadConfig {
+  uint8_t policy = PPUC_THREAD_POLICY_DEFAULT;
+  // Real-time priority, only used for PPUC_THREAD_POLICY_FIFO and
+  // PPUC_THREAD_POLICY_RR.
+  int priority = 0;
+  // CPUs the serial thread is allowed to run on, empty means no restriction.
+  std::vector<int> affinity;
+  std::string name = "ppuc-rs485";
+  // Timer slack in ns of the serial thread, 0 keeps the default. Only
+  // supported on Linux.
+  uint32_t timerSlack = 0;
+};
+
+#define PPUC_TRANSPORT_LIBSERIALPORT 0
+// Native termios and epoll based transport, only available on Linux.
+#define PPUC_TRANSPORT_NATIVE 1
+
+// Result of queueing a solenoid or lamp update.
+#define PPUC_QUEUE_OK 0
+// The event got dropped because the event queue of a bus is full.
+#define PPUC_QUEUE_FULL 1
+// Not connected (yet), the event got dropped.
+#define PPUC_QUEUE_NOT_CONNECTED 2
+
+// What happens if the event queue of a bus is full. PPUC_QUEUE_POLICY_BLOCK
+// waits a bit for the serial thread before the event gets dropped.
+#define PPUC_QUEUE_POLICY_BLOCK 0
+#define PPUC_QUEUE_POLICY_DROP 1
+
+struct PPUCSerialPort {
+  std::string device;
+  // Boards connected to this serial port. Empty means all boards.
+  std::vector<uint8_t> boards;
+  PPUCThreadConfig threadConfig;
+  int baudRate = 115200;
+  // Highest baud rate to negotiate with the boards after discovery, 0 turns
+  // the negotiation off.
+  int maxBaudRate = 0;
+  uint8_t transport = PPUC_TRANSPORT_LIBSERIALPORT;
+  // Use frames with checksums if all boards of the bus support them.
+  bool crc = false;
+  // Percentage of the bus airtime reserved for switch polling.
+  uint8_t pollShare = 50;
+};
+
+struct PPUCBusStatistics {
+  uint32_t timeouts = 0;
+  uint32_t resyncs = 0;
+  uint32_t crcErrors = 0;
+  uint32_t retransmits = 0;
+  uint32_t reconnects = 0;
+  // Events dropped because the event queue was full.
+  uint32_t droppedEvents = 0;
+  // Switch board polls, to determine the poll frequency.
+  uint32_t polls = 0;
+  // Switch edges dropped by the debounce and chatter filter.
+  uint32_t filteredSwitchEdges = 0;
+  // Times a switch exceeded its configured edge rate.
+  uint32_t flaggedSwitches = 0;
+  // Boards currently out of the poll rotation.
+  uint8_t unresponsiveBoards = 0;
+  uint32_t switchRulesFired = 0;
+  // Turnaround and pacing waits of the serial thread and how far they
+  // overshot their deadline in microseconds.
+  uint32_t timerWaits = 0;
+  uint32_t timerOvershootAvg = 0;
+  uint32_t timerOvershootMax = 0;
+  // Lamp and flasher intensities that didn't change the quantized level or
+  // got replaced by a newer one before they were sent.
+  uint32_t suppressedIntensityUpdates = 0;
+  // Board events by type and the solenoid commands dropped because of a
+  // fault.
+  uint32_t faults = 0;
+  uint32_t telemetryEvents = 0;
+  uint32_t unknownEvents = 0;
+  uint32_t suppressedFaultEvents = 0;
+  // Longest time in microseconds from receiving a fault to switching the
+  // solenoid off.
+  uint32_t faultReactionMax = 0;
+};
+
+// Device groups of a hardware test.
+#define PPUC_TEST_COILS 0x01
+#define PPUC_TEST_LAMPS 0x02
+#define PPUC_TEST_FLASHERS 0x04
+#define PPUC_TEST_GI 0x08
+#define PPUC_TEST_SWITCHES 0x10
+
+#define PPUC_TEST_RESULT_RUNNING 0
+#define PPUC_TEST_RESULT_PASSED 1
+// The board of the device didn't respond.
+#define PPUC_TEST_RESULT_FAILED 2
+#define PPUC_TEST_RESULT_CANCELLED 3
+
+struct PPUCTestPlan {
+  uint8_t devices = PPUC_TEST_COILS | PPUC_TEST_LAMPS | PPUC_TEST_FLASHERS |
+                    PPUC_TEST_GI;
+  // Test a single device number only, 0 tests all devices.
+  uint8_t number = 0;
+  // Times in ms, 0 uses the default of the device type.
+  uint32_t onTime = 0;
+  uint32_t offTime = 0;
+  // Time in ms to wait for all switches to change, 0 waits until the test
+  // gets cancelled.
+  uint32_t switchTimeout = 0;
+};
+
+struct PPUCTestResult {
+  uint8_t devices;
+  uint8_t board;
+  uint8_t port;
+  uint8_t number;
+  std::string description;
+  uint8_t result = PPUC_TEST_RESULT_RUNNING;
+  // Last state seen by a switch test.
+  uint8_t state = 0;
+};
+
+typedef void(CALLBACK* PPUC_TestCallback)(const PPUCTestResult* result,
+                                          const void* userData);
+
+// Kinds of traffic of a stress test. Lamp toggles use the lamps of the test
+// mapping only.
+#define PPUC_STRESS_TRAFFIC_NULL 0x01
+#define PPUC_STRESS_TRAFFIC_PING 0x02
+#define PPUC_STRESS_TRAFFIC_LAMPS 0x04
+
+struct PPUCStressConfig {
+  uint8_t traffic = PPUC_STRESS_TRAFFIC_NULL | PPUC_STRESS_TRAFFIC_PING;
+  // Lamp numbers that are safe to toggle.
+  std::vector<uint8_t> lamps;
+  // Events per second of the first step, the increase per step and the
+  // highest rate to try.
+  uint32_t startRate = 500;
+  uint32_t rateStep = 500;
+  uint32_t maxRate = 10000;
+  // Duration of a step in ms.
+  uint32_t stepDuration = 5000;
+  // Stop after the first step that sent less than 90% of the requested rate.
+  bool stopWhenSaturated = true;
+};
+
+struct PPUCStressBoardResult {
+  uint8_t board = 0;
+  // Polls the board responded to and their round trip times in µs.
+  uint32_t polls = 0;
+  uint32_t latencyP50 = 0;
+  uint32_t latencyP95 = 0;
+  uint32_t latencyP99 = 0;
+  uint32_t latencyMax = 0;
+};
+
+struct PPUCStressResult {
+  uint32_t rate = 0;
+  uint32_t queued = 0;
+  // Events that didn't fit into the event queues.
+  uint32_t dropped = 0;
+  // Frames written per second, summed up over all buses.
+  uint32_t framesPerSecond = 0;
+  uint32_t timeouts = 0;
+  uint32_t resyncs = 0;
+  uint32_t crcErrors = 0;
+  std::vector<PPUCStressBoardResult> boards;
+};
+
+typedef void(CALLBACK* PPUC_StressCallback)(const PPUCStressResult* result,
+                                            const void* userData);
 
 struct PPUCSwitchState {
   int number;
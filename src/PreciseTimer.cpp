@@ -0,0 +1,58 @@
+#include "PreciseTimer.h"
+
+#include <thread>
+
+void PreciseTimer::SleepFor(std::chrono::microseconds duration) {
+  SleepUntil(std::chrono::steady_clock::now() + duration);
+}
+
+void PreciseTimer::SleepUntil(std::chrono::steady_clock::time_point deadline) {
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  if (now >= deadline) {
+    return;
+  }
+
+  std::chrono::microseconds spin(m_spinThreshold);
+  if (deadline - now > spin) {
+    std::chrono::steady_clock::time_point wakeup = deadline - spin;
+    std::this_thread::sleep_until(wakeup);
+    now = std::chrono::steady_clock::now();
+    Calibrate(
+        std::chrono::duration_cast<std::chrono::microseconds>(now - wakeup)
+            .count());
+  }
+
+  while (now < deadline) {
+    now = std::chrono::steady_clock::now();
+  }
+
+  uint32_t overshoot =
+      (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(
+          now - deadline)
+          .count();
+  m_waits++;
+  m_totalOvershoot += overshoot;
+  if (overshoot > m_maxOvershoot) {
+    m_maxOvershoot = overshoot;
+  }
+}
+
+uint32_t PreciseTimer::GetAverageOvershoot() {
+  uint32_t waits = m_waits;
+  return waits > 0 ? (uint32_t)(m_totalOvershoot / waits) : 0;
+}
+
+// The spin has to cover the usual oversleep with some margin. Outliers, for
+// example from preemption, only move the average by an eighth.
+void PreciseTimer::Calibrate(int64_t oversleep) {
+  if (oversleep < 0) {
+    oversleep = 0;
+  }
+  m_oversleep += (oversleep * 16 - m_oversleep) / 8;
+
+  int64_t threshold = m_oversleep / 16 * 2 + PRECISE_TIMER_SPIN_MIN;
+  if (threshold > PRECISE_TIMER_SPIN_MAX) {
+    threshold = PRECISE_TIMER_SPIN_MAX;
+  }
+  m_spinThreshold = (uint32_t)threshold;
+}
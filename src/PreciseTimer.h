@@ -0,0 +1,41 @@
+#pragma once
+
+#include <inttypes.h>
+
+#include <atomic>
+#include <chrono>
+
+// Time in microseconds before a deadline at which the timer stops sleeping
+// and starts spinning. The threshold adapts to the oversleep measured on the
+// platform within these limits.
+#define PRECISE_TIMER_SPIN_DEFAULT 200
+#define PRECISE_TIMER_SPIN_MIN 20
+#define PRECISE_TIMER_SPIN_MAX 2000
+
+// Waits for short delays like the RS485 turnaround. Sleeps that short
+// overshoot by up to a millisecond on stock kernels because of the timer
+// slack, so the timer sleeps coarsely and spins on the steady clock for the
+// rest. Waits and statistics belong to a single thread at a time, the
+// statistics can be read from any thread.
+class PreciseTimer {
+ public:
+  void SleepFor(std::chrono::microseconds duration);
+  void SleepUntil(std::chrono::steady_clock::time_point deadline);
+
+  uint32_t GetWaits() { return m_waits; }
+  // Overshoot of the waits beyond their deadline in microseconds.
+  uint32_t GetAverageOvershoot();
+  uint32_t GetMaxOvershoot() { return m_maxOvershoot; }
+  uint32_t GetSpinThreshold() { return m_spinThreshold; }
+
+ private:
+  void Calibrate(int64_t oversleep);
+
+  std::atomic<uint32_t> m_spinThreshold = PRECISE_TIMER_SPIN_DEFAULT;
+  // Moving average of the oversleep of the coarse sleeps, in 1/16 µs.
+  int64_t m_oversleep = 0;
+
+  std::atomic<uint32_t> m_waits = 0;
+  std::atomic<uint64_t> m_totalOvershoot = 0;
+  std::atomic<uint32_t> m_maxOvershoot = 0;
+};
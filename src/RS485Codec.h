@@ -0,0 +1,323 @@
+#pragma once
+
+#include <inttypes.h>
+
+#include <cstddef>
+#include <type_traits>
+
+#include "RS485Crc.h"
+#include "RS485Protocol.h"
+
+// Encoding and decoding of RS485 frames on caller provided buffers. The frame
+// layout depends on the CRC mode, which is a template parameter, so sizes and
+// offsets are known at compile time. WithCrcMode() selects the instantiation
+// for the CRC mode of a bus at run time.
+//
+// Event frame:
+// [0xFF, source, event >> 8, event & 0xFF, value, (crc), 0xAA, 0x55]
+// ConfigEvent frame:
+// [0xFF, source, (sequence), board, topic, index, key, value (4 bytes, big
+// endian), (crc), 0xAA, 0x55]
+// The sequence number is only present in CRC mode.
+
+inline constexpr uint8_t kFrameStart = 0b11111111;
+inline constexpr uint8_t kFrameStop1 = 0b10101010;
+inline constexpr uint8_t kFrameStop2 = 0b01010101;
+
+#define RS485_DECODE_OK 0
+#define RS485_DECODE_STOP_BYTES 1
+#define RS485_DECODE_CRC 2
+
+template <uint8_t crcMode>
+struct RS485FrameLayout {
+  static constexpr size_t kCrcSize = crcMode == CRC_MODE_CRC8    ? 1
+                                     : crcMode == CRC_MODE_CRC16 ? 2
+                                                                 : 0;
+  static constexpr size_t kEventSize = 7 + kCrcSize;
+  static constexpr size_t kConfigEventSize =
+      12 + (crcMode != CRC_MODE_NONE ? 1 : 0) + kCrcSize;
+  // Start byte, source, board, port and length in front of the LED runs.
+  static constexpr size_t kLedFrameHeaderSize = 5;
+
+  static constexpr size_t LedFrameSize(size_t payload) {
+    return kLedFrameHeaderSize + payload + kCrcSize + 2;
+  }
+
+  // Start byte, source, board, first switch and length in front of the
+  // bitmap.
+  static constexpr size_t kSwitchBankHeaderSize = 6;
+
+  static constexpr size_t SwitchBankFrameSize(size_t length) {
+    return kSwitchBankHeaderSize + length + kCrcSize + 2;
+  }
+};
+
+// Frame sizes of the largest layout, for buffers shared by all CRC modes.
+inline constexpr size_t kEventFrameSizeMax =
+    RS485FrameLayout<CRC_MODE_CRC16>::kEventSize;
+inline constexpr size_t kConfigEventFrameSizeMax =
+    RS485FrameLayout<CRC_MODE_CRC16>::kConfigEventSize;
+
+// Calls f with std::integral_constant<uint8_t, crcMode>, so f can use
+// decltype(mode)::value as template argument.
+template <typename F>
+constexpr auto WithCrcMode(uint8_t crcMode, F&& f) {
+  switch (crcMode) {
+    case CRC_MODE_CRC8:
+      return f(std::integral_constant<uint8_t, CRC_MODE_CRC8>());
+    case CRC_MODE_CRC16:
+      return f(std::integral_constant<uint8_t, CRC_MODE_CRC16>());
+  }
+  return f(std::integral_constant<uint8_t, CRC_MODE_NONE>());
+}
+
+// Appends the checksum and the stop bytes and returns the frame size. The
+// start byte is not covered by the checksum.
+template <uint8_t crcMode>
+constexpr size_t FinishFrame(uint8_t* msg, size_t size) {
+  if constexpr (crcMode == CRC_MODE_CRC8) {
+    uint8_t crc = Crc8(msg + 1, size - 1);
+    msg[size++] = crc;
+  } else if constexpr (crcMode == CRC_MODE_CRC16) {
+    uint16_t crc = Crc16(msg + 1, size - 1);
+    msg[size++] = (uint8_t)(crc >> 8);
+    msg[size++] = (uint8_t)(crc & 0xff);
+  }
+  msg[size++] = kFrameStop1;
+  msg[size++] = kFrameStop2;
+
+  return size;
+}
+
+template <uint8_t crcMode>
+constexpr size_t EncodeEventFrame(uint8_t* msg, uint8_t sourceId,
+                                  uint16_t eventId, uint8_t value) {
+  msg[0] = kFrameStart;
+  msg[1] = sourceId;
+  msg[2] = (uint8_t)(eventId >> 8);
+  msg[3] = (uint8_t)(eventId & 0xff);
+  msg[4] = value;
+
+  return FinishFrame<crcMode>(msg, 5);
+}
+
+template <uint8_t crcMode, typename TEvent>
+size_t EncodeEventFrame(uint8_t* msg, const TEvent& event) {
+  return EncodeEventFrame<crcMode>(msg, event.sourceId, event.eventId,
+                                   event.value);
+}
+
+// Encodes as many events as fit into buffer back to back, so they can be sent
+// with a single write. Returns the number of bytes, encoded is set to the
+// number of events.
+template <uint8_t crcMode, typename TEvent>
+size_t EncodeEventFrames(uint8_t* buffer, size_t size, TEvent* const* events,
+                         size_t count, size_t* encoded) {
+  constexpr size_t frameSize = RS485FrameLayout<crcMode>::kEventSize;
+
+  size_t i = 0;
+  for (; i < count && (i + 1) * frameSize <= size; i++) {
+    EncodeEventFrame<crcMode>(buffer + i * frameSize, *events[i]);
+  }
+  *encoded = i;
+
+  return i * frameSize;
+}
+
+template <uint8_t crcMode>
+constexpr size_t EncodeConfigEventFrame(uint8_t* msg, uint8_t sequence,
+                                        uint8_t sourceId, uint8_t boardId,
+                                        uint8_t topic, uint8_t index,
+                                        uint8_t key, uint32_t value) {
+  size_t size = 0;
+  msg[size++] = kFrameStart;
+  msg[size++] = sourceId;
+  if constexpr (crcMode != CRC_MODE_NONE) {
+    msg[size++] = sequence;
+  }
+  msg[size++] = boardId;
+  msg[size++] = topic;
+  msg[size++] = index;
+  msg[size++] = key;
+  msg[size++] = (uint8_t)(value >> 24);
+  msg[size++] = (uint8_t)((value >> 16) & 0xff);
+  msg[size++] = (uint8_t)((value >> 8) & 0xff);
+  msg[size++] = (uint8_t)(value & 0xff);
+
+  return FinishFrame<crcMode>(msg, size);
+}
+
+template <uint8_t crcMode, typename TConfigEvent>
+size_t EncodeConfigEventFrame(uint8_t* msg, uint8_t sequence,
+                              const TConfigEvent& event) {
+  return EncodeConfigEventFrame<crcMode>(msg, sequence, event.sourceId,
+                                         event.boardId, event.topic,
+                                         event.index, event.key, event.value);
+}
+
+// The runs have to be written to msg + kLedFrameHeaderSize already.
+template <uint8_t crcMode>
+constexpr size_t EncodeLedFrame(uint8_t* msg, uint8_t board, uint8_t port,
+                                uint8_t length) {
+  msg[0] = kFrameStart;
+  msg[1] = EVENT_LED_FRAME;
+  msg[2] = board;
+  msg[3] = port;
+  msg[4] = length;
+
+  return FinishFrame<crcMode>(
+      msg, RS485FrameLayout<crcMode>::kLedFrameHeaderSize + length);
+}
+
+template <uint8_t crcMode>
+constexpr size_t EncodeSwitchBankFrame(uint8_t* msg, uint8_t board,
+                                       uint16_t first, const uint8_t* bitmap,
+                                       uint8_t length) {
+  constexpr size_t headerSize =
+      RS485FrameLayout<crcMode>::kSwitchBankHeaderSize;
+
+  msg[0] = kFrameStart;
+  msg[1] = EVENT_SWITCH_BANK;
+  msg[2] = board;
+  msg[3] = (uint8_t)(first >> 8);
+  msg[4] = (uint8_t)(first & 0xff);
+  msg[5] = length;
+  for (size_t i = 0; i < length; i++) {
+    msg[headerSize + i] = bitmap[i];
+  }
+
+  return FinishFrame<crcMode>(msg, headerSize + length);
+}
+
+// Checks a complete switch bank frame, the length is taken from its header.
+template <uint8_t crcMode>
+constexpr int DecodeSwitchBankFrame(const uint8_t* msg) {
+  constexpr size_t headerSize =
+      RS485FrameLayout<crcMode>::kSwitchBankHeaderSize;
+  size_t size = headerSize + msg[5];
+
+  if (msg[size + RS485FrameLayout<crcMode>::kCrcSize] != kFrameStop1 ||
+      msg[size + RS485FrameLayout<crcMode>::kCrcSize + 1] != kFrameStop2) {
+    return RS485_DECODE_STOP_BYTES;
+  }
+
+  if constexpr (crcMode == CRC_MODE_CRC8) {
+    if (Crc8(msg + 1, size - 1) != msg[size]) {
+      return RS485_DECODE_CRC;
+    }
+  } else if constexpr (crcMode == CRC_MODE_CRC16) {
+    if (Crc16(msg + 1, size - 1) !=
+        (((uint16_t)msg[size]) << 8 | msg[size + 1])) {
+      return RS485_DECODE_CRC;
+    }
+  }
+
+  return RS485_DECODE_OK;
+}
+
+struct RS485EventFrame {
+  uint8_t sourceId = 0;
+  uint16_t eventId = 0;
+  uint8_t value = 0;
+};
+
+// Decodes a complete event frame of RS485FrameLayout<crcMode>::kEventSize
+// bytes, including the start byte.
+template <uint8_t crcMode>
+constexpr int DecodeEventFrame(const uint8_t* msg, RS485EventFrame& frame) {
+  constexpr size_t frameSize = RS485FrameLayout<crcMode>::kEventSize;
+
+  if (msg[frameSize - 2] != kFrameStop1 || msg[frameSize - 1] != kFrameStop2) {
+    return RS485_DECODE_STOP_BYTES;
+  }
+
+  if constexpr (crcMode == CRC_MODE_CRC8) {
+    if (Crc8(msg + 1, 4) != msg[5]) {
+      return RS485_DECODE_CRC;
+    }
+  } else if constexpr (crcMode == CRC_MODE_CRC16) {
+    if (Crc16(msg + 1, 4) != (((uint16_t)msg[5]) << 8 | msg[6])) {
+      return RS485_DECODE_CRC;
+    }
+  }
+
+  frame.sourceId = msg[1];
+  frame.eventId = (((uint16_t)msg[2]) << 8) | msg[3];
+  frame.value = msg[4];
+
+  return RS485_DECODE_OK;
+}
+
+// Source and event id 0 are illegal, except for the event id of board events,
+// which carries a solenoid or a reading that might be 0.
+constexpr bool IsLegalEventFrame(const RS485EventFrame& frame) {
+  return frame.sourceId != 0 &&
+         (frame.eventId != 0 || frame.sourceId == EVENT_FAULT ||
+          frame.sourceId == EVENT_TELEMETRY);
+}
+
+// Round trips of every layout, evaluated at compile time.
+template <uint8_t crcMode>
+constexpr bool CheckEventFrameRoundTrip() {
+  uint8_t msg[RS485FrameLayout<crcMode>::kEventSize] = {};
+  if (EncodeEventFrame<crcMode>(msg, 83, 0x1234, 7) != sizeof(msg)) {
+    return false;
+  }
+  RS485EventFrame frame;
+  if (DecodeEventFrame<crcMode>(msg, frame) != RS485_DECODE_OK ||
+      frame.sourceId != 83 || frame.eventId != 0x1234 || frame.value != 7) {
+    return false;
+  }
+  // A flipped bit has to be detected if there is a checksum.
+  msg[4] ^= 0x01;
+  return crcMode == CRC_MODE_NONE ||
+         DecodeEventFrame<crcMode>(msg, frame) == RS485_DECODE_CRC;
+}
+
+template <uint8_t crcMode>
+constexpr bool CheckZeroTelemetryRoundTrip() {
+  uint8_t msg[RS485FrameLayout<crcMode>::kEventSize] = {};
+  EncodeEventFrame<crcMode>(msg, EVENT_TELEMETRY, 0, 2);
+  RS485EventFrame frame;
+  if (DecodeEventFrame<crcMode>(msg, frame) != RS485_DECODE_OK ||
+      !IsLegalEventFrame(frame) || frame.eventId != 0 || frame.value != 2) {
+    return false;
+  }
+  EncodeEventFrame<crcMode>(msg, 83, 0, 2);
+  return DecodeEventFrame<crcMode>(msg, frame) == RS485_DECODE_OK &&
+         !IsLegalEventFrame(frame);
+}
+
+template <uint8_t crcMode>
+constexpr bool CheckConfigEventFrameSize() {
+  uint8_t msg[RS485FrameLayout<crcMode>::kConfigEventSize] = {};
+  return EncodeConfigEventFrame<crcMode>(msg, 1, 67, 2, 3, 4, 5, 0x01020304) ==
+             sizeof(msg) &&
+         msg[sizeof(msg) - 3 - RS485FrameLayout<crcMode>::kCrcSize] == 0x04;
+}
+
+template <uint8_t crcMode>
+constexpr bool CheckSwitchBankFrameRoundTrip() {
+  const uint8_t bitmap[3] = {0x81, 0x00, 0x7e};
+  uint8_t msg[RS485FrameLayout<crcMode>::SwitchBankFrameSize(3)] = {};
+  if (EncodeSwitchBankFrame<crcMode>(msg, 2, 8, bitmap, 3) != sizeof(msg) ||
+      DecodeSwitchBankFrame<crcMode>(msg) != RS485_DECODE_OK) {
+    return false;
+  }
+  msg[7] ^= 0x10;
+  return crcMode == CRC_MODE_NONE ||
+         DecodeSwitchBankFrame<crcMode>(msg) == RS485_DECODE_CRC;
+}
+
+static_assert(CheckEventFrameRoundTrip<CRC_MODE_NONE>());
+static_assert(CheckEventFrameRoundTrip<CRC_MODE_CRC8>());
+static_assert(CheckEventFrameRoundTrip<CRC_MODE_CRC16>());
+static_assert(CheckZeroTelemetryRoundTrip<CRC_MODE_NONE>());
+static_assert(CheckZeroTelemetryRoundTrip<CRC_MODE_CRC8>());
+static_assert(CheckZeroTelemetryRoundTrip<CRC_MODE_CRC16>());
+static_assert(CheckConfigEventFrameSize<CRC_MODE_NONE>());
+static_assert(CheckConfigEventFrameSize<CRC_MODE_CRC8>());
+static_assert(CheckConfigEventFrameSize<CRC_MODE_CRC16>());
+static_assert(CheckSwitchBankFrameRoundTrip<CRC_MODE_NONE>());
+static_assert(CheckSwitchBankFrameRoundTrip<CRC_MODE_CRC8>());
+static_assert(CheckSwitchBankFrameRoundTrip<CRC_MODE_CRC16>());
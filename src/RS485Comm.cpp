@@ -1,20 +1,56 @@
 #include "RS485Comm.h"
 
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#endif
+#if defined(__linux__)
+#include <sys/prctl.h>
+#endif
+
+#include <random>
+
+#include "LibSerialPortTransport.h"
+#include "LinuxSerialTransport.h"
+#include "PPUCTrace.h"
+#include "RS485Crc.h"
 #include "io-boards/PPUCTimings.h"
 
 RS485Comm::RS485Comm() {
   m_pThread = NULL;
-  m_pSerialPort = NULL;
-  m_pSerialPortConfig = NULL;
+  m_pTransport = NULL;
+
+  SetPortBaudRate(RS485_COMM_BAUD_RATE);
 }
 
 RS485Comm::~RS485Comm() {
   Disconnect();
 
-  if (m_pThread) {
-    m_pThread->join();
+  if (m_pTransport) {
+    delete m_pTransport;
+  }
 
-    delete m_pThread;
+  for (int i = 0; i < RS485_COMM_MAX_BOARDS; i++) {
+    for (ConfigEvent* event : m_configWindows[i]) {
+      delete event;
+    }
+  }
+
+  for (LedStripe* ledStripe : m_ledStripes) {
+    delete ledStripe;
+  }
+
+  for (const auto& scheduledEvent : m_scheduledEvents) {
+    delete scheduledEvent.first;
+  }
+  for (const auto& pulse : m_newPulses) {
+    delete pulse.second.off;
+  }
+  for (const auto& pulse : m_pulses) {
+    delete pulse.second.off;
   }
 }
 
@@ -35,87 +71,576 @@ void RS485Comm::LogMessage(const char* format, ...) {
   va_end(args);
 }
 
+void RS485Comm::LogFrame(const char* text, const uint8_t* msg, size_t size) {
+  char hex[RS485_COMM_CONFIG_FRAME_SIZE_MAX * 3 + 1] = "";
+  size_t length = 0;
+  for (size_t i = 0; i < size && length + 3 < sizeof(hex); i++) {
+    length += snprintf(hex + length, sizeof(hex) - length, " %02X", msg[i]);
+  }
+  LogMessage("RS485Comm: %s%s", text, hex);
+}
+
 void RS485Comm::SetDebug(bool debug) { m_debug = debug; }
 
+void RS485Comm::SetBaudRate(int baudRate) { m_configuredBaudRate = baudRate; }
+
+void RS485Comm::SetMaxBaudRate(int maxBaudRate) {
+  m_maxBaudRate = maxBaudRate;
+}
+
+int RS485Comm::GetBaudRate() { return m_baudRate; }
+
+void RS485Comm::SetTransport(uint8_t transport) { m_transport = transport; }
+
+void RS485Comm::SetCrc(bool crc) { m_crc = crc; }
+
+uint8_t RS485Comm::GetCrcMode() { return m_crcMode; }
+
+void RS485Comm::SetPollShare(uint8_t pollShare) {
+  m_airtime.SetPollShare(pollShare);
+}
+
+void RS485Comm::SetQueuePolicy(uint8_t queuePolicy) {
+  m_queuePolicy = queuePolicy;
+}
+
+PPUCBusStatistics RS485Comm::GetStatistics() {
+  PPUCBusStatistics statistics;
+  statistics.timeouts = m_timeouts;
+  statistics.resyncs = m_resyncs;
+  statistics.crcErrors = m_crcErrors;
+  statistics.retransmits = m_retransmits;
+  statistics.reconnects = m_reconnects;
+  statistics.droppedEvents = m_droppedEvents;
+  statistics.polls = m_polls;
+  statistics.filteredSwitchEdges = m_switchFilter.GetFilteredEdges();
+  statistics.flaggedSwitches = m_switchFilter.GetFlaggedSwitches();
+  statistics.unresponsiveBoards = m_unresponsiveBoardCount;
+  statistics.switchRulesFired = m_switchRulesFired;
+  statistics.timerWaits = m_timer.GetWaits();
+  statistics.timerOvershootAvg = m_timer.GetAverageOvershoot();
+  statistics.timerOvershootMax = m_timer.GetMaxOvershoot();
+  statistics.suppressedIntensityUpdates =
+      m_intensityFilter.GetSuppressedUpdates();
+  statistics.faults = m_faults;
+  statistics.telemetryEvents = m_telemetryEvents;
+  statistics.unknownEvents = m_unknownEvents;
+  statistics.suppressedFaultEvents = m_suppressedFaultEvents;
+  statistics.faultReactionMax = m_faultReactionMax;
+
+  return statistics;
+}
+
+void RS485Comm::SetPortBaudRate(int baudRate) {
+  m_baudRate = baudRate;
+
+  if (m_pTransport != NULL && m_pTransport->IsOpen()) {
+    m_pTransport->SetBaudRate(baudRate);
+  }
+
+  // RS485_MODE_SWITCH_DELAY is given for RS485_COMM_BAUD_RATE. The boards
+  // scale their turnaround with the baud rate, but it can't be shorter than
+  // two characters.
+  m_modeSwitchDelay = (uint32_t)((uint64_t)RS485_MODE_SWITCH_DELAY *
+                                 RS485_COMM_BAUD_RATE / baudRate);
+  if (m_modeSwitchDelay < GetTransmissionTime(2)) {
+    m_modeSwitchDelay = GetTransmissionTime(2);
+  }
+
+  m_receiveTimeout =
+      m_modeSwitchDelay +
+      GetTransmissionTime(RS485_COMM_RECEIVE_TIMEOUT_FRAMES * 7);
+  if (m_receiveTimeout < RS485_COMM_MIN_RECEIVE_TIMEOUT) {
+    m_receiveTimeout = RS485_COMM_MIN_RECEIVE_TIMEOUT;
+  }
+}
+
+// Returns the time in microseconds required to transmit the given amount of
+// bytes. Every byte takes 10 bits on the wire using 8N1.
+uint32_t RS485Comm::GetTransmissionTime(size_t bytes) {
+  return (uint32_t)((uint64_t)bytes * 10 * 1000000 / m_baudRate);
+}
+
+// Returns the write timeout in milliseconds for the given amount of bytes.
+uint32_t RS485Comm::GetWriteTimeout(size_t bytes) {
+  return (GetTransmissionTime(bytes) + 999) / 1000 +
+         RS485_COMM_SERIAL_WRITE_TIMEOUT;
+}
+
+void RS485Comm::SetThreadConfig(const PPUCThreadConfig& config) {
+  m_threadConfig = config;
+}
+
+int RS485Comm::GetThreadConfigResult() { return m_threadConfigResult; }
+
+// Applies m_threadConfig to the calling thread. Missing privileges or
+// unsupported features are not fatal, the thread keeps running with the
+// default settings and the failed parts are reported as result flags.
+int RS485Comm::ApplyThreadConfig() {
+  int result = PPUC_THREAD_CONFIG_OK;
+
+#if defined(_WIN32)
+  if (m_threadConfig.policy != PPUC_THREAD_POLICY_DEFAULT) {
+    int priority = m_threadConfig.policy == PPUC_THREAD_POLICY_FIFO
+                       ? THREAD_PRIORITY_TIME_CRITICAL
+                       : THREAD_PRIORITY_HIGHEST;
+    if (!SetThreadPriority(GetCurrentThread(), priority)) {
+      LogMessage("RS485Comm: failed to set thread priority, error %lu",
+                 GetLastError());
+      result |= PPUC_THREAD_CONFIG_POLICY_FAILED;
+    }
+  }
+
+  if (!m_threadConfig.affinity.empty()) {
+    DWORD_PTR mask = 0;
+    for (int cpu : m_threadConfig.affinity) {
+      if (cpu >= 0 && cpu < (int)(sizeof(DWORD_PTR) * 8)) {
+        mask |= ((DWORD_PTR)1) << cpu;
+      }
+    }
+    if (mask == 0 || !SetThreadAffinityMask(GetCurrentThread(), mask)) {
+      LogMessage("RS485Comm: failed to set thread affinity, error %lu",
+                 GetLastError());
+      result |= PPUC_THREAD_CONFIG_AFFINITY_FAILED;
+    }
+  }
+
+  if (!m_threadConfig.name.empty()) {
+    std::wstring name(m_threadConfig.name.begin(), m_threadConfig.name.end());
+    if (FAILED(SetThreadDescription(GetCurrentThread(), name.c_str()))) {
+      result |= PPUC_THREAD_CONFIG_NAME_FAILED;
+    }
+  }
+#else
+  if (m_threadConfig.policy != PPUC_THREAD_POLICY_DEFAULT) {
+    int policy = m_threadConfig.policy == PPUC_THREAD_POLICY_FIFO ? SCHED_FIFO
+                                                                  : SCHED_RR;
+    int priority = m_threadConfig.priority;
+    if (priority < sched_get_priority_min(policy)) {
+      priority = sched_get_priority_min(policy);
+    } else if (priority > sched_get_priority_max(policy)) {
+      priority = sched_get_priority_max(policy);
+    }
+
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = priority;
+    int error = pthread_setschedparam(pthread_self(), policy, &param);
+    if (error != 0) {
+      LogMessage(
+          "RS485Comm: failed to set %s scheduling with priority %d: %s%s",
+          policy == SCHED_FIFO ? "SCHED_FIFO" : "SCHED_RR", priority,
+          strerror(error),
+          error == EPERM ? " (missing CAP_SYS_NICE or RLIMIT_RTPRIO)" : "");
+      result |= PPUC_THREAD_CONFIG_POLICY_FAILED;
+    }
+  }
+
+  if (!m_threadConfig.affinity.empty()) {
+#if defined(__linux__)
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    for (int cpu : m_threadConfig.affinity) {
+      if (cpu >= 0 && cpu < CPU_SETSIZE) {
+        CPU_SET(cpu, &cpuset);
+      }
+    }
+    int error = CPU_COUNT(&cpuset) == 0
+                    ? EINVAL
+                    : pthread_setaffinity_np(pthread_self(), sizeof(cpuset),
+                                             &cpuset);
+    if (error != 0) {
+      LogMessage("RS485Comm: failed to set thread affinity: %s",
+                 strerror(error));
+      result |= PPUC_THREAD_CONFIG_AFFINITY_FAILED;
+    }
+#else
+    LogMessage("RS485Comm: thread affinity is not supported on this platform");
+    result |= PPUC_THREAD_CONFIG_AFFINITY_FAILED;
+#endif
+  }
+
+  if (m_threadConfig.timerSlack > 0) {
+#if defined(__linux__)
+    // Shortens the coarse sleeps of the turnaround waits, the spin of
+    // PreciseTimer covers less then.
+    if (prctl(PR_SET_TIMERSLACK, (unsigned long)m_threadConfig.timerSlack) !=
+        0) {
+      LogMessage("RS485Comm: failed to set timer slack: %s", strerror(errno));
+      result |= PPUC_THREAD_CONFIG_TIMER_SLACK_FAILED;
+    }
+#else
+    LogMessage("RS485Comm: timer slack is not supported on this platform");
+    result |= PPUC_THREAD_CONFIG_TIMER_SLACK_FAILED;
+#endif
+  }
+
+  if (!m_threadConfig.name.empty()) {
+#if defined(__APPLE__)
+    int error = pthread_setname_np(m_threadConfig.name.c_str());
+#else
+    // Linux limits thread names to 15 characters plus the terminating null.
+    int error = pthread_setname_np(pthread_self(),
+                                   m_threadConfig.name.substr(0, 15).c_str());
+#endif
+    if (error != 0) {
+      result |= PPUC_THREAD_CONFIG_NAME_FAILED;
+    }
+  }
+#endif
+
+  return result;
+}
+
 void RS485Comm::Run() {
-  m_pThread = new std::thread([this]() {
+  std::promise<int> threadConfigResult;
+  std::future<int> threadConfigApplied = threadConfigResult.get_future();
+
+  m_running = true;
+  m_pThread = new std::thread([this, &threadConfigResult]() {
+    threadConfigResult.set_value(ApplyThreadConfig());
+
     LogMessage("RS485Comm run thread starting");
 
+    StartConfigSession();
+
     int switchBoardCount = 0;
-    while (m_pSerialPort != NULL) {
+    // Grows if a frame doesn't fit.
+    std::vector<Event*> events(RS485_COMM_MAX_EVENTS_TO_SEND);
+    while (m_running) {
+      if (m_portLost && !Reconnect()) {
+        break;
+      }
+
+      // Send only as many queued events as the outbound airtime budget
+      // allows, the remaining ones wait for the next round after the switch
+      // polling.
+      m_airtime.Refill();
+      uint32_t frameAirtime = GetTransmissionTime(GetEventFrameSize());
+      size_t maxEvents = m_airtime.GetOutboundFrames(frameAirtime);
+      if (maxEvents > RS485_COMM_MAX_EVENTS_TO_SEND) {
+        maxEvents = RS485_COMM_MAX_EVENTS_TO_SEND;
+      }
+
+      SendUrgentEvents();
+
+      size_t eventCount = 0;
+      uint64_t tick = GetTick(std::chrono::steady_clock::now());
       m_eventQueueMutex.lock();
-      uint8_t eventsSent = m_events.empty() ? RS485_COMM_MAX_EVENTS_TO_SEND : 0;
+      for (const auto& scheduledEvent : m_scheduledEvents) {
+        m_timerWheel.Add(scheduledEvent.first, scheduledEvent.second, tick);
+      }
+      m_scheduledEvents.clear();
+      AdoptPulses();
       m_eventQueueMutex.unlock();
-      while (eventsSent++ < RS485_COMM_MAX_EVENTS_TO_SEND) {
-        m_eventQueueMutex.lock();
-        if (!m_events.empty()) {
-          Event* event = m_events.front();
-          m_events.pop();
-          m_eventQueueMutex.unlock();
-          SendEvent(event);
-        } else {
-          m_eventQueueMutex.unlock();
+
+      // Due scheduled events go first and aren't held back by the budget, so
+      // the end of a pulse doesn't wait for a backed up queue. They are still
+      // charged, which delays the queued events instead.
+      size_t released;
+      while ((released = m_timerWheel.Advance(
+                  tick, events.data() + eventCount,
+                  events.size() - eventCount)) > 0) {
+        eventCount += released;
+        if (eventCount < events.size()) {
+          break;
+        }
+        events.resize(events.size() * 2);
+      }
+      size_t timedCount = eventCount;
+      if (timedCount + maxEvents > events.size()) {
+        events.resize(timedCount + maxEvents);
+      }
+
+      m_eventQueueMutex.lock();
+      while (!m_events.empty()) {
+        while (!m_frames.empty() && m_frames.front().second <= m_dequeued) {
+          m_frames.pop();
+        }
+        // A frame that has been started gets dequeued completely, so it is
+        // sent without polling in between.
+        bool inFrame = !m_frames.empty() && m_frames.front().first < m_dequeued;
+        if (eventCount - timedCount >= maxEvents && !inFrame) {
           break;
         }
+
+        if (eventCount == events.size()) {
+          events.resize(events.size() * 2);
+        }
+        events[eventCount++] = m_events.front();
+        m_events.pop();
+        m_dequeued++;
+      }
+      uint64_t dequeued = m_dequeued;
+      m_eventQueueMutex.unlock();
+      if (eventCount > 0) {
+        m_eventQueueSpace.notify_all();
+      }
+
+      if (eventCount - timedCount < maxEvents) {
+        eventCount += m_intensityFilter.Poll(
+            tick, events.data() + eventCount,
+            maxEvents - (eventCount - timedCount));
       }
 
-      if (m_activeBoards[m_switchBoards[switchBoardCount]]) {
-        PollEvents(m_switchBoards[switchBoardCount]);
+      eventCount = DropFaultedEvents(events.data(), eventCount);
+      if (eventCount > 0) {
+        PPUC_TRACE1(event_dequeue, eventCount);
+        m_airtime.ChargeOutbound(eventCount * frameAirtime);
+        SendEvents(events.data(), eventCount);
+        StartPulses(events.data(), eventCount);
+        for (size_t i = 0; i < eventCount; i++) {
+          delete events[i];
+        }
       }
+      if (m_sent != dequeued) {
+        m_sent = dequeued;
+        if (m_sentCallback) {
+          (*(m_sentCallback))(m_sentUserData);
+        }
+      }
+
+      SendLedFrames();
+
+      // A bus might not have any board to poll at all.
+      if (m_switchBoardCounter > 0) {
+        uint8_t board = m_switchBoards[switchBoardCount];
+        if (m_activeBoards[board]) {
+          UpdateBoardHealth(board, PollEvents(board));
+          m_polls++;
+          // Outputs of switch rules that fired during the poll.
+          SendUrgentEvents();
+        }
 
-      if (++switchBoardCount > m_switchBoardCounter) {
-        switchBoardCount = 0;
+        if (++switchBoardCount >= m_switchBoardCounter) {
+          switchBoardCount = 0;
+        }
       }
 
+      CheckBoardHealth();
+      PollSwitchFilter();
+
       // std::this_thread::sleep_for(std::chrono::milliseconds(1));
     }
 
     LogMessage("RS485Comm run thread finished");
   });
+
+  // Block until the thread configuration got applied, so the result is
+  // available as soon as Run() returns.
+  m_threadConfigResult = threadConfigApplied.get();
 }
 
-void RS485Comm::QueueEvent(Event* event) {
-  m_eventQueueMutex.lock();
+uint8_t RS485Comm::QueueEvent(Event* event) {
+  std::unique_lock<std::mutex> lock(m_eventQueueMutex);
+  if (m_events.size() >= RS485_COMM_QUEUE_SIZE_MAX &&
+      m_queuePolicy == PPUC_QUEUE_POLICY_BLOCK) {
+    m_eventQueueSpace.wait_for(
+        lock, std::chrono::milliseconds(RS485_COMM_QUEUE_BLOCK_TIMEOUT),
+        [this]() { return m_events.size() < RS485_COMM_QUEUE_SIZE_MAX; });
+  }
+
+  if (m_events.size() >= RS485_COMM_QUEUE_SIZE_MAX) {
+    lock.unlock();
+    delete event;
+    m_droppedEvents++;
+    return PPUC_QUEUE_FULL;
+  }
+
   m_events.push(event);
+  m_enqueued++;
+  PPUC_TRACE3(event_enqueue, event->sourceId, event->eventId, event->value);
+  return PPUC_QUEUE_OK;
+}
+
+uint8_t RS485Comm::QueueFrame(Event** events, size_t count) {
+  if (count == 0) {
+    return PPUC_QUEUE_OK;
+  }
+
+  // A frame larger than the queue fits into an empty one.
+  auto fits = [this, count]() {
+    return m_events.empty() ||
+           m_events.size() + count <= RS485_COMM_QUEUE_SIZE_MAX;
+  };
+
+  std::unique_lock<std::mutex> lock(m_eventQueueMutex);
+  if (!fits() && m_queuePolicy == PPUC_QUEUE_POLICY_BLOCK) {
+    m_eventQueueSpace.wait_for(
+        lock, std::chrono::milliseconds(RS485_COMM_QUEUE_BLOCK_TIMEOUT), fits);
+  }
+
+  if (!fits()) {
+    lock.unlock();
+    for (size_t i = 0; i < count; i++) {
+      delete events[i];
+    }
+    m_droppedEvents += count;
+    return PPUC_QUEUE_FULL;
+  }
+
+  m_frames.push(std::make_pair(m_enqueued, m_enqueued + count));
+  for (size_t i = 0; i < count; i++) {
+    m_events.push(events[i]);
+  }
+  m_enqueued += count;
+  PPUC_TRACE1(frame_enqueue, count);
+  return PPUC_QUEUE_OK;
+}
+
+void RS485Comm::QueueUrgentEvent(Event* event) {
+  m_eventQueueMutex.lock();
+  m_urgentEvents.push(event);
   m_eventQueueMutex.unlock();
 }
 
-void RS485Comm::Disconnect() {
-  if (m_pSerialPort == NULL) {
+void RS485Comm::QueueUrgentPulse(Event* on, Event* off, uint32_t duration) {
+  m_eventQueueMutex.lock();
+  m_urgentEvents.push(on);
+  m_newPulses.push_back(std::make_pair(on, RS485Pulse{off, duration}));
+  m_eventQueueMutex.unlock();
+}
+
+void RS485Comm::SendUrgentEvents() {
+  Event* events[RS485_COMM_MAX_EVENTS_TO_SEND];
+  size_t eventCount = 0;
+
+  m_eventQueueMutex.lock();
+  while (!m_urgentEvents.empty() &&
+         eventCount < RS485_COMM_MAX_EVENTS_TO_SEND) {
+    events[eventCount++] = m_urgentEvents.front();
+    m_urgentEvents.pop();
+  }
+  AdoptPulses();
+  m_eventQueueMutex.unlock();
+
+  eventCount = DropFaultedEvents(events, eventCount);
+  if (eventCount > 0) {
+    PPUC_TRACE1(event_dequeue, eventCount);
+    SendEvents(events, eventCount);
+    StartPulses(events, eventCount);
+    for (size_t i = 0; i < eventCount; i++) {
+      delete events[i];
+    }
+  }
+}
+
+LatencyHistogram* RS485Comm::GetPollLatency(uint8_t board) {
+  return board < RS485_COMM_MAX_BOARDS ? &m_pollLatencies[board] : nullptr;
+}
+
+void RS485Comm::ResetPollLatencies() {
+  for (LatencyHistogram& pollLatency : m_pollLatencies) {
+    pollLatency.Reset();
+  }
+}
+
+uint64_t RS485Comm::GetQueuePosition() {
+  std::lock_guard<std::mutex> lock(m_eventQueueMutex);
+  return m_enqueued;
+}
+
+uint64_t RS485Comm::GetSentPosition() { return m_sent; }
+
+void RS485Comm::SetSentCallback(RS485Comm_SentCallback callback,
+                                const void* userData) {
+  m_sentCallback = callback;
+  m_sentUserData = userData;
+}
+
+void RS485Comm::ScheduleEvent(Event* event,
+                              std::chrono::steady_clock::time_point at) {
+  m_eventQueueMutex.lock();
+  m_scheduledEvents.push_back(std::make_pair(event, GetTick(at)));
+  m_eventQueueMutex.unlock();
+}
+
+void RS485Comm::SchedulePulse(Event* on, Event* off, uint32_t duration,
+                              std::chrono::steady_clock::time_point at) {
+  m_eventQueueMutex.lock();
+  m_scheduledEvents.push_back(std::make_pair(on, GetTick(at)));
+  m_newPulses.push_back(std::make_pair(on, RS485Pulse{off, duration}));
+  m_eventQueueMutex.unlock();
+}
+
+void RS485Comm::AdoptPulses() {
+  for (const auto& pulse : m_newPulses) {
+    m_pulses[pulse.first] = pulse.second;
+  }
+  m_newPulses.clear();
+}
+
+void RS485Comm::StartPulses(Event** events, size_t count) {
+  if (m_pulses.empty()) {
     return;
   }
 
-  sp_set_config(m_pSerialPort, m_pSerialPortConfig);
-  sp_free_config(m_pSerialPortConfig);
-  m_pSerialPortConfig = NULL;
+  uint64_t tick = GetTick(std::chrono::steady_clock::now());
+  for (size_t i = 0; i < count; i++) {
+    auto it = m_pulses.find(events[i]);
+    if (it != m_pulses.end()) {
+      m_timerWheel.Add(it->second.off, tick + it->second.duration, tick);
+      m_pulses.erase(it);
+    }
+  }
+}
+
+// Returns the time in ms ticks of the timer wheel.
+uint64_t RS485Comm::GetTick(std::chrono::steady_clock::time_point time) {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             time.time_since_epoch())
+      .count();
+}
+
+void RS485Comm::Disconnect() {
+  // Stop the run thread before the port gets closed underneath it.
+  m_running = false;
+  if (m_pThread) {
+    m_pThread->join();
+
+    delete m_pThread;
+    m_pThread = NULL;
+  }
 
-  sp_close(m_pSerialPort);
-  sp_free_port(m_pSerialPort);
-  m_pSerialPort = NULL;
+  if (m_pTransport != NULL) {
+    m_pTransport->Close();
+  }
 }
 
 bool RS485Comm::Connect(const char* pDevice) {
-  enum sp_return result = sp_get_port_by_name(pDevice, &m_pSerialPort);
-  if (result != SP_OK) {
-    return false;
+  if (m_pTransport != NULL) {
+    delete m_pTransport;
   }
 
-  result = sp_open(m_pSerialPort, SP_MODE_READ_WRITE);
-  if (result != SP_OK) {
-    sp_free_port(m_pSerialPort);
-    m_pSerialPort = NULL;
-    return false;
+#if defined(__linux__)
+  if (m_transport == PPUC_TRANSPORT_NATIVE) {
+    m_pTransport = new LinuxSerialTransport();
+  } else {
+    m_pTransport = new LibSerialPortTransport();
+  }
+#else
+  if (m_transport == PPUC_TRANSPORT_NATIVE) {
+    LogMessage(
+        "RS485Comm: native transport is not available on this platform, "
+        "using libserialport");
+  }
+  m_pTransport = new LibSerialPortTransport();
+#endif
+
+  m_device = pDevice;
+  m_portLost = false;
+  m_crcMode = CRC_MODE_NONE;
+  m_journalConfig = false;
+  for (int i = 0; i < RS485_COMM_MAX_BOARDS; i++) {
+    m_configJournal[i].clear();
   }
 
-  sp_new_config(&m_pSerialPortConfig);
-  sp_get_config(m_pSerialPort, m_pSerialPortConfig);
-  sp_set_baudrate(m_pSerialPort, RS485_COMM_BAUD_RATE);
-  sp_set_bits(m_pSerialPort, 8);
-  sp_set_parity(m_pSerialPort, SP_PARITY_NONE);
-  sp_set_stopbits(m_pSerialPort, 1);
-  sp_set_xon_xoff(m_pSerialPort, SP_XONXOFF_DISABLED);
+  SetPortBaudRate(m_configuredBaudRate);
+  if (!m_pTransport->Open(pDevice, m_baudRate)) {
+    return false;
+  }
 
-  sp_flush(m_pSerialPort, SP_BUF_BOTH);
+  m_pTransport->Flush();
   // Wait before continuing.
   std::this_thread::sleep_for(std::chrono::milliseconds(200));
   for (int i = 0; i < RS485_COMM_MAX_BOARDS; i++) {
@@ -150,212 +675,1053 @@ bool RS485Comm::Connect(const char* pDevice) {
 
   for (int i = 0; i < RS485_COMM_MAX_BOARDS; i++) {
     if (m_debug) {
-      printf("Probe i/o board %d\n", i);
+      LogMessage("RS485Comm: probe i/o board %d", i);
     }
     PollEvents(i);
   }
 
+  Negotiate();
+
+  // Record the configuration that follows.
+  std::random_device random;
+  m_sessionToken = (uint16_t)(random() % 0xffff) + 1;
+  m_journalConfig = true;
+
   return true;
 }
 
-void RS485Comm::RegisterSwitchBoard(uint8_t number) {
-  if (m_switchBoardCounter < RS485_COMM_MAX_BOARDS) {
-    m_switchBoards[m_switchBoardCounter++] = number;
+void RS485Comm::Negotiate() {
+  uint16_t capabilities = RequestCapabilities();
+  if (m_maxBaudRate > m_baudRate) {
+    NegotiateBaudRate(capabilities);
   }
+  if (m_crc) {
+    NegotiateCrc(capabilities);
+  }
+  NegotiateSwitchBank();
 }
 
-PPUCSwitchState* RS485Comm::GetNextSwitchState() {
-  PPUCSwitchState* switchState = nullptr;
-
-  m_switchesQueueMutex.lock();
-
-  if (!m_switches.empty()) {
-    switchState = m_switches.front();
-    m_switches.pop();
+// Assigns the session token to all boards once their configuration is
+// complete.
+void RS485Comm::StartConfigSession() {
+  m_journalConfig = false;
+  for (int i = 0; i < RS485_COMM_MAX_BOARDS; i++) {
+    if (m_activeBoards[i]) {
+      Event sessionEvent(EVENT_CONFIG_SESSION, m_sessionToken, i);
+      SendEvent(&sessionEvent);
+      m_boardSessions[i] = m_sessionToken;
+    }
   }
-
-  m_switchesQueueMutex.unlock();
-
-  return switchState;
 }
 
-bool RS485Comm::SendConfigEvent(ConfigEvent* event) {
-  // Wait a bit to not exceed the output buffer in case of large configurations.
-  std::this_thread::sleep_for(std::chrono::milliseconds(5));
-
-  if (m_pSerialPort != NULL) {
-    m_cmsg[0] = 0b11111111;
-    m_cmsg[1] = event->sourceId;
-    m_cmsg[2] = event->boardId;
-    m_cmsg[3] = event->topic;
-    m_cmsg[4] = event->index;
-    m_cmsg[5] = event->key;
-    m_cmsg[6] = event->value >> 24;
-    m_cmsg[7] = (event->value >> 16) & 0xff;
-    m_cmsg[8] = (event->value >> 8) & 0xff;
-    m_cmsg[9] = event->value & 0xff;
-    m_cmsg[10] = 0b10101010;
-    m_cmsg[11] = 0b01010101;
+// Reopens a lost serial port, for example after a USB adapter dropout. Boards
+// that kept their session token are still configured, so the queues just
+// resume. Only boards that rebooted in the meantime get their configuration
+// again. Returns false if the run thread got stopped while waiting.
+bool RS485Comm::Reconnect() {
+  LogMessage("RS485Comm: lost connection to %s, reconnecting",
+             m_device.c_str());
 
-    delete event;
+  bool expectedBoards[RS485_COMM_MAX_BOARDS];
+  for (int i = 0; i < RS485_COMM_MAX_BOARDS; i++) {
+    expectedBoards[i] = m_activeBoards[i];
+  }
 
-    if (sp_blocking_write(m_pSerialPort, m_cmsg, 12,
-                          RS485_COMM_SERIAL_WRITE_TIMEOUT)) {
-      if (m_debug) {
-        // @todo user logger
-        printf(
-            "Sent ConfigEvent %02X %d %d %d %d %d %02x%02x%02x%02x %02X %02X\n",
-            m_cmsg[0], m_cmsg[1], m_cmsg[2], m_cmsg[3], m_cmsg[4], m_cmsg[5],
-            m_cmsg[6], m_cmsg[7], m_cmsg[8], m_cmsg[9], m_cmsg[10], m_cmsg[11]);
-      }
-      return true;
-    } else {
-      if (m_debug) {
-        // @todo user logger
-        printf(
-            "Error when sending ConfigEvent %02X %d %d %d %d %d "
-            "%02x%02x%02x%02x %02X %02X\n",
-            m_cmsg[0], m_cmsg[1], m_cmsg[2], m_cmsg[3], m_cmsg[4], m_cmsg[5],
-            m_cmsg[6], m_cmsg[7], m_cmsg[8], m_cmsg[9], m_cmsg[10], m_cmsg[11]);
-      }
+  m_pTransport->Close();
+  while (!m_pTransport->Open(m_device.c_str(), m_baudRate)) {
+    std::this_thread::sleep_for(
+        std::chrono::milliseconds(RS485_COMM_RECONNECT_INTERVAL));
+    if (!m_running) {
+      return false;
     }
   }
+  m_pTransport->Flush();
+  m_portLost = false;
+  m_reconnects++;
 
-  return false;
-}
-
-bool RS485Comm::SendEvent(Event* event) {
-  if (m_pSerialPort != NULL) {
-    m_msg[0] = (uint8_t)255;
-    m_msg[1] = event->sourceId;
-    m_msg[2] = event->eventId >> 8;
-    m_msg[3] = event->eventId & 0xff;
-    m_msg[4] = event->value;
-    m_msg[5] = 0b10101010;
-    m_msg[6] = 0b01010101;
-
-    if (sp_blocking_write(m_pSerialPort, m_msg, 7,
-                          RS485_COMM_SERIAL_WRITE_TIMEOUT)) {
-      if (m_debug) {
-        // @todo user logger
-        printf("Sent Event %d %d %d\n", event->sourceId, event->eventId,
-               event->value);
-      }
-      return true;
+  if (!VerifyActiveBoards() &&
+      (m_baudRate != m_configuredBaudRate || m_crcMode != CRC_MODE_NONE)) {
+    // Rebooted boards start with the default settings, so the whole bus has
+    // to fall back and negotiate again.
+    RestoreDefaultBusSettings();
+    for (int i = 0; i < RS485_COMM_MAX_BOARDS; i++) {
+      m_activeBoards[i] = expectedBoards[i];
     }
+    VerifyActiveBoards();
+    Negotiate();
   }
 
-  return false;
-}
-
-Event* RS485Comm::receiveEvent() {
-  if (m_pSerialPort != NULL) {
-    std::chrono::steady_clock::time_point start =
-        std::chrono::steady_clock::now();
-
-    // Set a timeout of 8ms when waiting for an I/O board event.
-    // The RS485 converter on the board itself requires 1ms to toggle
-    // send/receive mode.
-    while ((std::chrono::duration_cast<std::chrono::microseconds>(
-                std::chrono::steady_clock::now() - start))
-               .count() < 8000) {
-      // printf("Available %d\n", m_serialPort.Available());
-      if ((int)sp_input_waiting(m_pSerialPort) >= 6) {
-        uint8_t startByte;
-        sp_blocking_read(m_pSerialPort, &startByte, 1,
-                         RS485_COMM_SERIAL_READ_TIMEOUT);
-        if (startByte == 255) {
-          uint8_t sourceId;
-          sp_blocking_read(m_pSerialPort, &sourceId, 1,
-                           RS485_COMM_SERIAL_READ_TIMEOUT);
-          if (sourceId != 0) {
-            uint8_t eventIdHigh;
-            uint8_t eventIdLow;
-            sp_blocking_read(m_pSerialPort, &eventIdHigh, 1,
-                             RS485_COMM_SERIAL_READ_TIMEOUT);
-            sp_blocking_read(m_pSerialPort, &eventIdLow, 1,
-                             RS485_COMM_SERIAL_READ_TIMEOUT);
-            uint16_t eventId = (((uint16_t)eventIdHigh) << 8) + eventIdLow;
-            if (eventId != 0) {
-              uint8_t value;
-              sp_blocking_read(m_pSerialPort, &value, 1,
-                               RS485_COMM_SERIAL_READ_TIMEOUT);
-
-              uint8_t stopByte;
-              sp_blocking_read(m_pSerialPort, &stopByte, 1,
-                               RS485_COMM_SERIAL_READ_TIMEOUT);
-              if (stopByte == 0b10101010) {
-                sp_blocking_read(m_pSerialPort, &stopByte, 1,
-                                 RS485_COMM_SERIAL_READ_TIMEOUT);
-                if (stopByte == 0b01010101) {
-                  if (m_debug) {
-                    // @todo use logger
-                    printf("Received Event %d %d %d\n", sourceId, eventId,
-                           value);
-                  }
-                  return new Event(sourceId, eventId, value);
-                } else if (m_debug) {
-                  // @todo use logger
-                  printf("Received wrong second stop byte %d\n", stopByte);
-                }
-              } else if (m_debug) {
-                // @todo use logger
-                printf("Received wrong first stop byte %d\n", stopByte);
-              }
-            } else if (m_debug) {
-              // @todo use logger
-              printf("Received illegal event id %d\n", eventId);
-            }
-          } else if (m_debug) {
-            // @todo use logger
-            printf("Received illegal source id %d\n", sourceId);
-          }
+  for (int i = 0; i < RS485_COMM_MAX_BOARDS; i++) {
+    if (!expectedBoards[i]) {
+      continue;
+    }
 
-          // Something went wrong after the start byte, try to get back in sync.
-          while (sp_input_waiting(m_pSerialPort) > 0) {
-            if (m_debug) {
-              // @todo use logger
-              printf("Error: Lost sync, %d bytes remaining\n",
-                     sp_input_waiting(m_pSerialPort));
-            }
-            uint8_t stopByte;
-            sp_blocking_read(m_pSerialPort, &stopByte, 1,
-                             RS485_COMM_SERIAL_READ_TIMEOUT);
-            if (stopByte == 0b10101010) {
-              sp_blocking_read(m_pSerialPort, &stopByte, 1,
-                               RS485_COMM_SERIAL_READ_TIMEOUT);
-              if (stopByte == 0b01010101) {
-                // Now we should be back in sync.
-                break;
-              }
-            }
-          }
-        }
-      }
+    if (!m_activeBoards[i]) {
+      LogMessage("RS485Comm: i/o board %d did not respond after reconnect", i);
+      m_boardTimeouts[i] = RS485_COMM_BOARD_TIMEOUTS_MAX - 1;
+      UpdateBoardHealth(i, false);
+      continue;
     }
-    if (m_debug) {
-      // @todo use logger
-      printf("Timeout when waiting for events from i/o boards\n");
+
+    m_boardSessions[i] = 0;
+    Event sessionEvent(EVENT_CONFIG_SESSION, 0, i);
+    SendEvent(&sessionEvent);
+    PollEvents(i);
+
+    if (m_boardSessions[i] != m_sessionToken) {
+      LogMessage("RS485Comm: i/o board %d rebooted, sending configuration",
+                 i);
+      ReplayConfigJournal(i);
     }
-  } else if (m_debug) {
-    // @todo use logger
-    printf("RS485 Error\n");
   }
 
-  return nullptr;
+  // LED frames might have been lost or the board rebooted.
+  for (LedStripe* ledStripe : m_ledStripes) {
+    ledStripe->Invalidate();
+  }
+
+  // Switch changes got lost during the dropout.
+  Event readSwitchesEvent(EVENT_READ_SWITCHES);
+  SendEvent(&readSwitchesEvent);
+
+  LogMessage("RS485Comm: reconnected to %s", m_device.c_str());
+
+  return true;
 }
 
-void RS485Comm::PollEvents(int board) {
-  if (m_debug) {
-    // @todo use logger
-    printf("Polling board %d ...\n", board);
+void RS485Comm::RestoreDefaultBusSettings() {
+  if (m_crcMode != CRC_MODE_NONE) {
+    Event noCrcModeEvent(EVENT_CRC_MODE, CRC_MODE_NONE, 0);
+    SendEvent(&noCrcModeEvent);
+    m_pTransport->Drain();
+    m_crcMode = CRC_MODE_NONE;
   }
 
-  Event* event = new Event(EVENT_POLL_EVENTS, 1, board);
-  if (SendEvent(event)) {
-    // Wait until the i/o board switched to RS485 send mode.
+  if (m_baudRate != m_configuredBaudRate) {
+    Event defaultBaudRateEvent(EVENT_BAUD_RATE, BAUD_RATE_CODE_DEFAULT, 0);
+    SendEvent(&defaultBaudRateEvent);
+    m_pTransport->Drain();
+    SetPortBaudRate(m_configuredBaudRate);
+    // Boards that missed the switch back fall back on their own.
     std::this_thread::sleep_for(
-        std::chrono::microseconds(RS485_MODE_SWITCH_DELAY));
+        std::chrono::milliseconds(RS485_COMM_BAUD_RATE_FALLBACK_TIMEOUT));
+  }
+}
+
+void RS485Comm::ReplayConfigJournal(uint8_t board) {
+  for (const ConfigEvent& configEvent : m_configJournal[board]) {
+    SendConfigEvent(new ConfigEvent(configEvent));
+  }
+  FlushConfigEvents(board);
+
+  Event sessionEvent(EVENT_CONFIG_SESSION, m_sessionToken, board);
+  SendEvent(&sessionEvent);
+  m_boardSessions[board] = m_sessionToken;
+}
+
+// Pings all boards found so far and checks if they are still responding.
+bool RS485Comm::VerifyActiveBoards() {
+  bool expectedBoards[RS485_COMM_MAX_BOARDS];
+  for (int i = 0; i < RS485_COMM_MAX_BOARDS; i++) {
+    expectedBoards[i] = m_activeBoards[i];
+    m_activeBoards[i] = false;
+  }
+
+  // Let the boards synchronize themselves to the RS485 bus.
+  Event nullEvent(EVENT_NULL);
+  SendEvent(&nullEvent);
+  SendEvent(&nullEvent);
+  Event pingEvent(EVENT_PING);
+  SendEvent(&pingEvent);
+  // Wait before continuing.
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+  bool allFound = true;
+  for (int i = 0; i < RS485_COMM_MAX_BOARDS; i++) {
+    if (expectedBoards[i]) {
+      PollEvents(i);
+      allFound &= m_activeBoards[i];
+    }
+  }
+
+  return allFound;
+}
+
+// Requests the capabilities of all boards found and returns the ones that all
+// of them have in common.
+uint16_t RS485Comm::RequestCapabilities() {
+  uint16_t capabilities = 0xffff;
+  bool boardsFound = false;
+  for (int i = 0; i < RS485_COMM_MAX_BOARDS; i++) {
+    if (m_activeBoards[i]) {
+      m_boardCapabilities[i] = 0;
+      Event capabilitiesEvent(EVENT_CAPABILITIES, 1, i);
+      SendEvent(&capabilitiesEvent);
+      PollEvents(i);
+      capabilities &= m_boardCapabilities[i];
+      boardsFound = true;
+    }
+  }
+
+  return boardsFound ? capabilities : 0;
+}
+
+// Switches the bus to the highest baud rate up to m_maxBaudRate that is
+// supported by all boards. All boards listen to the bus, so a single board
+// without support keeps the whole bus at the configured baud rate.
+void RS485Comm::NegotiateBaudRate(uint16_t capabilities) {
+  static const struct {
+    int baudRate;
+    uint16_t capability;
+    uint8_t code;
+  } baudRates[] = {
+      {1000000, PPUC_CAPABILITY_BAUD_1000000, BAUD_RATE_CODE_1000000},
+      {500000, PPUC_CAPABILITY_BAUD_500000, BAUD_RATE_CODE_500000},
+      {250000, PPUC_CAPABILITY_BAUD_250000, BAUD_RATE_CODE_250000},
+  };
+
+  for (const auto& baudRate : baudRates) {
+    if (baudRate.baudRate > m_maxBaudRate || baudRate.baudRate <= m_baudRate ||
+        !(capabilities & baudRate.capability)) {
+      continue;
+    }
+
+    Event baudRateEvent(EVENT_BAUD_RATE, baudRate.code, 0);
+    SendEvent(&baudRateEvent);
+    m_pTransport->Drain();
+    m_timer.SleepFor(
+        std::chrono::milliseconds(RS485_COMM_BAUD_RATE_SWITCH_DELAY));
+    SetPortBaudRate(baudRate.baudRate);
+
+    if (VerifyActiveBoards()) {
+      LogMessage("RS485Comm: switched bus to %d baud", m_baudRate);
+      return;
+    }
+
+    LogMessage(
+        "RS485Comm: not all boards responded at %d baud, falling back to %d "
+        "baud",
+        m_baudRate, m_configuredBaudRate);
+
+    Event defaultBaudRateEvent(EVENT_BAUD_RATE, BAUD_RATE_CODE_DEFAULT, 0);
+    SendEvent(&defaultBaudRateEvent);
+    m_pTransport->Drain();
+    SetPortBaudRate(m_configuredBaudRate);
+    // Boards that missed the switch back fall back on their own.
+    std::this_thread::sleep_for(
+        std::chrono::milliseconds(RS485_COMM_BAUD_RATE_FALLBACK_TIMEOUT));
+    VerifyActiveBoards();
+    return;
+  }
+}
+
+// Switches the bus to frames with checksums. Like the baud rate this has to
+// be supported by all boards of the bus. CRC-16 is preferred over CRC-8.
+void RS485Comm::NegotiateCrc(uint16_t capabilities) {
+  uint8_t crcMode = CRC_MODE_NONE;
+  if (capabilities & PPUC_CAPABILITY_CRC16) {
+    crcMode = CRC_MODE_CRC16;
+  } else if (capabilities & PPUC_CAPABILITY_CRC8) {
+    crcMode = CRC_MODE_CRC8;
+  } else {
+    LogMessage("RS485Comm: not all boards support checksums");
+    return;
+  }
+
+  Event crcModeEvent(EVENT_CRC_MODE, crcMode, 0);
+  SendEvent(&crcModeEvent);
+  m_pTransport->Drain();
+  m_crcMode = crcMode;
+
+  if (VerifyActiveBoards()) {
+    LogMessage("RS485Comm: switched bus to CRC-%d frames",
+               crcMode == CRC_MODE_CRC16 ? 16 : 8);
+    return;
+  }
+
+  LogMessage(
+      "RS485Comm: not all boards responded using checksums, falling back");
+  Event noCrcModeEvent(EVENT_CRC_MODE, CRC_MODE_NONE, 0);
+  SendEvent(&noCrcModeEvent);
+  m_pTransport->Drain();
+  m_crcMode = CRC_MODE_NONE;
+  VerifyActiveBoards();
+}
+
+// Unlike the baud rate and the checksums, switch bank frames are enabled per
+// board. Boards without support keep sending a frame per switch change.
+void RS485Comm::NegotiateSwitchBank() {
+  for (int i = 0; i < RS485_COMM_MAX_BOARDS; i++) {
+    if (m_activeBoards[i] &&
+        (m_boardCapabilities[i] & PPUC_CAPABILITY_SWITCH_BANK)) {
+      Event switchBankEvent(EVENT_SWITCH_BANK, 1, i);
+      SendEvent(&switchBankEvent);
+      if (m_debug) {
+        LogMessage("RS485Comm: enabled switch bank frames for i/o board %d",
+                   i);
+      }
+    }
+  }
+  m_pTransport->Drain();
+}
+
+bool RS485Comm::RegisterLedStripe(uint8_t board, uint8_t port,
+                                  uint16_t amount, bool white,
+                                  uint8_t airtimeShare) {
+  if (board >= RS485_COMM_MAX_BOARDS ||
+      !(m_boardCapabilities[board] & PPUC_CAPABILITY_LED_FRAME)) {
+    LogMessage("RS485Comm: i/o board %d does not support LED frames", board);
+    return false;
+  }
+
+  m_ledStripes.push_back(
+      new LedStripe(board, port, amount, white, airtimeShare));
+
+  return true;
+}
+
+bool RS485Comm::SetLedFrame(uint8_t board, uint8_t port,
+                            const uint32_t* colors, uint16_t count,
+                            uint16_t first) {
+  for (LedStripe* ledStripe : m_ledStripes) {
+    if (ledStripe->GetBoard() == board && ledStripe->GetPort() == port) {
+      return ledStripe->SetFrame(colors, count, first);
+    }
+  }
+
+  return false;
+}
+
+void RS485Comm::RegisterSwitchBoard(uint8_t number) {
+  if (number < RS485_COMM_MAX_BOARDS &&
+      m_switchBoardCounter < RS485_COMM_MAX_BOARDS) {
+    m_switchBoards[m_switchBoardCounter++] = number;
+  }
+}
+
+uint8_t RS485Comm::GetActiveBoardCount() {
+  uint8_t count = 0;
+  for (int i = 0; i < RS485_COMM_MAX_BOARDS; i++) {
+    if (m_activeBoards[i]) {
+      count++;
+    }
+  }
+
+  return count;
+}
+
+bool RS485Comm::IsBoardActive(uint8_t board) {
+  return board < RS485_COMM_MAX_BOARDS && m_activeBoards[board];
+}
+
+void RS485Comm::SetSwitchCallback(PPUC_SwitchCallback callback,
+                                  const void* userData) {
+  m_switchCallback = callback;
+  m_switchUserData = userData;
+}
+
+void RS485Comm::SetBoardStateCallback(PPUC_BoardStateCallback callback,
+                                      const void* userData) {
+  m_boardStateCallback = callback;
+  m_boardStateUserData = userData;
+}
+
+void RS485Comm::SetBoardEventCallback(PPUC_BoardEventCallback callback,
+                                      const void* userData) {
+  m_boardEventCallback = callback;
+  m_boardEventUserData = userData;
+}
+
+bool RS485Comm::IsSolenoidFaulted(uint16_t number) {
+  return number < RS485_COMM_MAX_SOLENOIDS && m_faultedSolenoids[number];
+}
+
+void RS485Comm::ClearSolenoidFault(uint16_t number) {
+  if (number < RS485_COMM_MAX_SOLENOIDS) {
+    m_faultedSolenoids[number] = false;
+  }
+}
+
+void RS485Comm::AddSwitchRule(const PPUCSwitchRule& rule,
+                              RS485Comm* pTarget) {
+  RS485SwitchRule switchRule;
+  switchRule.rule = rule;
+  switchRule.pTarget = pTarget;
+  m_switchRules.push_back(switchRule);
+}
+
+void RS485Comm::SetSwitchRuleCallback(PPUC_SwitchRuleCallback callback,
+                                      const void* userData) {
+  m_switchRuleCallback = callback;
+  m_switchRuleUserData = userData;
+}
+
+void RS485Comm::ConfigureSwitchFilter(uint16_t number, uint16_t debounce,
+                                      uint16_t maxRate, bool quarantine) {
+  m_switchFilter.Configure(number, debounce, maxRate, quarantine);
+}
+
+void RS485Comm::ConfigureIntensity(uint8_t sourceId, uint16_t number,
+                                   uint16_t levels, uint8_t hysteresis,
+                                   uint16_t maxRate) {
+  m_intensityFilter.Configure(sourceId, number, levels, hysteresis, maxRate);
+}
+
+void RS485Comm::SetIntensity(uint8_t sourceId, uint16_t number,
+                             uint8_t intensity) {
+  m_intensityFilter.Set(sourceId, number, intensity);
+}
+
+bool RS485Comm::IsSwitchQuarantined(uint16_t number) {
+  return m_switchFilter.IsQuarantined(number);
+}
+
+void RS485Comm::ReleaseSwitch(uint16_t number) {
+  m_switchFilter.Release(number);
+}
+
+void RS485Comm::FireSwitchRules(uint16_t number, uint8_t state) {
+  if (m_switchRules.empty() || number >= SWITCH_BANK_MAX_SWITCHES) {
+    return;
+  }
+
+  // The first state reported for a switch is its initial state, like a ball
+  // resting in a saucer after EVENT_READ_SWITCHES or the first switch bank
+  // frame. Only real edges fire rules.
+  uint8_t mask = (uint8_t)(1 << (number % 8));
+  bool known = m_ruleSwitchesKnown[number / 8] & mask;
+  bool changed = ((m_ruleSwitchStates[number / 8] & mask) != 0) != (state != 0);
+  m_ruleSwitchesKnown[number / 8] |= mask;
+  if (state) {
+    m_ruleSwitchStates[number / 8] |= mask;
+  } else {
+    m_ruleSwitchStates[number / 8] &= ~mask;
+  }
+  if (!known || !changed) {
+    return;
+  }
+
+  for (RS485SwitchRule& switchRule : m_switchRules) {
+    const PPUCSwitchRule& rule = switchRule.rule;
+    if (rule.switchNumber != number || rule.switchState != state) {
+      continue;
+    }
+
+    uint64_t tick = GetTick(std::chrono::steady_clock::now());
+    if (switchRule.fired && tick - switchRule.lastFired < rule.recycle) {
+      continue;
+    }
+    switchRule.fired = true;
+    switchRule.lastFired = tick;
+
+    switchRule.pTarget->QueueUrgentPulse(
+        new Event(EVENT_SOURCE_SOLENOID, rule.solenoid, 1),
+        new Event(EVENT_SOURCE_SOLENOID, rule.solenoid, 0), rule.duration);
+    m_switchRulesFired++;
+
+    if (m_debug) {
+      LogMessage("RS485Comm: switch %d fired solenoid %d for %dms", number,
+                 rule.solenoid, rule.duration);
+    }
+    if (m_switchRuleCallback) {
+      (*(m_switchRuleCallback))(&rule, m_switchRuleUserData);
+    }
+  }
+}
+
+void RS485Comm::PushSwitchState(uint16_t number, uint8_t state) {
+  // Rules first, the host gets told after the fact.
+  FireSwitchRules(number, state);
+  // Queue first, the callback might take the state from the queue.
+  m_switchesQueueMutex.lock();
+  m_switches.push(new PPUCSwitchState(number, state));
+  m_switchesQueueMutex.unlock();
+  if (m_switchCallback) {
+    (*(m_switchCallback))(number, state, m_switchUserData);
+  }
+}
+
+void RS485Comm::PollSwitchFilter() {
+  m_switchFilter.Poll(GetTick(std::chrono::steady_clock::now()),
+                      m_debouncedSwitches);
+  for (const PPUCSwitchState& switchState : m_debouncedSwitches) {
+    PushSwitchState(switchState.number, switchState.state);
+  }
+  m_debouncedSwitches.clear();
+}
+
+PPUCSwitchState* RS485Comm::GetNextSwitchState() {
+  PPUCSwitchState* switchState = nullptr;
+
+  m_switchesQueueMutex.lock();
+
+  if (!m_switches.empty()) {
+    switchState = m_switches.front();
+    m_switches.pop();
+  }
+
+  m_switchesQueueMutex.unlock();
+
+  return switchState;
+}
+
+bool RS485Comm::SendConfigEvent(ConfigEvent* event) {
+  // Wait a bit to not exceed the output buffer in case of large configurations.
+  m_timer.SleepFor(std::chrono::milliseconds(5));
+
+  if (m_pTransport == NULL || !m_pTransport->IsOpen()) {
+    delete event;
+    return false;
+  }
+
+  if (m_journalConfig && event->boardId < RS485_COMM_MAX_BOARDS) {
+    m_configJournal[event->boardId].push_back(*event);
+  }
+
+  if (m_crcMode != CRC_MODE_NONE && event->boardId < RS485_COMM_MAX_BOARDS &&
+      m_activeBoards[event->boardId]) {
+    // ConfigEvents to boards using checksums get acknowledged. Keep them until
+    // the board confirmed them.
+    std::vector<ConfigEvent*>& window = m_configWindows[event->boardId];
+    if (window.size() == RS485_COMM_CONFIG_ACK_WINDOW) {
+      FlushConfigEvents(event->boardId);
+    }
+    window.push_back(event);
+    return WriteConfigEvent(event, (uint8_t)(window.size() - 1));
+  }
+
+  bool result = WriteConfigEvent(event, 0);
+  delete event;
+
+  return result;
+}
+
+bool RS485Comm::WriteConfigEvent(ConfigEvent* event, uint8_t sequence) {
+  uint8_t msg[RS485_COMM_CONFIG_FRAME_SIZE_MAX];
+  size_t size = WithCrcMode(m_crcMode, [&](auto mode) {
+    return EncodeConfigEventFrame<decltype(mode)::value>(msg, sequence, *event);
+  });
+  int written = WriteFrames(msg, size);
+  if (written < 0) {
+    m_portLost = true;
+  } else if (written == (int)size) {
+    if (m_debug) {
+      LogFrame("sent ConfigEvent", msg, size);
+    }
+    return true;
+  }
+
+  if (m_debug) {
+    LogFrame("error when sending ConfigEvent", msg, size);
+  }
+
+  return false;
+}
+
+// Sends all ConfigEvents still waiting for their acknowledgement.
+bool RS485Comm::FlushConfigEvents() {
+  bool result = true;
+  for (int i = 0; i < RS485_COMM_MAX_BOARDS; i++) {
+    result &= FlushConfigEvents(i);
+  }
+
+  return result;
+}
+
+// Requests the acknowledgement of the ConfigEvents sent to a board and
+// retransmits the ones that got lost or corrupted.
+bool RS485Comm::FlushConfigEvents(uint8_t board) {
+  std::vector<ConfigEvent*>& window = m_configWindows[board];
+  if (window.empty()) {
+    return true;
+  }
+
+  uint32_t pending = (((uint32_t)1) << window.size()) - 1;
+  for (int attempt = 0; attempt <= RS485_COMM_CONFIG_RETRIES && pending;
+       attempt++) {
+    if (attempt > 0) {
+      for (size_t i = 0; i < window.size(); i++) {
+        if (pending & (((uint32_t)1) << i)) {
+          WriteConfigEvent(window[i], (uint8_t)i);
+          m_retransmits++;
+        }
+      }
+    }
+
+    m_configAck = 0;
+    Event ackEvent(EVENT_CONFIG_ACK, 1, board);
+    SendEvent(&ackEvent);
+    PollEvents(board);
+    pending &= ~m_configAck;
+  }
+
+  if (pending) {
+    int missing = 0;
+    for (size_t i = 0; i < window.size(); i++) {
+      if (pending & (((uint32_t)1) << i)) {
+        missing++;
+      }
+    }
+    LogMessage("RS485Comm: board %d did not acknowledge %d ConfigEvents",
+               board, missing);
+  }
+
+  for (ConfigEvent* event : window) {
+    delete event;
+  }
+  window.clear();
+
+  return pending == 0;
+}
+
+size_t RS485Comm::GetEventFrameSize() {
+  return WithCrcMode(m_crcMode, [](auto mode) {
+    return RS485FrameLayout<decltype(mode)::value>::kEventSize;
+  });
+}
+
+// Sends a batch of events with a single write.
+int RS485Comm::WriteFrames(const uint8_t* msg, size_t size) {
+  PPUC_TRACE1(write_start, size);
+  int written = m_pTransport->Write(msg, size, GetWriteTimeout(size));
+  PPUC_TRACE2(write_end, size, written);
+
+  return written;
+}
+
+int RS485Comm::WriteFrames(const SerialBuffer* buffers, size_t count,
+                           size_t size) {
+  PPUC_TRACE1(write_start, size);
+  int written = m_pTransport->Writev(buffers, count, GetWriteTimeout(size));
+  PPUC_TRACE2(write_end, size, written);
+
+  return written;
+}
+
+bool RS485Comm::SendEvents(Event** events, size_t count) {
+  if (m_pTransport == NULL || !m_pTransport->IsOpen()) {
+    return false;
+  }
+
+  // Batches larger than the buffer, like frames, are written in chunks.
+  uint8_t msg[RS485_COMM_MAX_EVENTS_TO_SEND * RS485_COMM_EVENT_FRAME_SIZE_MAX];
+  while (count > 0) {
+    size_t encoded = 0;
+    size_t size = WithCrcMode(m_crcMode, [&](auto mode) {
+      return EncodeEventFrames<decltype(mode)::value>(msg, sizeof(msg), events,
+                                                      count, &encoded);
+    });
+
+    int written = WriteFrames(msg, size);
+    if (written < 0) {
+      m_portLost = true;
+      return false;
+    } else if (written != (int)size) {
+      return false;
+    }
+
+    if (m_debug) {
+      for (size_t i = 0; i < encoded; i++) {
+        LogMessage("RS485Comm: sent Event %d %d %d", events[i]->sourceId,
+                   events[i]->eventId, events[i]->value);
+      }
+    }
+    events += encoded;
+    count -= encoded;
+  }
+
+  return true;
+}
+
+// Sends at most one LED frame per stripe, so LED updates don't delay events
+// and switch polling for too long. The frames of all stripes are submitted
+// with a single write.
+void RS485Comm::SendLedFrames() {
+  if (m_pTransport == NULL || !m_pTransport->IsOpen()) {
+    return;
+  }
+
+  m_ledFrames.resize(m_ledStripes.size() * RS485_COMM_LED_FRAME_SIZE_MAX);
+  m_ledBuffers.clear();
+  m_ledSentStripes.clear();
+  size_t total = 0;
+  for (LedStripe* ledStripe : m_ledStripes) {
+    if (!ledStripe->IsReady()) {
+      continue;
+    }
+
+    uint8_t* msg = m_ledFrames.data() +
+                   m_ledBuffers.size() * RS485_COMM_LED_FRAME_SIZE_MAX;
+    size_t length = ledStripe->EncodeRuns(
+        msg + RS485FrameLayout<CRC_MODE_NONE>::kLedFrameHeaderSize,
+        RS485_COMM_LED_FRAME_PAYLOAD_MAX);
+    if (length == 0) {
+      continue;
+    }
+
+    size_t size = WithCrcMode(m_crcMode, [&](auto mode) {
+      return EncodeLedFrame<decltype(mode)::value>(
+          msg, ledStripe->GetBoard(), ledStripe->GetPort(), (uint8_t)length);
+    });
+    m_ledBuffers.push_back({msg, size});
+    m_ledSentStripes.push_back(ledStripe);
+    total += size;
+  }
+
+  if (m_ledBuffers.empty()) {
+    return;
+  }
+
+  int written = WriteFrames(m_ledBuffers.data(), m_ledBuffers.size(), total);
+  if (written < 0) {
+    m_portLost = true;
+    return;
+  }
+
+  for (size_t i = 0; i < m_ledBuffers.size(); i++) {
+    m_ledSentStripes[i]->Transmitted(m_ledBuffers[i].size, m_baudRate);
+
+    if (m_debug) {
+      const uint8_t* msg = m_ledBuffers[i].data;
+      LogMessage("RS485Comm: sent LED frame %d %d, %d bytes", msg[2], msg[3],
+                 (int)m_ledBuffers[i].size);
+    }
+  }
+}
+
+bool RS485Comm::SendEvent(Event* event) {
+  if (m_pTransport != NULL && m_pTransport->IsOpen()) {
+    uint8_t msg[RS485_COMM_EVENT_FRAME_SIZE_MAX];
+    size_t size = WithCrcMode(m_crcMode, [&](auto mode) {
+      return EncodeEventFrame<decltype(mode)::value>(msg, *event);
+    });
+
+    int written = WriteFrames(msg, size);
+    if (written < 0) {
+      m_portLost = true;
+    } else if (written == (int)size) {
+      if (m_debug) {
+        LogMessage("RS485Comm: sent Event %d %d %d", event->sourceId,
+                   event->eventId, event->value);
+      }
+      return true;
+    }
+  }
+
+  return false;
+}
+
+Event* RS485Comm::receiveEvent() {
+  if (m_pTransport != NULL && m_pTransport->IsOpen()) {
+    size_t frameSize = GetEventFrameSize();
+    uint8_t msg[RS485_COMM_EVENT_FRAME_SIZE_MAX];
+
+    // The timeout when waiting for an I/O board event depends on the baud
+    // rate. The RS485 converter on the board itself requires some time to
+    // toggle send/receive mode.
+    std::chrono::steady_clock::time_point deadline =
+        std::chrono::steady_clock::now() +
+        std::chrono::microseconds(m_receiveTimeout);
+
+    while (std::chrono::steady_clock::now() < deadline) {
+      if (!m_pTransport->WaitForInput(frameSize - 1, deadline)) {
+        if (m_pTransport->InputWaiting() < 0) {
+          // The port is gone, for example if the USB adapter got unplugged.
+          m_portLost = true;
+          return nullptr;
+        }
+      } else {
+        m_pTransport->Read(msg, 1, RS485_COMM_SERIAL_READ_TIMEOUT);
+        if (msg[0] == kFrameStart) {
+          PPUC_TRACE0(rx_start);
+          int read =
+              m_pTransport->Read(msg + 1, 1, RS485_COMM_SERIAL_READ_TIMEOUT);
+          if (read == 1 && msg[1] == EVENT_SWITCH_BANK) {
+            if (ReceiveSwitchBank()) {
+              m_receivedFrames++;
+              continue;
+            }
+          } else if (read == 1 &&
+                     m_pTransport->Read(msg + 2, frameSize - 2,
+                                        RS485_COMM_SERIAL_READ_TIMEOUT) ==
+                         (int)(frameSize - 2)) {
+            RS485EventFrame frame;
+            int decoded = WithCrcMode(m_crcMode, [&](auto mode) {
+              return DecodeEventFrame<decltype(mode)::value>(msg, frame);
+            });
+            uint8_t sourceId = frame.sourceId;
+            uint16_t eventId = frame.eventId;
+            uint8_t value = frame.value;
+
+            if (decoded != RS485_DECODE_STOP_BYTES) {
+              // The frame is complete, so we're still in sync even if its
+              // content is invalid.
+              m_receivedFrames++;
+              if (decoded == RS485_DECODE_CRC) {
+                m_crcErrors++;
+                if (m_debug) {
+                  LogMessage("RS485Comm: received event with wrong checksum");
+                }
+              } else if (!IsLegalEventFrame(frame)) {
+                if (m_debug) {
+                  LogMessage("RS485Comm: received illegal Event %d %d %d",
+                             sourceId, eventId, value);
+                }
+              } else {
+                if (m_debug) {
+                  LogMessage("RS485Comm: received Event %d %d %d", sourceId,
+                             eventId, value);
+                }
+                PPUC_TRACE3(frame_decoded, sourceId, eventId, value);
+                return new Event(sourceId, eventId, value);
+              }
+              continue;
+            }
+
+            if (m_debug) {
+              LogMessage("RS485Comm: received wrong stop bytes %d %d",
+                         msg[frameSize - 2], msg[frameSize - 1]);
+            }
+          }
+
+          // Something went wrong after the start byte, try to get back in sync.
+          m_resyncs++;
+          PPUC_TRACE0(resync);
+          while (m_pTransport->InputWaiting() > 0) {
+            if (m_debug) {
+              LogMessage("RS485Comm: lost sync, %d bytes remaining",
+                         m_pTransport->InputWaiting());
+            }
+            uint8_t stopByte;
+            m_pTransport->Read(&stopByte, 1, RS485_COMM_SERIAL_READ_TIMEOUT);
+            if (stopByte == kFrameStop1) {
+              m_pTransport->Read(&stopByte, 1, RS485_COMM_SERIAL_READ_TIMEOUT);
+              if (stopByte == kFrameStop2) {
+                // Now we should be back in sync.
+                break;
+              }
+            }
+          }
+        }
+      }
+    }
+    m_timeouts++;
+    PPUC_TRACE0(timeout);
+    if (m_debug) {
+      LogMessage("RS485Comm: timeout when waiting for events from i/o boards");
+    }
+  } else if (m_debug) {
+    LogMessage("RS485Comm: RS485 error");
+  }
+
+  return nullptr;
+}
+
+// Reads the rest of a switch bank frame after its source byte and turns the
+// bitmap into switch changes. Returns false if the frame is broken and the
+// caller has to resync.
+bool RS485Comm::ReceiveSwitchBank() {
+  uint8_t msg[RS485_COMM_SWITCH_BANK_FRAME_SIZE_MAX];
+  msg[0] = kFrameStart;
+  msg[1] = EVENT_SWITCH_BANK;
+  if (m_pTransport->Read(msg + 2, 4, RS485_COMM_SERIAL_READ_TIMEOUT) != 4) {
+    return false;
+  }
+
+  uint8_t board = msg[2];
+  uint16_t first = ((uint16_t)msg[3]) << 8 | msg[4];
+  uint8_t length = msg[5];
+  if (first % 8 != 0 || length > RS485_COMM_SWITCH_BANK_LENGTH_MAX) {
+    if (m_debug) {
+      LogMessage("RS485Comm: received invalid switch bank %d %d", first,
+                 length);
+    }
+    return false;
+  }
+
+  size_t frameSize = WithCrcMode(m_crcMode, [&](auto mode) {
+    return RS485FrameLayout<decltype(mode)::value>::SwitchBankFrameSize(
+        length);
+  });
+  size_t remaining = frameSize - 6;
+  // The bitmap might take longer to arrive than a single event frame.
+  if (m_pTransport->Read(msg + 6, remaining,
+                         RS485_COMM_SERIAL_READ_TIMEOUT +
+                             GetWriteTimeout(remaining)) != (int)remaining) {
+    return false;
+  }
+
+  int decoded = WithCrcMode(m_crcMode, [&](auto mode) {
+    return DecodeSwitchBankFrame<decltype(mode)::value>(msg);
+  });
+  if (decoded == RS485_DECODE_STOP_BYTES) {
+    if (m_debug) {
+      LogMessage("RS485Comm: received switch bank with wrong stop bytes %d %d",
+                 msg[frameSize - 2], msg[frameSize - 1]);
+    }
+    return false;
+  }
+  if (decoded == RS485_DECODE_CRC) {
+    m_crcErrors++;
+    if (m_debug) {
+      LogMessage("RS485Comm: received switch bank with wrong checksum");
+    }
+    return true;
+  }
+
+  m_switchBankChanges.clear();
+  if (!m_switchBank.Apply(first, msg + 6, length, m_switchBankChanges)) {
+    if (m_debug) {
+      LogMessage("RS485Comm: received switch bank out of range %d %d", first,
+                 length);
+    }
+    return true;
+  }
+
+  PPUC_TRACE3(switch_bank, board, first, m_switchBankChanges.size());
+  if (m_debug) {
+    LogMessage("RS485Comm: received switch bank of board %d, %d changes",
+               board, (int)m_switchBankChanges.size());
+  }
+  for (const PPUCSwitchState& change : m_switchBankChanges) {
+    FilterSwitchState(change.number, change.state);
+  }
+
+  return true;
+}
+
+void RS485Comm::FilterSwitchState(uint16_t number, uint8_t state) {
+  uint32_t flagged = m_switchFilter.GetFlaggedSwitches();
+  if (m_switchFilter.Process(number, state,
+                             GetTick(std::chrono::steady_clock::now()))) {
+    PushSwitchState(number, state);
+  }
+  if (m_switchFilter.GetFlaggedSwitches() != flagged) {
+    LogMessage("RS485Comm: switch %d exceeds its edge rate%s", number,
+               m_switchFilter.IsQuarantined(number) ? ", quarantined" : "");
+  }
+}
+
+bool RS485Comm::IsSwitchBoard(uint8_t board) {
+  for (int i = 0; i < m_switchBoardCounter; i++) {
+    if (m_switchBoards[i] == board) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// Switch boards are checked by their regular polls. The other active boards
+// and the unresponsive ones that are due get polled one at a time, so a check
+// costs one receive timeout at most.
+void RS485Comm::CheckBoardHealth() {
+  uint64_t now = GetTick(std::chrono::steady_clock::now());
+  if (now < m_nextHealthCheck) {
+    return;
+  }
+  m_nextHealthCheck = now + RS485_COMM_HEALTH_CHECK_INTERVAL;
+
+  for (int i = 0; i < RS485_COMM_MAX_BOARDS; i++) {
+    uint8_t board = m_healthCheckBoard;
+    m_healthCheckBoard = (m_healthCheckBoard + 1) % RS485_COMM_MAX_BOARDS;
+
+    if (m_unresponsiveBoards[board]) {
+      if (now < m_boardReprobes[board]) {
+        continue;
+      }
+      m_boardReprobes[board] = now + RS485_COMM_BOARD_REPROBE_INTERVAL;
+    } else if (!m_activeBoards[board] || IsSwitchBoard(board)) {
+      continue;
+    }
+
+    UpdateBoardHealth(board, PollEvents(board));
+    return;
+  }
+}
+
+void RS485Comm::UpdateBoardHealth(uint8_t board, bool responded) {
+  if (m_portLost) {
+    // Not the board's fault.
+    return;
+  }
+
+  if (responded) {
+    m_boardTimeouts[board] = 0;
+    if (m_unresponsiveBoards[board]) {
+      RecoverBoard(board);
+    }
+    return;
+  }
+
+  if (m_unresponsiveBoards[board] ||
+      ++m_boardTimeouts[board] < RS485_COMM_BOARD_TIMEOUTS_MAX) {
+    return;
+  }
+
+  m_activeBoards[board] = false;
+  m_unresponsiveBoards[board] = true;
+  m_unresponsiveBoardCount++;
+  m_boardReprobes[board] = GetTick(std::chrono::steady_clock::now()) +
+                           RS485_COMM_BOARD_REPROBE_INTERVAL;
+  LogMessage(
+      "RS485Comm: i/o board %d is not responding, probing it every %d ms",
+      board, RS485_COMM_BOARD_REPROBE_INTERVAL);
+  ReportBoardState(board, PPUC_BOARD_STATE_UNRESPONSIVE);
+}
+
+// A board that responds again might have rebooted in the meantime. That is
+// detected by its session token, like after a reconnect. A rebooted board
+// only responds again if the bus still runs at the default settings.
+void RS485Comm::RecoverBoard(uint8_t board) {
+  m_unresponsiveBoards[board] = false;
+  m_unresponsiveBoardCount--;
+  m_activeBoards[board] = true;
+
+  m_boardSessions[board] = 0;
+  Event sessionEvent(EVENT_CONFIG_SESSION, 0, board);
+  SendEvent(&sessionEvent);
+  PollEvents(board);
+
+  if (m_boardSessions[board] != m_sessionToken) {
+    LogMessage("RS485Comm: i/o board %d rebooted, sending configuration",
+               board);
+    ReplayConfigJournal(board);
+    if (m_boardCapabilities[board] & PPUC_CAPABILITY_SWITCH_BANK) {
+      Event switchBankEvent(EVENT_SWITCH_BANK, 1, board);
+      SendEvent(&switchBankEvent);
+    }
+  }
+
+  // Switch changes got lost while the board wasn't polled.
+  Event readSwitchesEvent(EVENT_READ_SWITCHES);
+  SendEvent(&readSwitchesEvent);
+
+  LogMessage("RS485Comm: i/o board %d is responding again", board);
+  ReportBoardState(board, PPUC_BOARD_STATE_ACTIVE);
+}
+
+void RS485Comm::ReportBoardState(uint8_t board, uint8_t state) {
+  if (m_boardStateCallback) {
+    (*(m_boardStateCallback))(board, state, m_boardStateUserData);
+  }
+}
+
+bool RS485Comm::PollEvents(int board) {
+  if (m_debug) {
+    LogMessage("RS485Comm: polling board %d ...", board);
+  }
+
+  // Any complete frame counts as a response, even if it is invalid or a
+  // switch bank frame that doesn't surface as an event.
+  uint32_t receivedFrames = m_receivedFrames;
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  Event* event = new Event(EVENT_POLL_EVENTS, 1, board);
+  PPUC_TRACE1(poll_send, board);
+  if (SendEvent(event)) {
+    // Wait until the i/o board switched to RS485 send mode.
+    m_timer.SleepFor(std::chrono::microseconds(m_modeSwitchDelay));
 
     bool null_event = false;
     Event* event_recv;
@@ -363,10 +1729,16 @@ void RS485Comm::PollEvents(int board) {
       switch (event_recv->sourceId) {
         case EVENT_PONG:
           if ((int)event_recv->value < RS485_COMM_MAX_BOARDS) {
-            m_activeBoards[(int)event_recv->value] = true;
-            if (m_debug) {
-              // @todo user logger
-              printf("Found i/o board %d\n", (int)event_recv->value);
+            if (m_unresponsiveBoards[(int)event_recv->value]) {
+              // Recovered after the poll, like a board answering a
+              // re-probe.
+              m_pongedBoards |= 1 << event_recv->value;
+            } else {
+              m_activeBoards[(int)event_recv->value] = true;
+              if (m_debug) {
+                LogMessage("RS485Comm: found i/o board %d",
+                           (int)event_recv->value);
+              }
             }
           }
           break;
@@ -375,23 +1747,165 @@ void RS485Comm::PollEvents(int board) {
           null_event = true;
           break;
 
+        case EVENT_CAPABILITIES:
+          if ((int)event_recv->value < RS485_COMM_MAX_BOARDS) {
+            m_boardCapabilities[(int)event_recv->value] = event_recv->eventId;
+          }
+          break;
+
+        case EVENT_CONFIG_SESSION:
+          if ((int)event_recv->value < RS485_COMM_MAX_BOARDS) {
+            m_boardSessions[(int)event_recv->value] = event_recv->eventId;
+          }
+          break;
+
+        case EVENT_CONFIG_ACK:
+          if ((int)event_recv->value == board) {
+            m_configAck |= event_recv->eventId;
+          }
+          break;
+
         case EVENT_SOURCE_SWITCH:
-          m_switchesQueueMutex.lock();
-          m_switches.push(
-              new PPUCSwitchState(event_recv->eventId, event_recv->value));
-          m_switchesQueueMutex.unlock();
+          m_switchBank.Update(event_recv->eventId, event_recv->value);
+          FilterSwitchState(event_recv->eventId, event_recv->value);
           break;
 
         default:
-          // @todo handle events like error reports, broken coils, ...
+          DecodeBoardEvent(board, event_recv);
           break;
       }
 
       delete event_recv;
     }
 
+    if (m_receivedFrames != receivedFrames &&
+        board < RS485_COMM_MAX_BOARDS) {
+      m_pollLatencies[board].Record(
+          (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(
+              std::chrono::steady_clock::now() - start)
+              .count());
+    }
+
     // Wait until the i/o board switched back to RS485 receive mode.
-    std::this_thread::sleep_for(
-        std::chrono::microseconds(RS485_MODE_SWITCH_DELAY));
+    m_timer.SleepFor(std::chrono::microseconds(m_modeSwitchDelay));
+
+    // The bus was blocked for the whole round trip, timeouts included.
+    m_airtime.ChargePoll(
+        (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start)
+            .count());
+  }
+
+  ReportBoardEvents();
+
+  // Recovering polls again, so the flags get cleared first.
+  uint16_t pongedBoards = m_pongedBoards;
+  m_pongedBoards = 0;
+  for (uint8_t i = 0; pongedBoards != 0; i++, pongedBoards >>= 1) {
+    if (pongedBoards & 1) {
+      UpdateBoardHealth(i, true);
+    }
+  }
+
+  return m_receivedFrames != receivedFrames;
+}
+
+void RS485Comm::DecodeBoardEvent(uint8_t board, Event* event) {
+  PPUCBoardEvent boardEvent;
+  boardEvent.board = board;
+
+  switch (event->sourceId) {
+    case EVENT_FAULT:
+      boardEvent.type = PPUC_BOARD_EVENT_FAULT;
+      boardEvent.code = event->value;
+      boardEvent.number = event->eventId;
+      if (event->value != PPUC_FAULT_CLEARED) {
+        m_faults++;
+      }
+      if (event->eventId < RS485_COMM_MAX_SOLENOIDS) {
+        bool faulted = event->value != PPUC_FAULT_CLEARED;
+        if (faulted && !m_faultedSolenoids[event->eventId]) {
+          if (m_faultReactions.empty()) {
+            m_faultReceived = std::chrono::steady_clock::now();
+          }
+          m_faultReactions.push_back(event->eventId);
+        }
+        m_faultedSolenoids[event->eventId] = faulted;
+      }
+      break;
+
+    case EVENT_TELEMETRY:
+      boardEvent.type = PPUC_BOARD_EVENT_TELEMETRY;
+      boardEvent.code = event->value;
+      boardEvent.value = event->eventId;
+      m_telemetryEvents++;
+      break;
+
+    default:
+      boardEvent.code = event->sourceId;
+      boardEvent.number = event->eventId;
+      boardEvent.value = event->value;
+      m_unknownEvents++;
+      break;
+  }
+
+  m_boardEvents.push_back(boardEvent);
+}
+
+void RS485Comm::ReportBoardEvents() {
+  if (!m_faultReactions.empty()) {
+    // The board might have switched the solenoid off already, but a command
+    // that is on the way must not turn it on again.
+    std::vector<Event*> events;
+    for (uint16_t number : m_faultReactions) {
+      events.push_back(new Event(EVENT_SOURCE_SOLENOID, number, 0));
+    }
+    SendEvents(events.data(), events.size());
+    for (Event* event : events) {
+      delete event;
+    }
+
+    uint32_t reaction =
+        (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - m_faultReceived)
+            .count();
+    if (reaction > m_faultReactionMax) {
+      m_faultReactionMax = reaction;
+    }
+    m_faultReactions.clear();
+  }
+
+  for (const PPUCBoardEvent& boardEvent : m_boardEvents) {
+    if (boardEvent.type == PPUC_BOARD_EVENT_FAULT) {
+      LogMessage("RS485Comm: board %d reports fault %d of solenoid %d",
+                 boardEvent.board, boardEvent.code, boardEvent.number);
+    }
+    if (m_boardEventCallback) {
+      (*(m_boardEventCallback))(&boardEvent, m_boardEventUserData);
+    }
   }
+  m_boardEvents.clear();
+}
+
+size_t RS485Comm::DropFaultedEvents(Event** events, size_t count) {
+  size_t kept = 0;
+  for (size_t i = 0; i < count; i++) {
+    Event* event = events[i];
+    if (event->sourceId == EVENT_SOURCE_SOLENOID &&
+        event->eventId < RS485_COMM_MAX_SOLENOIDS &&
+        m_faultedSolenoids[event->eventId]) {
+      // The off event of a pulse is dropped as well.
+      auto it = m_pulses.find(event);
+      if (it != m_pulses.end()) {
+        delete it->second.off;
+        m_pulses.erase(it);
+      }
+      delete event;
+      m_suppressedFaultEvents++;
+      continue;
+    }
+    events[kept++] = event;
+  }
+
+  return kept;
 }
@@ -3,15 +3,31 @@
 #include <inttypes.h>
 #include <stdarg.h>
 
+#include <atomic>
+#include <condition_variable>
 #include <cstdio>
 #include <cstring>
+#include <future>
+#include <map>
 #include <mutex>
 #include <queue>
+#include <string>
 #include <thread>
+#include <vector>
 
+#include "BusAirtime.h"
+#include "IntensityFilter.h"
+#include "LatencyHistogram.h"
+#include "LedStripe.h"
 #include "PPUC_structs.h"
+#include "PreciseTimer.h"
+#include "RS485Codec.h"
+#include "RS485Protocol.h"
+#include "SerialTransport.h"
+#include "SwitchBank.h"
+#include "SwitchFilter.h"
+#include "TimerWheel.h"
 #include "io-boards/Event.h"
-#include "libserialport.h"
 
 #if _MSC_VER
 #define CALLBACK __stdcall
@@ -21,9 +37,33 @@
 
 #define RS485_COMM_BAUD_RATE 115200
 #define RS485_COMM_SERIAL_READ_TIMEOUT 2
-#define RS485_COMM_SERIAL_WRITE_TIMEOUT 4
+// Additional time in ms on top of the transmission time of a frame before a
+// write times out.
+#define RS485_COMM_SERIAL_WRITE_TIMEOUT 3
+// Number of event frames the receive timeout is able to cover, including the
+// board's processing time, at the current baud rate.
+#define RS485_COMM_RECEIVE_TIMEOUT_FRAMES 12
+#define RS485_COMM_MIN_RECEIVE_TIMEOUT 2000
+// Time in ms the boards get to reconfigure their UART after a baud rate
+// switch and the time after which they fall back if they don't see valid
+// frames.
+#define RS485_COMM_BAUD_RATE_SWITCH_DELAY 20
+#define RS485_COMM_BAUD_RATE_FALLBACK_TIMEOUT 500
+// Time in ms between two attempts to reopen a lost serial port.
+#define RS485_COMM_RECONNECT_INTERVAL 100
 
 #define RS485_COMM_MAX_BOARDS 16
+// Consecutive polls without any response after which a board is considered
+// unresponsive. It is probed every RS485_COMM_BOARD_REPROBE_INTERVAL ms then,
+// instead of costing a receive timeout in every poll round.
+#define RS485_COMM_BOARD_TIMEOUTS_MAX 3
+#define RS485_COMM_BOARD_REPROBE_INTERVAL 1000
+// Time in ms between two health checks. Every check polls a single board
+// that isn't polled for switches anyway or is due for a re-probe.
+#define RS485_COMM_HEALTH_CHECK_INTERVAL 250
+
+// Faults are tracked for solenoid numbers below this limit.
+#define RS485_COMM_MAX_SOLENOIDS 256
 
 #if _MSC_VER
 #define RS485_COMM_MAX_SERIAL_WRITE_AT_ONCE 256
@@ -33,9 +73,50 @@
 #define RS485_COMM_MAX_SERIAL_WRITE_AT_ONCE 256
 #endif
 
+#define RS485_COMM_EVENT_FRAME_SIZE_MAX kEventFrameSizeMax
+#define RS485_COMM_CONFIG_FRAME_SIZE_MAX kConfigEventFrameSizeMax
+// Number of unacknowledged ConfigEvents per board in CRC mode and the number
+// of retransmissions before giving up.
+#define RS485_COMM_CONFIG_ACK_WINDOW 16
+#define RS485_COMM_CONFIG_RETRIES 3
+
+// Maximum number of bytes of the runs in a single LED frame, a multiple of the
+// RGB and RGBW run sizes.
+#define RS485_COMM_LED_FRAME_PAYLOAD_MAX 252
+#define RS485_COMM_LED_FRAME_SIZE_MAX         \
+  (RS485FrameLayout<CRC_MODE_CRC16>::LedFrameSize( \
+      RS485_COMM_LED_FRAME_PAYLOAD_MAX))
+
+// Switch bank frames cover up to SWITCH_BANK_MAX_SWITCHES switches.
+#define RS485_COMM_SWITCH_BANK_LENGTH_MAX (SWITCH_BANK_MAX_SWITCHES / 8)
+#define RS485_COMM_SWITCH_BANK_FRAME_SIZE_MAX          \
+  (RS485FrameLayout<CRC_MODE_CRC16>::SwitchBankFrameSize( \
+      RS485_COMM_SWITCH_BANK_LENGTH_MAX))
+
 #define RS485_COMM_QUEUE_SIZE_MAX 128
+// Time in ms QueueEvent() waits for space in a full queue with
+// PPUC_QUEUE_POLICY_BLOCK before it drops the event.
+#define RS485_COMM_QUEUE_BLOCK_TIMEOUT 100
 #define RS485_COMM_MAX_EVENTS_TO_SEND 32
 
+typedef void(CALLBACK* RS485Comm_SentCallback)(const void* userData);
+
+class RS485Comm;
+
+// The off event of a pulse gets scheduled once the on event got written.
+struct RS485Pulse {
+  Event* off;
+  uint32_t duration;
+};
+
+struct RS485SwitchRule {
+  PPUCSwitchRule rule;
+  // The bus of the solenoid, which might differ from the one of the switch.
+  RS485Comm* pTarget;
+  uint64_t lastFired = 0;
+  bool fired = false;
+};
+
 class RS485Comm {
  public:
   RS485Comm();
@@ -44,45 +125,284 @@ class RS485Comm {
   void SetLogMessageCallback(PPUC_LogMessageCallback callback,
                              const void* userData);
 
+  void SetBaudRate(int baudRate);
+  void SetMaxBaudRate(int maxBaudRate);
+  int GetBaudRate();
+  void SetTransport(uint8_t transport);
+  void SetCrc(bool crc);
+  uint8_t GetCrcMode();
+  // Percentage of the bus airtime reserved for switch polling.
+  void SetPollShare(uint8_t pollShare);
+  void SetQueuePolicy(uint8_t queuePolicy);
+  PPUCBusStatistics GetStatistics();
+  // Time in microseconds from sending a poll to the end of the board's
+  // response, per board.
+  LatencyHistogram* GetPollLatency(uint8_t board);
+  void ResetPollLatencies();
+
   bool Connect(const char* device);
   void Disconnect();
 
+  void SetThreadConfig(const PPUCThreadConfig& config);
+  int GetThreadConfigResult();
+
   void Run();
 
-  void QueueEvent(Event* event);
+  // Returns PPUC_QUEUE_FULL if the event got dropped.
+  uint8_t QueueEvent(Event* event);
+  // Queues the events in one step. The run thread sends them back to back,
+  // without switch polling in between. Either all events get queued or all
+  // get dropped.
+  uint8_t QueueFrame(Event** events, size_t count);
+  // Number of events queued so far and the number of them the run thread
+  // wrote to the bus. Scheduled events are not counted.
+  uint64_t GetQueuePosition();
+  uint64_t GetSentPosition();
+  // The callback is called by the run thread after it wrote events.
+  void SetSentCallback(RS485Comm_SentCallback callback, const void* userData);
+  // Queues the event in front of all other events. It is sent outside of the
+  // airtime budget, right after the current poll.
+  void QueueUrgentEvent(Event* event);
+  // Queues on like an urgent event and schedules off duration ms after on got
+  // written.
+  void QueueUrgentPulse(Event* on, Event* off, uint32_t duration);
+  // Sends the event at the given time, with a resolution of 1 ms.
+  void ScheduleEvent(Event* event, std::chrono::steady_clock::time_point at);
+  // Sends on at the given time and off duration ms after on got written, so
+  // the pulse width doesn't depend on the load of the bus.
+  void SchedulePulse(Event* on, Event* off, uint32_t duration,
+                     std::chrono::steady_clock::time_point at);
   bool SendConfigEvent(ConfigEvent* configEvent);
+  bool FlushConfigEvents();
+
+  // LED stripes have to be registered before Run() gets called.
+  bool RegisterLedStripe(uint8_t board, uint8_t port, uint16_t amount,
+                         bool white, uint8_t airtimeShare);
+  bool SetLedFrame(uint8_t board, uint8_t port, const uint32_t* colors,
+                   uint16_t count, uint16_t first);
 
   void RegisterSwitchBoard(uint8_t number);
+  uint8_t GetActiveBoardCount();
+  bool IsBoardActive(uint8_t board);
   PPUCSwitchState* GetNextSwitchState();
+  // The callback is called by the run thread for every switch change, in
+  // addition to queueing it.
+  void SetSwitchCallback(PPUC_SwitchCallback callback, const void* userData);
+  // The callback is called by the run thread if a board becomes unresponsive
+  // or recovers.
+  void SetBoardStateCallback(PPUC_BoardStateCallback callback,
+                             const void* userData);
+  // The callback is called by the run thread for faults and telemetry the
+  // boards report, after faulted solenoids got switched off.
+  void SetBoardEventCallback(PPUC_BoardEventCallback callback,
+                             const void* userData);
+  // The run thread drops all events of a faulted solenoid.
+  bool IsSolenoidFaulted(uint16_t number);
+  void ClearSolenoidFault(uint16_t number);
+  // Switch rules have to be added before Run() gets called. They are
+  // evaluated by the run thread for every switch change that passed the
+  // switch filter.
+  void AddSwitchRule(const PPUCSwitchRule& rule, RS485Comm* pTarget);
+  void SetSwitchRuleCallback(PPUC_SwitchRuleCallback callback,
+                             const void* userData);
+  void ConfigureSwitchFilter(uint16_t number, uint16_t debounce,
+                             uint16_t maxRate, bool quarantine);
+  bool IsSwitchQuarantined(uint16_t number);
+  void ReleaseSwitch(uint16_t number);
+
+  // Intensities of lamps and flashers are quantized and rate limited per
+  // output. The run thread sends the resulting events within the airtime
+  // budget, they are not counted by GetQueuePosition().
+  void ConfigureIntensity(uint8_t sourceId, uint16_t number, uint16_t levels,
+                          uint8_t hysteresis, uint16_t maxRate);
+  void SetIntensity(uint8_t sourceId, uint16_t number, uint8_t intensity);
 
   void SetDebug(bool debug);
 
  private:
   void LogMessage(const char* format, ...);
+  // Logs the bytes of a frame in hex after the given text.
+  void LogFrame(const char* text, const uint8_t* msg, size_t size);
+
+  int ApplyThreadConfig();
+
+  void SetPortBaudRate(int baudRate);
+  uint32_t GetTransmissionTime(size_t bytes);
+  uint32_t GetWriteTimeout(size_t bytes);
+  bool VerifyActiveBoards();
+  uint16_t RequestCapabilities();
+  void NegotiateBaudRate(uint16_t capabilities);
+  void NegotiateCrc(uint16_t capabilities);
+  void NegotiateSwitchBank();
+  void Negotiate();
+
+  void StartConfigSession();
+  bool Reconnect();
+  void RestoreDefaultBusSettings();
+  void ReplayConfigJournal(uint8_t board);
+
+  size_t GetEventFrameSize();
+  bool WriteConfigEvent(ConfigEvent* event, uint8_t sequence);
+  bool FlushConfigEvents(uint8_t board);
 
+  // Writes encoded frames, wrapped by the write_start and write_end probes.
+  int WriteFrames(const uint8_t* msg, size_t size);
+  // Writes multiple frames of a total size at once.
+  int WriteFrames(const SerialBuffer* buffers, size_t count, size_t size);
   bool SendEvent(Event* event);
+  bool SendEvents(Event** events, size_t count);
+  uint64_t GetTick(std::chrono::steady_clock::time_point time);
+  void SendLedFrames();
+  // Takes over the pulses queued by other threads, has to be called with the
+  // event queue mutex locked.
+  void AdoptPulses();
+  // Schedules the off events of the pulses that got switched on by events.
+  void StartPulses(Event** events, size_t count);
   Event* receiveEvent();
-  void PollEvents(int board);
+  bool ReceiveSwitchBank();
+  // Returns false if the board didn't respond at all.
+  bool PollEvents(int board);
+  bool IsSwitchBoard(uint8_t board);
+  void CheckBoardHealth();
+  void UpdateBoardHealth(uint8_t board, bool responded);
+  void RecoverBoard(uint8_t board);
+  void ReportBoardState(uint8_t board, uint8_t state);
+  void DecodeBoardEvent(uint8_t board, Event* event);
+  // Switches newly faulted solenoids off and calls the board event callback.
+  void ReportBoardEvents();
+  // Removes the events of faulted solenoids and returns the remaining count.
+  size_t DropFaultedEvents(Event** events, size_t count);
+  // Runs a raw switch change through the switch filter.
+  void FilterSwitchState(uint16_t number, uint8_t state);
+  void PushSwitchState(uint16_t number, uint8_t state);
+  void FireSwitchRules(uint16_t number, uint8_t state);
+  void SendUrgentEvents();
+  void PollSwitchFilter();
 
   PPUC_LogMessageCallback m_logMessageCallback = nullptr;
   const void* m_logMessageUserData = nullptr;
+  PPUC_SwitchCallback m_switchCallback = nullptr;
+  const void* m_switchUserData = nullptr;
+  RS485Comm_SentCallback m_sentCallback = nullptr;
+  const void* m_sentUserData = nullptr;
+  PPUC_BoardStateCallback m_boardStateCallback = nullptr;
+  const void* m_boardStateUserData = nullptr;
+  PPUC_SwitchRuleCallback m_switchRuleCallback = nullptr;
+  const void* m_switchRuleUserData = nullptr;
+  PPUC_BoardEventCallback m_boardEventCallback = nullptr;
+  const void* m_boardEventUserData = nullptr;
 
   uint8_t m_switchBoards[RS485_COMM_MAX_BOARDS];
   uint8_t m_switchBoardCounter = 0;
-  bool m_activeBoards[RS485_COMM_MAX_BOARDS] = {false};
+  // Written by the run thread, read by other threads as well.
+  std::atomic<bool> m_activeBoards[RS485_COMM_MAX_BOARDS];
+  uint16_t m_boardCapabilities[RS485_COMM_MAX_BOARDS] = {0};
+  // Health of the boards, maintained by the run thread.
+  uint8_t m_boardTimeouts[RS485_COMM_MAX_BOARDS] = {0};
+  std::atomic<bool> m_unresponsiveBoards[RS485_COMM_MAX_BOARDS];
+  uint64_t m_boardReprobes[RS485_COMM_MAX_BOARDS] = {0};
+  // Unresponsive boards that answered a ping, recovered after the poll.
+  uint16_t m_pongedBoards = 0;
+  uint64_t m_nextHealthCheck = 0;
+  uint8_t m_healthCheckBoard = 0;
+  uint32_t m_receivedFrames = 0;
+  LatencyHistogram m_pollLatencies[RS485_COMM_MAX_BOARDS];
+  std::atomic<uint8_t> m_unresponsiveBoardCount = 0;
+
+  // Faulted solenoids, set by the run thread and released by the host.
+  std::atomic<bool> m_faultedSolenoids[RS485_COMM_MAX_SOLENOIDS];
+  // Board events and newly faulted solenoids of the current poll.
+  std::vector<PPUCBoardEvent> m_boardEvents;
+  std::vector<uint16_t> m_faultReactions;
+  std::chrono::steady_clock::time_point m_faultReceived;
+
+  int m_baudRate = RS485_COMM_BAUD_RATE;
+  int m_configuredBaudRate = RS485_COMM_BAUD_RATE;
+  int m_maxBaudRate = 0;
+  // Timings in microseconds derived from the current baud rate.
+  uint32_t m_receiveTimeout = 8000;
+  uint32_t m_modeSwitchDelay = 0;
+
+  bool m_crc = false;
+  uint8_t m_crcMode = CRC_MODE_NONE;
+  // ConfigEvents waiting for their acknowledgement in CRC mode, the index is
+  // the sequence number.
+  std::vector<ConfigEvent*> m_configWindows[RS485_COMM_MAX_BOARDS];
+  uint32_t m_configAck = 0;
+
+  std::atomic<uint32_t> m_timeouts = 0;
+  std::atomic<uint32_t> m_resyncs = 0;
+  std::atomic<uint32_t> m_crcErrors = 0;
+  std::atomic<uint32_t> m_retransmits = 0;
+  std::atomic<uint32_t> m_reconnects = 0;
+  std::atomic<uint32_t> m_droppedEvents = 0;
+  std::atomic<uint32_t> m_polls = 0;
+  std::atomic<uint32_t> m_switchRulesFired = 0;
+  std::atomic<uint32_t> m_faults = 0;
+  std::atomic<uint32_t> m_telemetryEvents = 0;
+  std::atomic<uint32_t> m_unknownEvents = 0;
+  std::atomic<uint32_t> m_suppressedFaultEvents = 0;
+  std::atomic<uint32_t> m_faultReactionMax = 0;
+
+  std::string m_device;
+  // Set on transport errors, the run thread reopens the port in this case.
+  std::atomic<bool> m_portLost = false;
+  uint16_t m_sessionToken = 0;
+  uint16_t m_boardSessions[RS485_COMM_MAX_BOARDS] = {0};
+  // All ConfigEvents sent per board after Connect(), to configure boards
+  // again that rebooted while the port was lost.
+  std::vector<ConfigEvent> m_configJournal[RS485_COMM_MAX_BOARDS];
+  bool m_journalConfig = false;
+
+  std::vector<LedStripe*> m_ledStripes;
+  // Scratch space of the serial thread to gather the LED frames of a round.
+  std::vector<uint8_t> m_ledFrames;
+  std::vector<SerialBuffer> m_ledBuffers;
+  std::vector<LedStripe*> m_ledSentStripes;
 
   bool m_debug = false;
 
-  // Event message buffers, we need two independent for events and config events
-  // because of threading.
-  uint8_t m_msg[7];
-  uint8_t m_cmsg[12];
+  PPUCThreadConfig m_threadConfig;
+  int m_threadConfigResult = PPUC_THREAD_CONFIG_OK;
 
-  struct sp_port* m_pSerialPort;
-  struct sp_port_config* m_pSerialPortConfig;
+  uint8_t m_transport = PPUC_TRANSPORT_LIBSERIALPORT;
+  SerialTransport* m_pTransport;
   std::thread* m_pThread;
+  std::atomic<bool> m_running = false;
   std::queue<Event*> m_events;
+  std::queue<Event*> m_urgentEvents;
+  std::condition_variable m_eventQueueSpace;
+  // Positions of the events queued and dequeued so far and the range of
+  // positions of every queued frame.
+  uint64_t m_enqueued = 0;
+  uint64_t m_dequeued = 0;
+  std::atomic<uint64_t> m_sent = 0;
+  std::queue<std::pair<uint64_t, uint64_t>> m_frames;
+  std::atomic<uint8_t> m_queuePolicy = PPUC_QUEUE_POLICY_BLOCK;
+  BusAirtime m_airtime;
+  // Turnaround and pacing waits.
+  PreciseTimer m_timer;
+  // Scheduled events get handed over to the timer wheel of the run thread.
+  std::vector<std::pair<Event*, uint64_t>> m_scheduledEvents;
+  TimerWheel m_timerWheel;
+  // Pulses handed over by other threads and the ones of the run thread,
+  // indexed by their on event.
+  std::vector<std::pair<Event*, RS485Pulse>> m_newPulses;
+  std::map<Event*, RS485Pulse> m_pulses;
+  IntensityFilter m_intensityFilter;
   std::queue<PPUCSwitchState*> m_switches;
+  SwitchFilter m_switchFilter;
+  // Last known state of all switches, switch bank frames are diffed against
+  // it by the run thread.
+  SwitchBank m_switchBank;
+  std::vector<PPUCSwitchState> m_switchBankChanges;
+  std::vector<RS485SwitchRule> m_switchRules;
+  // States of the switches as seen by the rules, and which of them have been
+  // reported at least once.
+  uint8_t m_ruleSwitchStates[SWITCH_BANK_MAX_SWITCHES / 8] = {0};
+  uint8_t m_ruleSwitchesKnown[SWITCH_BANK_MAX_SWITCHES / 8] = {0};
+  // Debounced switch states released by the filter, reused by the run thread.
+  std::vector<PPUCSwitchState> m_debouncedSwitches;
   std::mutex m_eventQueueMutex;
   std::mutex m_switchesQueueMutex;
 };
\ No newline at end of file
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <inttypes.h>
+
+#include <array>
+#include <cstddef>
+
+// Table driven CRC-8 (polynomial 0x07, init 0x00) and CRC-16/CCITT-FALSE
+// (polynomial 0x1021, init 0xFFFF). The tables are generated at compile time.
+
+constexpr std::array<uint8_t, 256> MakeCrc8Table() {
+  std::array<uint8_t, 256> table = {};
+  for (int i = 0; i < 256; i++) {
+    uint8_t crc = (uint8_t)i;
+    for (int bit = 0; bit < 8; bit++) {
+      crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+    }
+    table[i] = crc;
+  }
+  return table;
+}
+
+constexpr std::array<uint16_t, 256> MakeCrc16Table() {
+  std::array<uint16_t, 256> table = {};
+  for (int i = 0; i < 256; i++) {
+    uint16_t crc = (uint16_t)(i << 8);
+    for (int bit = 0; bit < 8; bit++) {
+      crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021)
+                           : (uint16_t)(crc << 1);
+    }
+    table[i] = crc;
+  }
+  return table;
+}
+
+inline constexpr std::array<uint8_t, 256> kCrc8Table = MakeCrc8Table();
+inline constexpr std::array<uint16_t, 256> kCrc16Table = MakeCrc16Table();
+
+constexpr uint8_t Crc8(const uint8_t* data, size_t size, uint8_t crc = 0x00) {
+  for (size_t i = 0; i < size; i++) {
+    crc = kCrc8Table[crc ^ data[i]];
+  }
+  return crc;
+}
+
+constexpr uint16_t Crc16(const uint8_t* data, size_t size,
+                         uint16_t crc = 0xFFFF) {
+  for (size_t i = 0; i < size; i++) {
+    crc = (uint16_t)((crc << 8) ^ kCrc16Table[(uint8_t)(crc >> 8) ^ data[i]]);
+  }
+  return crc;
+}
+
+// Check values of the CRC catalogue for "123456789".
+inline constexpr uint8_t kCrcCheckInput[] = {'1', '2', '3', '4', '5',
+                                             '6', '7', '8', '9'};
+static_assert(Crc8(kCrcCheckInput, 9) == 0xF4);
+static_assert(Crc16(kCrcCheckInput, 9) == 0x29B1);
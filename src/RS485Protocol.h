@@ -0,0 +1,107 @@
+#pragma once
+
+// Host side extensions of the PPUC RS485 protocol which are not part of the
+// io-boards Event.h (yet). Lower case source IDs are used to not collide
+// with the upper case ones of the i/o boards firmware.
+
+#include "io-boards/Event.h"
+
+// The host requests the capabilities of a board by sending
+// Event(EVENT_CAPABILITIES, 1, board) and polling it afterwards. A board that
+// supports any extension answers with
+// Event(EVENT_CAPABILITIES, <capability bits>, board). Boards without support
+// just answer EVENT_NULL, which means no capabilities.
+#ifndef EVENT_CAPABILITIES
+#define EVENT_CAPABILITIES 99  // "c"
+#endif
+
+// Event(EVENT_BAUD_RATE, <baud rate code>, 0) is broadcasted to switch all
+// boards of a bus to a different baud rate. Boards which don't receive a
+// valid frame within RS485_COMM_BAUD_RATE_FALLBACK_TIMEOUT after a switch
+// have to fall back to RS485_COMM_BAUD_RATE on their own.
+#ifndef EVENT_BAUD_RATE
+#define EVENT_BAUD_RATE 98  // "b"
+#endif
+
+#define BAUD_RATE_CODE_DEFAULT 0
+#define BAUD_RATE_CODE_250000 1
+#define BAUD_RATE_CODE_500000 2
+#define BAUD_RATE_CODE_1000000 3
+
+#define PPUC_CAPABILITY_BAUD_250000 0x0001
+#define PPUC_CAPABILITY_BAUD_500000 0x0002
+#define PPUC_CAPABILITY_BAUD_1000000 0x0004
+#define PPUC_CAPABILITY_CRC8 0x0008
+#define PPUC_CAPABILITY_CRC16 0x0010
+#define PPUC_CAPABILITY_LED_FRAME 0x0020
+#define PPUC_CAPABILITY_SWITCH_BANK 0x0040
+
+// Event(EVENT_CRC_MODE, <crc mode>, 0) is broadcasted to switch all boards of
+// a bus to frames with a checksum in front of the stop bytes. The checksum
+// covers all bytes after the start byte. ConfigEvent frames additionally carry
+// a sequence number after the source ID in this mode.
+#ifndef EVENT_CRC_MODE
+#define EVENT_CRC_MODE 107  // "k"
+#endif
+
+#define CRC_MODE_NONE 0
+#define CRC_MODE_CRC8 1
+#define CRC_MODE_CRC16 2
+
+// In CRC mode, ConfigEvents are acknowledged. The host requests the
+// acknowledgement by sending Event(EVENT_CONFIG_ACK, 1, board) and polling the
+// board. The board answers Event(EVENT_CONFIG_ACK, <bit mask>, board), where
+// every bit represents the sequence number of a ConfigEvent that has been
+// received with a valid checksum since the previous acknowledgement.
+#ifndef EVENT_CONFIG_ACK
+#define EVENT_CONFIG_ACK 97  // "a"
+#endif
+
+// After the configuration upload, the host assigns a session token to every
+// board using Event(EVENT_CONFIG_SESSION, <token>, board). Token 0 is
+// reserved. Event(EVENT_CONFIG_SESSION, 0, board) requests the current token,
+// the board answers Event(EVENT_CONFIG_SESSION, <token>, board). A board that
+// rebooted since then doesn't know the token anymore and has to be
+// configured again.
+#ifndef EVENT_CONFIG_SESSION
+#define EVENT_CONFIG_SESSION 115  // "s"
+#endif
+
+// Variable length frame carrying colors for a LED stripe:
+// [0xFF, EVENT_LED_FRAME, board, port, length, <runs>, <crc>, 0xAA, 0x55]
+// length is the number of bytes of all runs. Every run sets count LEDs
+// starting at first to the same color:
+// [first >> 8, first & 0xFF, count, red, green, blue(, white)]
+// The white byte is only present for stripes of a RGBW LED type.
+#ifndef EVENT_LED_FRAME
+#define EVENT_LED_FRAME 108  // "l"
+#endif
+
+// Boards with PPUC_CAPABILITY_SWITCH_BANK get switched to switch bank mode
+// using Event(EVENT_SWITCH_BANK, 1, board). In this mode a board answers a
+// poll with a packed bitmap of its switches instead of a frame per changed
+// switch, and a read of all switches (EVENT_READ_SWITCHES) with a single
+// bitmap of all of them:
+// [0xFF, EVENT_SWITCH_BANK, board, first >> 8, first & 0xFF, length,
+//  <bitmap>, <crc>, 0xAA, 0x55]
+// first is the number of the first switch and a multiple of 8, length is the
+// number of bitmap bytes. Bit n of bitmap byte m is the state of switch
+// first + m * 8 + n.
+#ifndef EVENT_SWITCH_BANK
+#define EVENT_SWITCH_BANK 119  // "w"
+#endif
+
+// Boards report a fault of a solenoid as answer to a poll using
+// Event(EVENT_FAULT, <solenoid>, <fault code>) and
+// Event(EVENT_FAULT, <solenoid>, PPUC_FAULT_CLEARED) once it is gone. The
+// fault codes are the PPUC_FAULT_* ones of PPUC_structs.h.
+#ifndef EVENT_FAULT
+#define EVENT_FAULT 102  // "f"
+#endif
+
+// Readings of sensors of a board are reported as answer to a poll using
+// Event(EVENT_TELEMETRY, <reading>, <channel>). The channels are the
+// PPUC_TELEMETRY_* ones of PPUC_structs.h.
+#ifndef EVENT_TELEMETRY
+#define EVENT_TELEMETRY 116  // "t"
+#endif
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <inttypes.h>
+
+#include <chrono>
+#include <cstddef>
+
+struct SerialBuffer {
+  const uint8_t* data;
+  size_t size;
+};
+
+// Byte stream to the RS485 bus. All timeouts are given in milliseconds.
+class SerialTransport {
+ public:
+  virtual ~SerialTransport() {}
+
+  virtual bool Open(const char* device, int baudRate) = 0;
+  virtual void Close() = 0;
+  virtual bool IsOpen() = 0;
+
+  virtual bool SetBaudRate(int baudRate) = 0;
+
+  // Returns the number of bytes waiting in the input buffer or a negative
+  // value on errors.
+  virtual int InputWaiting() = 0;
+  // Waits until at least the given amount of bytes is waiting in the input
+  // buffer. Returns false if the deadline passed or on errors.
+  virtual bool WaitForInput(
+      size_t bytes, std::chrono::steady_clock::time_point deadline) = 0;
+
+  // Blocking read and write, both return the number of bytes transferred or a
+  // negative value on errors.
+  virtual int Read(uint8_t* buffer, size_t size, unsigned int timeout) = 0;
+  virtual int Write(const uint8_t* buffer, size_t size,
+                    unsigned int timeout) = 0;
+  // Writes multiple buffers at once. Returns the total number of bytes
+  // written or a negative value on errors.
+  virtual int Writev(const SerialBuffer* buffers, size_t count,
+                     unsigned int timeout) = 0;
+
+  // Waits until all output is transmitted.
+  virtual void Drain() = 0;
+  // Discards the contents of the input and output buffers.
+  virtual void Flush() = 0;
+};
@@ -0,0 +1,147 @@
+#include "SharedMemory.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+SharedMemory::SharedMemory() {}
+
+SharedMemory::~SharedMemory() { Close(); }
+
+bool SharedMemory::Create(const char* name, size_t size) {
+  return Map(name, size, true);
+}
+
+bool SharedMemory::Open(const char* name, size_t size) {
+  return Map(name, size, false);
+}
+
+#if defined(_WIN32)
+
+bool SharedMemory::Map(const char* name, size_t size, bool create) {
+  Close();
+
+  std::string mappingName = std::string("Local\\") + name;
+  if (create) {
+    m_hMapping = CreateFileMappingA(
+        INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+        (DWORD)((uint64_t)size >> 32), (DWORD)(size & 0xffffffff),
+        mappingName.c_str());
+  } else {
+    m_hMapping =
+        OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, mappingName.c_str());
+  }
+  if (m_hMapping == NULL) {
+    return false;
+  }
+
+  m_pData = MapViewOfFile(m_hMapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+  if (m_pData == NULL) {
+    CloseHandle(m_hMapping);
+    m_hMapping = nullptr;
+    return false;
+  }
+
+  m_name = name;
+  m_owner = create;
+  m_size = size;
+
+  return true;
+}
+
+void SharedMemory::Close() {
+  if (m_pData) {
+    UnmapViewOfFile(m_pData);
+    m_pData = nullptr;
+  }
+  // The mapping disappears with the last handle.
+  if (m_hMapping) {
+    CloseHandle(m_hMapping);
+    m_hMapping = nullptr;
+  }
+  m_size = 0;
+}
+
+uint32_t SharedMemory::GetProcessId() {
+  return (uint32_t)::GetCurrentProcessId();
+}
+
+bool SharedMemory::ProcessExists(uint32_t pid) {
+  HANDLE hProcess = OpenProcess(SYNCHRONIZE, FALSE, pid);
+  if (hProcess == NULL) {
+    return false;
+  }
+
+  bool running = WaitForSingleObject(hProcess, 0) == WAIT_TIMEOUT;
+  CloseHandle(hProcess);
+
+  return running;
+}
+
+#else
+
+bool SharedMemory::Map(const char* name, size_t size, bool create) {
+  Close();
+
+  // POSIX requires a leading slash for portable names.
+  std::string shmName = std::string("/") + name;
+  m_fd = shm_open(shmName.c_str(), create ? O_RDWR | O_CREAT : O_RDWR, 0660);
+  if (m_fd < 0) {
+    return false;
+  }
+
+  if (create && ftruncate(m_fd, (off_t)size) != 0) {
+    Close();
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(m_fd, &st) != 0 || (size_t)st.st_size < size) {
+    Close();
+    return false;
+  }
+
+  m_pData = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+  if (m_pData == MAP_FAILED) {
+    m_pData = nullptr;
+    Close();
+    return false;
+  }
+
+  m_name = shmName;
+  m_owner = create;
+  m_size = size;
+
+  return true;
+}
+
+void SharedMemory::Close() {
+  if (m_pData) {
+    munmap(m_pData, m_size);
+    m_pData = nullptr;
+  }
+  if (m_fd >= 0) {
+    close(m_fd);
+    m_fd = -1;
+  }
+  if (m_owner) {
+    shm_unlink(m_name.c_str());
+    m_owner = false;
+  }
+  m_size = 0;
+}
+
+uint32_t SharedMemory::GetProcessId() { return (uint32_t)getpid(); }
+
+bool SharedMemory::ProcessExists(uint32_t pid) {
+  return kill((pid_t)pid, 0) == 0 || errno == EPERM;
+}
+
+#endif
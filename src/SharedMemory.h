@@ -0,0 +1,39 @@
+#pragma once
+
+#include <inttypes.h>
+
+#include <cstddef>
+#include <string>
+
+// Named shared memory region, backed by shm_open() on POSIX systems and by a
+// paging file mapping on Windows.
+class SharedMemory {
+ public:
+  SharedMemory();
+  ~SharedMemory();
+
+  // Creates the region or opens an existing one and resizes it.
+  bool Create(const char* name, size_t size);
+  // Opens a region created by another process.
+  bool Open(const char* name, size_t size);
+  void Close();
+
+  void* GetData() { return m_pData; }
+  size_t GetSize() { return m_size; }
+
+  static uint32_t GetProcessId();
+  static bool ProcessExists(uint32_t pid);
+
+ private:
+  bool Map(const char* name, size_t size, bool create);
+
+  std::string m_name;
+  bool m_owner = false;
+  void* m_pData = nullptr;
+  size_t m_size = 0;
+#if defined(_WIN32)
+  void* m_hMapping = nullptr;
+#else
+  int m_fd = -1;
+#endif
+};
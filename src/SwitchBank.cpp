@@ -0,0 +1,58 @@
+#include "SwitchBank.h"
+
+#include <bit>
+#include <cstring>
+
+bool SwitchBank::Apply(uint16_t first, const uint8_t* bitmap, size_t length,
+                       std::vector<PPUCSwitchState>& changes) {
+  size_t offset = first / 8;
+  if (first % 8 != 0 || offset + length > sizeof(m_shadow)) {
+    return false;
+  }
+
+  // Plain byte loops the compiler vectorizes. Switches that haven't been seen
+  // yet count as changed.
+  alignas(8) uint8_t diff[sizeof(m_shadow)] = {0};
+  for (size_t i = 0; i < length; i++) {
+    diff[offset + i] =
+        (m_shadow[offset + i] ^ bitmap[i]) | (uint8_t)~m_known[offset + i];
+  }
+
+  // Skip unchanged switches 64 at a time.
+  for (size_t word = offset & ~(size_t)7; word < offset + length; word += 8) {
+    uint64_t changed;
+    memcpy(&changed, diff + word, sizeof(changed));
+    if (changed == 0) {
+      continue;
+    }
+
+    for (size_t i = word; i < word + 8; i++) {
+      uint8_t bits = diff[i];
+      while (bits) {
+        int bit = std::countr_zero(bits);
+        bits &= bits - 1;
+        changes.push_back(
+            PPUCSwitchState(i * 8 + bit, (bitmap[i - offset] >> bit) & 1));
+      }
+    }
+  }
+
+  memcpy(m_shadow + offset, bitmap, length);
+  memset(m_known + offset, 0xff, length);
+
+  return true;
+}
+
+void SwitchBank::Update(uint16_t number, uint8_t state) {
+  if (number >= SWITCH_BANK_MAX_SWITCHES) {
+    return;
+  }
+
+  uint8_t mask = (uint8_t)(1 << (number % 8));
+  if (state) {
+    m_shadow[number / 8] |= mask;
+  } else {
+    m_shadow[number / 8] &= ~mask;
+  }
+  m_known[number / 8] |= mask;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <inttypes.h>
+
+#include <cstddef>
+#include <vector>
+
+#include "PPUC_structs.h"
+
+#define SWITCH_BANK_MAX_SWITCHES 256
+
+// Shadow of the switch states of a bus. Switch bank frames are diffed against
+// it to generate the switch edges. It belongs to the serial thread.
+class SwitchBank {
+ public:
+  // Applies length bitmap bytes starting at switch first, which has to be a
+  // multiple of 8. Appends the changed switches to changes, and all switches
+  // of the range the first time they are seen. Returns false if the range is
+  // invalid.
+  bool Apply(uint16_t first, const uint8_t* bitmap, size_t length,
+             std::vector<PPUCSwitchState>& changes);
+  // Keeps the shadow up to date with switch events of boards without switch
+  // bank support.
+  void Update(uint16_t number, uint8_t state);
+
+ private:
+  alignas(8) uint8_t m_shadow[SWITCH_BANK_MAX_SWITCHES / 8] = {0};
+  // Switches whose state has been seen at least once.
+  alignas(8) uint8_t m_known[SWITCH_BANK_MAX_SWITCHES / 8] = {0};
+};
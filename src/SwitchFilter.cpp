@@ -0,0 +1,122 @@
+#include "SwitchFilter.h"
+
+void SwitchFilter::Configure(uint16_t number, uint16_t debounce,
+                             uint16_t maxRate, bool quarantine) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  SwitchState& sw = m_switches[number];
+  sw.debounce = debounce;
+  sw.maxRate = maxRate;
+  sw.quarantine = quarantine;
+}
+
+bool SwitchFilter::Process(uint16_t number, uint8_t state, uint64_t now) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto it = m_switches.find(number);
+  if (it == m_switches.end()) {
+    // Switches without a filter configuration are passed through.
+    return true;
+  }
+
+  SwitchState& sw = it->second;
+  sw.raw = state;
+  sw.lastEdge = now;
+
+  if (sw.maxRate > 0) {
+    if (now - sw.windowStart >= SWITCH_FILTER_RATE_WINDOW) {
+      sw.windowStart = now;
+      sw.windowEdges = 0;
+      if (!sw.quarantined) {
+        sw.flagged = false;
+      }
+    }
+
+    if (++sw.windowEdges > sw.maxRate && !sw.flagged) {
+      sw.flagged = true;
+      m_flaggedSwitches++;
+      if (sw.quarantine) {
+        sw.quarantined = true;
+        if (sw.pending) {
+          sw.pending = false;
+          m_pendingCount--;
+        }
+      }
+    }
+  }
+
+  if (sw.quarantined) {
+    m_filteredEdges++;
+    return false;
+  }
+
+  if (sw.debounce > 0 && now - sw.lastReported < sw.debounce) {
+    // Within the debounce time of the last reported edge. Poll() reports the
+    // state once it is stable.
+    if (!sw.pending) {
+      sw.pending = true;
+      m_pendingCount++;
+    }
+    m_filteredEdges++;
+    return false;
+  }
+
+  if (sw.pending) {
+    sw.pending = false;
+    m_pendingCount--;
+  }
+  if (state == sw.reported) {
+    m_filteredEdges++;
+    return false;
+  }
+
+  sw.reported = state;
+  sw.lastReported = now;
+  return true;
+}
+
+void SwitchFilter::Poll(uint64_t now, std::vector<PPUCSwitchState>& changes) {
+  if (m_pendingCount == 0) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  for (auto& it : m_switches) {
+    SwitchState& sw = it.second;
+    if (!sw.pending || now - sw.lastEdge < sw.debounce) {
+      continue;
+    }
+
+    sw.pending = false;
+    m_pendingCount--;
+    if (sw.raw != sw.reported) {
+      sw.reported = sw.raw;
+      sw.lastReported = now;
+      changes.push_back(PPUCSwitchState(it.first, sw.raw));
+    }
+  }
+}
+
+bool SwitchFilter::IsQuarantined(uint16_t number) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto it = m_switches.find(number);
+  return it != m_switches.end() && it->second.quarantined;
+}
+
+void SwitchFilter::Release(uint16_t number) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto it = m_switches.find(number);
+  if (it == m_switches.end() || !it->second.quarantined) {
+    return;
+  }
+
+  SwitchState& sw = it->second;
+  sw.quarantined = false;
+  sw.flagged = false;
+  sw.windowEdges = 0;
+  // Report the current state through Poll().
+  sw.lastEdge = 0;
+  sw.lastReported = 0;
+  if (!sw.pending) {
+    sw.pending = true;
+    m_pendingCount++;
+  }
+}
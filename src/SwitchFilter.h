@@ -0,0 +1,67 @@
+#pragma once
+
+#include <inttypes.h>
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include "PPUC_structs.h"
+
+// Edges per second are counted within windows of this size in ms.
+#define SWITCH_FILTER_RATE_WINDOW 1000
+
+// Host side debounce and chatter filter for the switch events of a bus. It
+// runs on the serial thread, only the quarantine can be queried and released
+// from other threads.
+class SwitchFilter {
+ public:
+  SwitchFilter() {}
+
+  // debounce is the time in ms a switch has to be stable before another edge
+  // gets reported. A switch exceeding maxRate edges per second is flagged and
+  // if quarantine is set, its edges are dropped until it gets released.
+  // 0 disables the debounce or the rate limit.
+  void Configure(uint16_t number, uint16_t debounce, uint16_t maxRate,
+                 bool quarantine);
+
+  // Returns true if the edge should be reported now. now is a tick in ms.
+  bool Process(uint16_t number, uint8_t state, uint64_t now);
+  // Appends the states of debounced switches that became stable to changes.
+  void Poll(uint64_t now, std::vector<PPUCSwitchState>& changes);
+
+  bool IsQuarantined(uint16_t number);
+  // Releases a quarantined switch. Its current state gets reported by the next
+  // Poll() if it differs from the last reported one.
+  void Release(uint16_t number);
+
+  uint32_t GetFilteredEdges() { return m_filteredEdges; }
+  uint32_t GetFlaggedSwitches() { return m_flaggedSwitches; }
+
+ private:
+  struct SwitchState {
+    uint16_t debounce = 0;
+    uint16_t maxRate = 0;
+    bool quarantine = false;
+
+    uint8_t reported = 0;
+    uint8_t raw = 0;
+    bool pending = false;
+    // Tick of the last raw edge and of the last reported edge.
+    uint64_t lastEdge = 0;
+    uint64_t lastReported = 0;
+
+    uint64_t windowStart = 0;
+    uint32_t windowEdges = 0;
+    bool flagged = false;
+    bool quarantined = false;
+  };
+
+  std::mutex m_mutex;
+  std::map<uint16_t, SwitchState> m_switches;
+  std::atomic<size_t> m_pendingCount = 0;
+
+  std::atomic<uint32_t> m_filteredEdges = 0;
+  std::atomic<uint32_t> m_flaggedSwitches = 0;
+};
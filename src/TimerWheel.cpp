@@ -0,0 +1,111 @@
+#include "TimerWheel.h"
+
+#include "io-boards/Event.h"
+
+TimerWheel::TimerWheel() {}
+
+TimerWheel::~TimerWheel() {
+  for (int i = 0; i < TIMER_WHEEL_SLOTS; i++) {
+    for (const Timer& timer : m_slots[i]) {
+      delete timer.event;
+    }
+  }
+  for (int i = 0; i < TIMER_WHEEL_LEVEL1_SLOTS; i++) {
+    for (const Timer& timer : m_level1[i]) {
+      delete timer.event;
+    }
+  }
+  for (const Timer& timer : m_overflow) {
+    delete timer.event;
+  }
+  for (Event* event : m_due) {
+    delete event;
+  }
+}
+
+void TimerWheel::Add(Event* event, uint64_t due, uint64_t now) {
+  if (m_count == 0 && now > m_current) {
+    m_current = now;
+  }
+
+  if (due < m_current) {
+    // The tick passed already.
+    m_due.push_back(event);
+  } else {
+    Insert({due, event});
+  }
+  m_count++;
+}
+
+void TimerWheel::Insert(const Timer& timer) {
+  uint64_t window = timer.due / TIMER_WHEEL_SLOTS;
+  uint64_t currentWindow = m_current / TIMER_WHEEL_SLOTS;
+
+  if (window == currentWindow) {
+    m_slots[timer.due % TIMER_WHEEL_SLOTS].push_back(timer);
+  } else if (window - currentWindow < TIMER_WHEEL_LEVEL1_SLOTS) {
+    m_level1[window % TIMER_WHEEL_LEVEL1_SLOTS].push_back(timer);
+  } else {
+    m_overflow.push_back(timer);
+  }
+}
+
+size_t TimerWheel::Advance(uint64_t now, Event** expired, size_t max) {
+  if (m_count == 0) {
+    // Nothing to process in between, skip the idle ticks.
+    if (now > m_current) {
+      m_current = now;
+    }
+    return 0;
+  }
+
+  size_t count = 0;
+  while (!m_due.empty()) {
+    if (count == max) {
+      return count;
+    }
+    expired[count++] = m_due.front();
+    m_due.pop_front();
+    m_count--;
+  }
+
+  while (m_current <= now) {
+    std::vector<Timer>& slot = m_slots[m_current % TIMER_WHEEL_SLOTS];
+    // Keep the order of events due at the same tick.
+    size_t taken = 0;
+    while (taken < slot.size() && count < max) {
+      expired[count++] = slot[taken++].event;
+    }
+    slot.erase(slot.begin(), slot.begin() + taken);
+    m_count -= taken;
+    if (!slot.empty()) {
+      // Continue with this tick next time.
+      return count;
+    }
+
+    m_current++;
+    if (m_current % TIMER_WHEEL_SLOTS == 0) {
+      // Entering a new window, move its timers to the first level.
+      uint64_t window = m_current / TIMER_WHEEL_SLOTS;
+      if (window % TIMER_WHEEL_LEVEL1_SLOTS == 0) {
+        std::vector<Timer> overflow;
+        overflow.swap(m_overflow);
+        for (const Timer& timer : overflow) {
+          Insert(timer);
+        }
+      }
+
+      std::vector<Timer> level1;
+      level1.swap(m_level1[window % TIMER_WHEEL_LEVEL1_SLOTS]);
+      for (const Timer& timer : level1) {
+        Insert(timer);
+      }
+    }
+
+    if (m_count == 0) {
+      break;
+    }
+  }
+
+  return count;
+}
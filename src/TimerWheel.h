@@ -0,0 +1,48 @@
+#pragma once
+
+#include <inttypes.h>
+
+#include <cstddef>
+#include <deque>
+#include <vector>
+
+// The first level covers 256 ticks of 1 ms, the second one 64 times that.
+// Anything further in the future waits in an overflow list.
+#define TIMER_WHEEL_SLOTS 256
+#define TIMER_WHEEL_LEVEL1_SLOTS 64
+
+struct Event;
+
+// Hierarchical timer wheel releasing events at a given tick. It is not
+// thread safe, it belongs to the serial thread.
+class TimerWheel {
+ public:
+  TimerWheel();
+  ~TimerWheel();
+
+  // now is the current tick. An empty wheel skips ahead to it, so the first
+  // event doesn't make Advance() walk all ticks since the start.
+  void Add(Event* event, uint64_t due, uint64_t now);
+  // Moves up to max events that are due at tick now into expired. Returns the
+  // number of events moved.
+  size_t Advance(uint64_t now, Event** expired, size_t max);
+
+  size_t GetCount() { return m_count; }
+
+ private:
+  struct Timer {
+    uint64_t due;
+    Event* event;
+  };
+
+  void Insert(const Timer& timer);
+
+  std::vector<Timer> m_slots[TIMER_WHEEL_SLOTS];
+  std::vector<Timer> m_level1[TIMER_WHEEL_LEVEL1_SLOTS];
+  std::vector<Timer> m_overflow;
+  // Events added for a tick that got processed already.
+  std::deque<Event*> m_due;
+  // The next tick to process.
+  uint64_t m_current = 0;
+  size_t m_count = 0;
+};
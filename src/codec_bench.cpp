@@ -0,0 +1,118 @@
+// ppuc_codec_bench measures how many event frames per second the RS485 frame
+// codec encodes and decodes in every CRC mode and checks that all of them
+// survive the round trip. It fails if the codec doesn't outrun the line rate
+// of the fastest baud rate by a wide margin.
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <vector>
+
+#include "RS485Codec.h"
+
+#define CODEC_BENCH_DEFAULT_EVENTS 1000000
+// Highest baud rate a bus gets switched to.
+#define CODEC_BENCH_BAUD_RATE 2000000
+// Encoding and decoding have to be at least this many times faster than the
+// line rate.
+#define CODEC_BENCH_MIN_MARGIN 100
+// Every nth frame gets a flipped bit to check the checksums.
+#define CODEC_BENCH_CORRUPT_EVERY 97
+
+double Seconds(std::chrono::steady_clock::time_point start,
+               std::chrono::steady_clock::time_point end) {
+  return std::chrono::duration<double>(end - start).count();
+}
+
+template <uint8_t crcMode>
+bool Run(const char* name, size_t count) {
+  constexpr size_t frameSize = RS485FrameLayout<crcMode>::kEventSize;
+
+  std::vector<RS485EventFrame> events(count);
+  std::vector<RS485EventFrame*> pointers(count);
+  for (size_t i = 0; i < count; i++) {
+    events[i].sourceId = (uint8_t)(i * 7);
+    events[i].eventId = (uint16_t)(i * 257);
+    events[i].value = (uint8_t)(i >> 8);
+    pointers[i] = &events[i];
+  }
+  std::vector<uint8_t> buffer(count * frameSize);
+  std::vector<RS485EventFrame> decoded(count);
+
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  size_t encoded = 0;
+  size_t size = EncodeEventFrames<crcMode>(buffer.data(), buffer.size(),
+                                           pointers.data(), count, &encoded);
+  std::chrono::steady_clock::time_point middle =
+      std::chrono::steady_clock::now();
+  size_t errors = 0;
+  for (size_t i = 0; i < encoded; i++) {
+    if (DecodeEventFrame<crcMode>(buffer.data() + i * frameSize,
+                                  decoded[i]) != RS485_DECODE_OK) {
+      errors++;
+    }
+  }
+  std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+  bool ok = encoded == count && size == count * frameSize && errors == 0;
+  for (size_t i = 0; ok && i < count; i++) {
+    ok = decoded[i].sourceId == events[i].sourceId &&
+         decoded[i].eventId == events[i].eventId &&
+         decoded[i].value == events[i].value;
+  }
+
+  size_t undetected = 0;
+  if (crcMode != CRC_MODE_NONE) {
+    for (size_t i = 0; i < encoded; i += CODEC_BENCH_CORRUPT_EVERY) {
+      uint8_t* msg = buffer.data() + i * frameSize;
+      msg[1 + i % 4] ^= (uint8_t)(1 << (i % 8));
+      RS485EventFrame frame;
+      if (DecodeEventFrame<crcMode>(msg, frame) != RS485_DECODE_CRC) {
+        undetected++;
+      }
+    }
+  }
+
+  double lineRate = (double)CODEC_BENCH_BAUD_RATE / 10 / frameSize;
+  double encodeRate = count / Seconds(start, middle);
+  double decodeRate = count / Seconds(middle, end);
+  printf(
+      "%-6s encode %8.2f M frames/s, decode %8.2f M frames/s, line rate "
+      "%.0f frames/s\n",
+      name, encodeRate / 1000000, decodeRate / 1000000, lineRate);
+
+  if (!ok) {
+    printf("%-6s round trip failed\n", name);
+  }
+  if (undetected > 0) {
+    printf("%-6s %zu corrupted frames not detected\n", name, undetected);
+  }
+  if (encodeRate < lineRate * CODEC_BENCH_MIN_MARGIN ||
+      decodeRate < lineRate * CODEC_BENCH_MIN_MARGIN) {
+    printf("%-6s slower than %d times the line rate\n", name,
+           CODEC_BENCH_MIN_MARGIN);
+    ok = false;
+  }
+
+  return ok && undetected == 0;
+}
+
+int main(int argc, char* argv[]) {
+  size_t count = CODEC_BENCH_DEFAULT_EVENTS;
+  if (argc > 1) {
+    count = strtoul(argv[1], nullptr, 10);
+  }
+  if (argc > 2 || count == 0) {
+    printf("Usage: ppuc_codec_bench [events]\n");
+    return 1;
+  }
+
+  bool ok = Run<CRC_MODE_NONE>("none", count);
+  ok &= Run<CRC_MODE_CRC8>("crc8", count);
+  ok &= Run<CRC_MODE_CRC16>("crc16", count);
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,55 @@
+// ppuc_link_test uses the public API like a host application linked against
+// the shared library. It only has to link and run without a bus, so
+// everything that is awaited completes right away or isn't called at all.
+
+#include <coroutine>
+#include <exception>
+
+#include "PPUC.h"
+
+// Minimal eagerly started coroutine without a result.
+struct Task {
+  struct promise_type {
+    Task get_return_object() { return Task(); }
+    std::suspend_never initial_suspend() { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+  };
+};
+
+Task AwaitConnected(PPUC& ppuc, bool& connected, bool& done) {
+  // Without a connect there is nothing to wait for.
+  connected = co_await ppuc.Connected();
+  co_await ppuc.Sent();
+  done = true;
+}
+
+Task AwaitSwitch(PPUC& ppuc, PPUCSwitchState& switchState) {
+  switchState = co_await ppuc.NextSwitchEvent();
+  switchState = co_await ppuc.SwitchChanged(1);
+}
+
+int main(int argc, char** /* argv */) {
+  PPUC ppuc;
+
+  bool connected = true;
+  bool done = false;
+  AwaitConnected(ppuc, connected, done);
+  if (!done || connected) {
+    return 1;
+  }
+
+  // Would never resume without a bus, it only has to link.
+  if (argc > 1) {
+    PPUCSwitchState switchState(0, 0);
+    AwaitSwitch(ppuc, switchState);
+  }
+
+  std::shared_ptr<const PPUCDeviceCatalog> devices = ppuc.GetDeviceCatalog();
+  if (devices->GetSwitches().Find(1) != -1 || !ppuc.GetSwitches().empty()) {
+    return 1;
+  }
+
+  return 0;
+}
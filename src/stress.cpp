@@ -0,0 +1,294 @@
+// ppuc_stress floods the RS485 buses of a machine with harmless traffic at
+// increasing rates and reports what the wiring sustains.
+//
+// With -f the library talks to fake boards behind a pseudo terminal instead
+// of a real bus, for example in CI. The fake bus needs "transport: native"
+// in the configuration on Linux.
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "PPUC.h"
+#include "RS485Codec.h"
+#include "io-boards/Event.h"
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#if defined(__APPLE__)
+#include <util.h>
+#else
+#include <pty.h>
+#endif
+
+// Boards behind a pseudo terminal that answer pings and polls like idle i/o
+// boards. They don't announce any capabilities, so the bus stays at the
+// default baud rate without checksums.
+class FakeBus {
+ public:
+  ~FakeBus() { Close(); }
+
+  bool Open(uint8_t boards) {
+    char name[128];
+    if (openpty(&m_master, &m_slave, name, nullptr, nullptr) != 0) {
+      return false;
+    }
+
+    struct termios tio;
+    tcgetattr(m_slave, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(m_slave, TCSANOW, &tio);
+
+    m_device = name;
+    m_boards = boards;
+    m_running = true;
+    m_thread = std::thread([this]() { Run(); });
+
+    return true;
+  }
+
+  void Close() {
+    m_running = false;
+    if (m_thread.joinable()) {
+      m_thread.join();
+    }
+    if (m_master >= 0) {
+      close(m_master);
+      close(m_slave);
+      m_master = -1;
+    }
+  }
+
+  const char* GetDevice() { return m_device.c_str(); }
+
+ private:
+  void Run() {
+    uint8_t frame[512];
+    size_t size = 0;
+    size_t frameSize = 0;
+
+    while (m_running) {
+      struct pollfd pfd = {m_master, POLLIN, 0};
+      if (poll(&pfd, 1, 100) <= 0) {
+        continue;
+      }
+
+      uint8_t buffer[256];
+      ssize_t length = read(m_master, buffer, sizeof(buffer));
+      for (ssize_t i = 0; i < length; i++) {
+        if (size == 0 && buffer[i] != kFrameStart) {
+          continue;
+        }
+        frame[size++] = buffer[i];
+
+        if (size == 2) {
+          frameSize = frame[1] == EVENT_CONFIGURATION
+                          ? RS485FrameLayout<CRC_MODE_NONE>::kConfigEventSize
+                          : RS485FrameLayout<CRC_MODE_NONE>::kEventSize;
+        } else if (size == 5 && frame[1] == EVENT_LED_FRAME) {
+          frameSize = RS485FrameLayout<CRC_MODE_NONE>::LedFrameSize(frame[4]);
+        }
+
+        if (size >= 2 && size == frameSize) {
+          if (frame[size - 2] == kFrameStop1 &&
+              frame[size - 1] == kFrameStop2 &&
+              frameSize == RS485FrameLayout<CRC_MODE_NONE>::kEventSize) {
+            Handle(frame[1], frame[4]);
+          }
+          size = 0;
+        }
+      }
+    }
+  }
+
+  void Handle(uint8_t sourceId, uint8_t value) {
+    if (sourceId == EVENT_PING) {
+      m_pongs = 0xffff;
+    } else if (sourceId == EVENT_POLL_EVENTS && value < m_boards) {
+      if (m_pongs & (1 << value)) {
+        m_pongs &= ~(1 << value);
+        Send(EVENT_PONG, 1, value);
+      }
+      // Like a real board, the end of the answer carries a non zero event id.
+      Send(EVENT_NULL, 1, value);
+    }
+  }
+
+  void Send(uint8_t sourceId, uint16_t eventId, uint8_t value) {
+    uint8_t msg[RS485FrameLayout<CRC_MODE_NONE>::kEventSize];
+    size_t size =
+        EncodeEventFrame<CRC_MODE_NONE>(msg, sourceId, eventId, value);
+    if (write(m_master, msg, size) != (ssize_t)size) {
+      printf("Fake bus: write failed\n");
+    }
+  }
+
+  int m_master = -1;
+  int m_slave = -1;
+  std::string m_device;
+  uint8_t m_boards = 0;
+  uint16_t m_pongs = 0;
+  std::atomic<bool> m_running = false;
+  std::thread m_thread;
+};
+#endif
+
+void CALLBACK StressCallback(const PPUCStressResult* result,
+                             const void* /* userData */) {
+  printf("%6u ev/s: %6u frames/s, %u queued, %u dropped, %u timeouts, %u "
+         "resyncs, %u crc errors\n",
+         result->rate, result->framesPerSecond, result->queued,
+         result->dropped, result->timeouts, result->resyncs,
+         result->crcErrors);
+  for (const PPUCStressBoardResult& board : result->boards) {
+    printf("        board %2u: %6u polls, latency p50 %u us, p95 %u us, p99 "
+           "%u us, max %u us\n",
+           board.board, board.polls, board.latencyP50, board.latencyP95,
+           board.latencyP99, board.latencyMax);
+  }
+  fflush(stdout);
+}
+
+void Usage() {
+  printf(
+      "Usage: ppuc_stress -c <config file> [options]\n"
+      "  -s <device>  serial device, overrides the configuration\n"
+      "  -r <rate>    events per second of the first step (500)\n"
+      "  -p <rate>    increase per step (500)\n"
+      "  -m <rate>    highest rate (10000)\n"
+      "  -d <ms>      duration of a step (5000)\n"
+      "  -l <lamps>   comma separated lamps to toggle, for example 1,2,3\n"
+      "  -n           don't stop when the bus is saturated\n"
+      "  -f <boards>  use a fake bus with boards 0 to <boards> - 1\n"
+      "  -v           debug output\n");
+}
+
+int main(int argc, char* argv[]) {
+  const char* configFile = nullptr;
+  const char* device = nullptr;
+  int fakeBoards = 0;
+  bool debug = false;
+  PPUCStressConfig config;
+
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+    if (strcmp(arg, "-n") == 0) {
+      config.stopWhenSaturated = false;
+      continue;
+    }
+    if (strcmp(arg, "-v") == 0) {
+      debug = true;
+      continue;
+    }
+    if (!value) {
+      Usage();
+      return 1;
+    }
+    i++;
+
+    if (strcmp(arg, "-c") == 0) {
+      configFile = value;
+    } else if (strcmp(arg, "-s") == 0) {
+      device = value;
+    } else if (strcmp(arg, "-r") == 0) {
+      config.startRate = atoi(value);
+    } else if (strcmp(arg, "-p") == 0) {
+      config.rateStep = atoi(value);
+    } else if (strcmp(arg, "-m") == 0) {
+      config.maxRate = atoi(value);
+    } else if (strcmp(arg, "-d") == 0) {
+      config.stepDuration = atoi(value);
+    } else if (strcmp(arg, "-l") == 0) {
+      std::string lamps = value;
+      size_t start = 0;
+      while (start < lamps.size()) {
+        size_t end = lamps.find(',', start);
+        if (end == std::string::npos) {
+          end = lamps.size();
+        }
+        config.lamps.push_back(
+            (uint8_t)atoi(lamps.substr(start, end - start).c_str()));
+        start = end + 1;
+      }
+      config.traffic |= PPUC_STRESS_TRAFFIC_LAMPS;
+    } else if (strcmp(arg, "-f") == 0) {
+      fakeBoards = atoi(value);
+    } else {
+      Usage();
+      return 1;
+    }
+  }
+
+  if (!configFile || fakeBoards < 0 || fakeBoards > 16) {
+    Usage();
+    return 1;
+  }
+
+  PPUC ppuc;
+  ppuc.LoadConfiguration(configFile);
+  ppuc.SetDebug(debug);
+
+#if !defined(_WIN32)
+  FakeBus fakeBus;
+  if (fakeBoards > 0) {
+    if (!fakeBus.Open((uint8_t)fakeBoards)) {
+      printf("Unable to create a pseudo terminal\n");
+      return 1;
+    }
+    device = fakeBus.GetDevice();
+    printf("Fake bus with %d boards on %s\n", fakeBoards, device);
+  }
+#else
+  if (fakeBoards > 0) {
+    printf("The fake bus is not available on this platform\n");
+    return 1;
+  }
+#endif
+
+  if (device) {
+    ppuc.SetSerial(device);
+  }
+  if (!ppuc.Connect()) {
+    printf("Unable to connect\n");
+    return 1;
+  }
+
+  ppuc.SetStressCallback(&StressCallback, nullptr);
+  std::vector<PPUCStressResult> results = ppuc.RunStressTest(config);
+
+  ppuc.Disconnect();
+
+  if (results.empty()) {
+    return 1;
+  }
+
+  // The last step that wasn't saturated is what the bus sustains.
+  uint32_t sustained = 0;
+  uint32_t timeouts = 0;
+  for (const PPUCStressResult& result : results) {
+    if (result.framesPerSecond * 10ull >= result.rate * 9ull &&
+        result.dropped == 0) {
+      sustained = result.rate;
+    }
+    timeouts += result.timeouts;
+  }
+  printf("Sustained rate: %u events/s\n", sustained);
+
+  // Polls that time out measure the timeout, not the bus.
+  if (timeouts > 0) {
+    printf("%u polls timed out\n", timeouts);
+    return 1;
+  }
+
+  return sustained > 0 ? 0 : 1;
+}